@@ -21,41 +21,30 @@
 #include <string.h>
 
 #include <ao/ao.h>
+#include <glib.h>
 
-#include "aoaudio.h"
+#include "audio_sink.h"
+#include "appconfig.h"
 
+typedef struct AoAudioSink_ AoAudioSink;
+struct AoAudioSink_ {
+    AudioSink hdr;
 
-static ao_device *device;
+    ao_device *device;
+};
 
-void ao_audio_close_device()
-{
-    if (device) {
-        ao_close(device);
-        device = NULL;
-
-        ao_shutdown();
-    }
-}
-
-int ao_audio_write(unsigned char *devbuf, int size)
-{
-    if (device) {
-        if (ao_play(device, (char *)devbuf, size) == 0) {
-            fprintf(stderr, "Error in ao_play()\n");
-            return -1;
-        }
-        return 0;
-    }
-
-    return -1;
-}
-
-int ao_audio_open_device(SampleInfo *sampleInfo)
+static AudioSink *
+ao_audio_open(const AudioSinkModule *self, SampleInfo *sampleInfo, const char *arg, char **error_message)
 {
     int default_driver;
     ao_sample_format format;
 
-    ao_initialize();
+    /* loading the drivers is slow, so it's only done once per process */
+    static gsize initialized = 0;
+    if (g_once_init_enter(&initialized)) {
+        ao_initialize();
+        g_once_init_leave(&initialized, 1);
+    }
 
     default_driver = ao_default_driver_id();
     memset(&format, 0, sizeof(format));
@@ -64,12 +53,61 @@ int ao_audio_open_device(SampleInfo *sampleInfo)
     format.rate = sampleInfo->samplesPerSec;
     format.byte_format = AO_FMT_LITTLE;
 
-    device = ao_open_live(default_driver, &format, NULL);
+    ao_device *device = ao_open_live(default_driver, &format, NULL);
 
     if (device == NULL) {
-        fprintf(stderr, "Cannot open default libao device\n");
-        return -1;
+        *error_message = g_strdup("Cannot open default libao device");
+        return NULL;
+    }
+
+    AoAudioSink *sink = g_new0(AoAudioSink, 1);
+    sink->device = device;
+
+    return &sink->hdr;
+}
+
+static gboolean
+ao_audio_write(AudioSink *self, const unsigned char *buf, size_t size)
+{
+    AoAudioSink *sink = (AoAudioSink *)self;
+
+    if (ao_play(sink->device, (char *)buf, size) == 0) {
+        fprintf(stderr, "Error in ao_play()\n");
+        return FALSE;
     }
 
-    return 0;
+    return TRUE;
+}
+
+static gint64
+ao_audio_get_latency(AudioSink *self)
+{
+    /* libao can't tell how much the driver buffers, so it's configured by the user */
+    return (gint64)appconfig_get_output_latency_ms() * 1000;
+}
+
+static void
+ao_audio_close(AudioSink *self)
+{
+    AoAudioSink *sink = (AoAudioSink *)self;
+
+    ao_close(sink->device);
+    g_free(sink);
+}
+
+static const AudioSinkModule
+AO_AUDIO_SINK_MODULE = {
+    .name = "ao",
+    .description = "default libao device",
+
+    .open = ao_audio_open,
+    .write = ao_audio_write,
+    .close = ao_audio_close,
+    .get_latency = ao_audio_get_latency,
+};
+
+const AudioSinkModule *
+audio_sink_module_ao(void)
+{
+    return &AO_AUDIO_SINK_MODULE;
 }
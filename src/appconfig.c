@@ -65,6 +65,21 @@ static int silence_percentage = 2;
 /* Draw moodbar in main window */
 static int show_moodbar = 1;
 
+/* Read the source file only once (front to back) when splitting */
+static int sequential_split = 0;
+
+/* How output files are flushed to disk: "none", "batch" or "syncfs" */
+static char *output_durability = NULL;
+
+/* Checksum file written next to the split files: "none", "md5" or "json" */
+static char *checksum_file = NULL;
+
+/* Audio decoded ahead of playback (in milliseconds) */
+static int playback_buffer_ms = 2000;
+
+/* Delay of the sound device, used to place the play marker (in milliseconds) */
+static int output_latency_ms = 0;
+
 /* function prototypes */
 static int appconfig_read_file();
 static void default_all_strings();
@@ -158,6 +173,62 @@ void appconfig_set_show_moodbar(int x)
     show_moodbar = x;
 }
 
+int appconfig_get_sequential_split()
+{
+    return sequential_split;
+}
+
+void appconfig_set_sequential_split(int x)
+{
+    sequential_split = x;
+}
+
+char *appconfig_get_output_durability()
+{
+    return output_durability;
+}
+
+void appconfig_set_output_durability(const char *val)
+{
+    if (output_durability != NULL) {
+        g_free(output_durability);
+    }
+    output_durability = g_strdup(val);
+}
+
+char *appconfig_get_checksum_file()
+{
+    return checksum_file;
+}
+
+void appconfig_set_checksum_file(const char *val)
+{
+    if (checksum_file != NULL) {
+        g_free(checksum_file);
+    }
+    checksum_file = g_strdup(val);
+}
+
+int appconfig_get_playback_buffer_ms()
+{
+    return playback_buffer_ms;
+}
+
+void appconfig_set_playback_buffer_ms(int x)
+{
+    playback_buffer_ms = x;
+}
+
+int appconfig_get_output_latency_ms()
+{
+    return output_latency_ms;
+}
+
+void appconfig_set_output_latency_ms(int x)
+{
+    output_latency_ms = x;
+}
+
 int appconfig_get_use_outputdir()
 {
     return use_outputdir;
@@ -276,6 +347,11 @@ struct ConfigOption_ {
 
     OPTION(silence_percentage, INTEGER),
     OPTION(show_moodbar, BOOLEAN),
+    OPTION(sequential_split, BOOLEAN),
+    OPTION(output_durability, STRING),
+    OPTION(checksum_file, STRING),
+    OPTION(playback_buffer_ms, INTEGER),
+    OPTION(output_latency_ms, INTEGER),
 #undef OPTION
     { NULL, INVALID, NULL, NULL },
 };
@@ -402,4 +478,13 @@ void default_all_strings() {
     if (appconfig_get_etree_cd_length() == NULL) {
         etree_cd_length = g_strdup("80");
     }
+    if (appconfig_get_output_durability() == NULL) {
+        output_durability = g_strdup("batch");
+    }
+    if (appconfig_get_checksum_file() == NULL) {
+        checksum_file = g_strdup("none");
+    }
+    if (appconfig_get_playback_buffer_ms() <= 0) {
+        playback_buffer_ms = 2000;
+    }
 }
@@ -59,6 +59,16 @@ int appconfig_get_silence_percentage();
 void appconfig_set_silence_percentage(int x);
 int appconfig_get_show_moodbar();
 void appconfig_set_show_moodbar(int x);
+int appconfig_get_sequential_split();
+void appconfig_set_sequential_split(int x);
+char *appconfig_get_output_durability();
+void appconfig_set_output_durability(const char *val);
+char *appconfig_get_checksum_file();
+void appconfig_set_checksum_file(const char *val);
+int appconfig_get_playback_buffer_ms();
+void appconfig_set_playback_buffer_ms(int x);
+int appconfig_get_output_latency_ms();
+void appconfig_set_output_latency_ms(int x);
 
 #endif /* APPCONFIG_H */
 
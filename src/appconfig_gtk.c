@@ -62,6 +62,12 @@ static GtkWidget *etree_cd_length_entry = NULL;
 
 static GtkWidget *silence_spin_button = NULL;
 
+static GtkWidget *sequential_split_toggle = NULL;
+static GtkWidget *output_durability_combo = NULL;
+static GtkWidget *checksum_file_combo = NULL;
+static GtkWidget *playback_buffer_spin_button = NULL;
+static GtkWidget *output_latency_spin_button = NULL;
+
 /* Forward declarations */
 static void open_select_outputdir();
 
@@ -127,6 +133,33 @@ static void prepend_file_number_toggled(GtkWidget *widget, gpointer user_data)
     }
 }
 
+static void sequential_split_toggled(GtkWidget *widget, gpointer user_data)
+{
+    if (loading_ui) {
+        return;
+    }
+
+    appconfig_set_sequential_split(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(widget)) ? 1 : 0);
+}
+
+static void output_durability_changed(GtkWidget *widget, gpointer user_data)
+{
+    if (loading_ui) {
+        return;
+    }
+
+    appconfig_set_output_durability(gtk_combo_box_get_active_id(GTK_COMBO_BOX(widget)));
+}
+
+static void checksum_file_changed(GtkWidget *widget, gpointer user_data)
+{
+    if (loading_ui) {
+        return;
+    }
+
+    appconfig_set_checksum_file(gtk_combo_box_get_active_id(GTK_COMBO_BOX(widget)));
+}
+
 static void appconfig_hide(GtkWidget *main_window)
 {
     gtk_widget_destroy(main_window);
@@ -166,6 +199,8 @@ on_appconfig_close(GtkWidget *widget, GdkEvent *event, gpointer user_data)
     appconfig_set_etree_filename_suffix(gtk_entry_get_text(GTK_ENTRY(etree_filename_suffix_entry)));
     appconfig_set_etree_cd_length(gtk_entry_get_text(GTK_ENTRY(etree_cd_length_entry)));
     appconfig_set_silence_percentage( gtk_spin_button_get_value_as_int( GTK_SPIN_BUTTON(silence_spin_button)));
+    appconfig_set_playback_buffer_ms(gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(playback_buffer_spin_button)));
+    appconfig_set_output_latency_ms(gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(output_latency_spin_button)));
 
     wavbreaker_update_listmodel();
 
@@ -242,6 +277,72 @@ void appconfig_show(GtkWidget *main_window)
     gtk_grid_attach(GTK_GRID(grid), silence_spin_button,
         1, 2, 1, 1);
 
+    sequential_split_toggle = gtk_check_button_new_with_label(_("Read input file in a single pass when saving"));
+    gtk_widget_set_tooltip_text(sequential_split_toggle,
+            _("Faster for files on rotating disks and network shares; all overwrite questions are asked before saving starts"));
+    gtk_grid_attach(GTK_GRID(grid), sequential_split_toggle,
+            0, 3, 2, 1);
+    g_signal_connect(G_OBJECT(sequential_split_toggle), "toggled",
+        G_CALLBACK(sequential_split_toggled), NULL);
+
+    label = gtk_label_new(_("Flush output files to disk:"));
+    g_object_set(G_OBJECT(label), "xalign", 0.0f, "yalign", 0.5f, NULL);
+    gtk_grid_attach(GTK_GRID(grid), label,
+        0, 4, 1, 1);
+
+    output_durability_combo = gtk_combo_box_text_new();
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(output_durability_combo), "none", _("Never"));
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(output_durability_combo), "batch", _("All files at the end"));
+#if defined(__linux__)
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(output_durability_combo), "syncfs", _("Whole filesystem at the end"));
+#endif /* __linux__ */
+    gtk_grid_attach(GTK_GRID(grid), output_durability_combo,
+        1, 4, 1, 1);
+    g_signal_connect(G_OBJECT(output_durability_combo), "changed",
+        G_CALLBACK(output_durability_changed), NULL);
+
+    label = gtk_label_new(_("Write checksum file:"));
+    g_object_set(G_OBJECT(label), "xalign", 0.0f, "yalign", 0.5f, NULL);
+    gtk_grid_attach(GTK_GRID(grid), label,
+        0, 5, 1, 1);
+
+    checksum_file_combo = gtk_combo_box_text_new();
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(checksum_file_combo), "none", _("None"));
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(checksum_file_combo), "md5", _("MD5 (md5sum format)"));
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(checksum_file_combo), "json", _("JSON (MD5, XXH64, AccurateRip)"));
+    gtk_widget_set_tooltip_text(checksum_file_combo,
+            _("Checksums are calculated while saving, and written to a file next to the output files"));
+    gtk_grid_attach(GTK_GRID(grid), checksum_file_combo,
+        1, 5, 1, 1);
+    g_signal_connect(G_OBJECT(checksum_file_combo), "changed",
+        G_CALLBACK(checksum_file_changed), NULL);
+
+    label = gtk_label_new(_("Playback buffer (in milliseconds):"));
+    g_object_set(G_OBJECT(label), "xalign", 0.0f, "yalign", 0.5f, NULL);
+    gtk_grid_attach(GTK_GRID(grid), label,
+        0, 6, 1, 1);
+
+    playback_buffer_spin_button = gtk_spin_button_new_with_range(100.0, 30000.0, 100.0);
+    gtk_spin_button_set_digits(GTK_SPIN_BUTTON(playback_buffer_spin_button), 0);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(playback_buffer_spin_button), appconfig_get_playback_buffer_ms());
+    gtk_widget_set_tooltip_text(playback_buffer_spin_button,
+            _("Audio read ahead of playback; a larger buffer avoids dropouts when the disk is busy"));
+    gtk_grid_attach(GTK_GRID(grid), playback_buffer_spin_button,
+        1, 6, 1, 1);
+
+    label = gtk_label_new(_("Sound device latency (in milliseconds):"));
+    g_object_set(G_OBJECT(label), "xalign", 0.0f, "yalign", 0.5f, NULL);
+    gtk_grid_attach(GTK_GRID(grid), label,
+        0, 7, 1, 1);
+
+    output_latency_spin_button = gtk_spin_button_new_with_range(0.0, 2000.0, 5.0);
+    gtk_spin_button_set_digits(GTK_SPIN_BUTTON(output_latency_spin_button), 0);
+    gtk_spin_button_set_value(GTK_SPIN_BUTTON(output_latency_spin_button), appconfig_get_output_latency_ms());
+    gtk_widget_set_tooltip_text(output_latency_spin_button,
+            _("The play marker is moved back by this amount, so that it matches what you hear"));
+    gtk_grid_attach(GTK_GRID(grid), output_latency_spin_button,
+        1, 7, 1, 1);
+
     /* Etree Filename Suffix */
 
     grid = gtk_grid_new();
@@ -309,6 +410,17 @@ void appconfig_show(GtkWidget *main_window)
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(prepend_file_number_toggle),
             appconfig_get_prepend_file_number() ? TRUE : FALSE);
 
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(sequential_split_toggle),
+            appconfig_get_sequential_split() ? TRUE : FALSE);
+
+    if (!gtk_combo_box_set_active_id(GTK_COMBO_BOX(output_durability_combo), appconfig_get_output_durability())) {
+        gtk_combo_box_set_active_id(GTK_COMBO_BOX(output_durability_combo), "batch");
+    }
+
+    if (!gtk_combo_box_set_active_id(GTK_COMBO_BOX(checksum_file_combo), appconfig_get_checksum_file())) {
+        gtk_combo_box_set_active_id(GTK_COMBO_BOX(checksum_file_combo), "none");
+    }
+
     gboolean use_etree = appconfig_get_use_etree_filename_suffix() ? TRUE : FALSE;
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio1), !use_etree);
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radio2), use_etree);
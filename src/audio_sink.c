@@ -0,0 +1,126 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <config.h>
+
+#include "audio_sink.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const audio_sink_module_load_func
+SINK_MODULES[] = {
+    &audio_sink_module_ao,
+    &audio_sink_module_null,
+    &audio_sink_module_file,
+};
+
+static const AudioSinkModule *
+g_default_sink = NULL;
+
+static gchar *
+g_default_sink_arg = NULL;
+
+static const AudioSinkModule *
+find_module(const char *name, size_t len)
+{
+    for (size_t i=0; i<G_N_ELEMENTS(SINK_MODULES); ++i) {
+        const AudioSinkModule *mod = SINK_MODULES[i]();
+
+        if (strlen(mod->name) == len && strncmp(mod->name, name, len) == 0) {
+            return mod;
+        }
+    }
+
+    return NULL;
+}
+
+gboolean
+audio_sink_set_default(const char *spec, char **error_message)
+{
+    const char *colon = strchr(spec, ':');
+    size_t len = (colon != NULL) ? (size_t)(colon - spec) : strlen(spec);
+
+    const AudioSinkModule *mod = find_module(spec, len);
+    if (mod == NULL) {
+        *error_message = g_strdup_printf("Unknown audio sink: %.*s", (int)len, spec);
+        return FALSE;
+    }
+
+    g_default_sink = mod;
+    g_free(g_default_sink_arg);
+    g_default_sink_arg = (colon != NULL) ? g_strdup(colon + 1) : NULL;
+
+    return TRUE;
+}
+
+AudioSink *
+audio_sink_open(SampleInfo *sample_info, char **error_message)
+{
+    const AudioSinkModule *mod = g_default_sink;
+
+    if (mod == NULL) {
+        mod = audio_sink_module_ao();
+    }
+
+    AudioSink *sink = mod->open(mod, sample_info, g_default_sink_arg, error_message);
+    if (sink != NULL) {
+        sink->mod = mod;
+    }
+
+    return sink;
+}
+
+gboolean
+audio_sink_write(AudioSink *sink, const unsigned char *buf, size_t size)
+{
+    return sink->mod->write(sink, buf, size);
+}
+
+gint64
+audio_sink_get_latency(AudioSink *sink)
+{
+    if (sink->mod->get_latency == NULL) {
+        return 0;
+    }
+
+    return sink->mod->get_latency(sink);
+}
+
+gboolean
+audio_sink_keep_open(AudioSink *sink)
+{
+    return sink->mod->keep_open;
+}
+
+void
+audio_sink_close(AudioSink *sink)
+{
+    sink->mod->close(sink);
+}
+
+void
+audio_sink_print_supported(void)
+{
+    for (size_t i=0; i<G_N_ELEMENTS(SINK_MODULES); ++i) {
+        const AudioSinkModule *mod = SINK_MODULES[i]();
+
+        printf("Sink:      %s (%s)\n", mod->name, mod->description);
+    }
+}
@@ -0,0 +1,103 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "sample_info.h"
+
+#include <glib.h>
+
+#include <stddef.h>
+
+/**
+ * Destination of played audio. The default is the libao sound device;
+ * the null and file sinks make it possible to run playback without a
+ * sound card (e.g. for measuring the playback pipeline).
+ *
+ * Sinks are selected with a spec string "name" or "name:argument":
+ *
+ *     ao             default libao device
+ *     null           discard audio as fast as it is delivered
+ *     null:realtime  discard audio at the pace of a sound card
+ *     file:PATH      write audio to a WAV file
+ **/
+
+typedef struct AudioSinkModule_ AudioSinkModule;
+typedef struct AudioSink_ AudioSink;
+
+struct AudioSinkModule_ {
+    const char *name;
+    const char *description;
+
+    /* arg is the part of the spec after the colon, or NULL */
+    AudioSink *(*open)(const AudioSinkModule *self, SampleInfo *sample_info, const char *arg, char **error_message);
+    gboolean (*write)(AudioSink *sink, const unsigned char *buf, size_t size);
+    void (*close)(AudioSink *sink);
+
+    /* Optional: time until the last written data is audible, in microseconds */
+    gint64 (*get_latency)(AudioSink *sink);
+
+    /* Set for sinks that don't hold a device, so they are not closed when idle */
+    gboolean keep_open;
+};
+
+/* Embedded as first member of module-specific structs */
+struct AudioSink_ {
+    const AudioSinkModule *mod;
+};
+
+typedef const AudioSinkModule *(*audio_sink_module_load_func)(void);
+
+const AudioSinkModule *
+audio_sink_module_ao(void);
+
+const AudioSinkModule *
+audio_sink_module_null(void);
+
+const AudioSinkModule *
+audio_sink_module_file(void);
+
+/**
+ * Select the sink used by audio_sink_open(), "ao" if never called.
+ **/
+gboolean
+audio_sink_set_default(const char *spec, char **error_message);
+
+AudioSink *
+audio_sink_open(SampleInfo *sample_info, char **error_message);
+
+gboolean
+audio_sink_write(AudioSink *sink, const unsigned char *buf, size_t size);
+
+/**
+ * Returns 0 for sinks that can't report their latency.
+ **/
+gint64
+audio_sink_get_latency(AudioSink *sink);
+
+/**
+ * Returns TRUE if the sink should stay open between playbacks.
+ **/
+gboolean
+audio_sink_keep_open(AudioSink *sink);
+
+void
+audio_sink_close(AudioSink *sink);
+
+void
+audio_sink_print_supported(void);
@@ -0,0 +1,119 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "audio_sink.h"
+#include "format_wav.h"
+
+#include <glib/gstdio.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+typedef struct FileAudioSink_ FileAudioSink;
+struct FileAudioSink_ {
+    AudioSink hdr;
+
+    FILE *fp;
+    gchar *filename;
+    SampleInfo sample_info;
+    guint64 written;
+};
+
+static AudioSink *
+file_open(const AudioSinkModule *self, SampleInfo *sample_info, const char *arg, char **error_message)
+{
+    if (arg == NULL || *arg == '\0') {
+        *error_message = g_strdup("The file audio sink needs a filename (file:PATH)");
+        return NULL;
+    }
+
+    FILE *fp = g_fopen(arg, "wb");
+    if (fp == NULL) {
+        *error_message = g_strdup_printf("Could not open %s: %s", arg, g_strerror(errno));
+        return NULL;
+    }
+
+    FileAudioSink *sink = g_new0(FileAudioSink, 1);
+
+    sink->fp = fp;
+    sink->filename = g_strdup(arg);
+    sink->sample_info = *sample_info;
+
+    /* the sizes are filled in when the sink is closed */
+    if (wav_write_file_header(fp, &sink->sample_info, 0) != 0) {
+        g_warning("Could not write WAV header to %s", arg);
+    }
+
+    return &sink->hdr;
+}
+
+static gboolean
+file_write(AudioSink *self, const unsigned char *buf, size_t size)
+{
+    FileAudioSink *sink = (FileAudioSink *)self;
+
+    if (fwrite(buf, 1, size, sink->fp) != size) {
+        g_warning("Could not write to %s: %s", sink->filename, g_strerror(errno));
+        return FALSE;
+    }
+
+    sink->written += size;
+
+    return TRUE;
+}
+
+static void
+file_close(AudioSink *self)
+{
+    FileAudioSink *sink = (FileAudioSink *)self;
+
+    /* the RIFF sizes are 32 bits */
+    unsigned long num_bytes = (unsigned long)MIN(sink->written, G_GUINT64_CONSTANT(0xFFFFFFFF) - 64);
+
+    if (fseek(sink->fp, 0, SEEK_SET) != 0 || wav_write_file_header(sink->fp, &sink->sample_info, num_bytes) != 0) {
+        g_warning("Could not update WAV header of %s", sink->filename);
+    }
+
+    if (fclose(sink->fp) != 0) {
+        g_warning("Could not close %s: %s", sink->filename, g_strerror(errno));
+    }
+
+    g_free(sink->filename);
+    g_free(sink);
+}
+
+static const AudioSinkModule
+FILE_AUDIO_SINK_MODULE = {
+    .name = "file",
+    .description = "write audio to a WAV file, \"file:PATH\"",
+
+    .open = file_open,
+    .write = file_write,
+    .close = file_close,
+
+    /* reopening would start the file over */
+    .keep_open = TRUE,
+};
+
+const AudioSinkModule *
+audio_sink_module_file(void)
+{
+    return &FILE_AUDIO_SINK_MODULE;
+}
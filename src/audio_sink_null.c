@@ -0,0 +1,122 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <config.h>
+
+#include "audio_sink.h"
+
+#include <string.h>
+
+typedef struct NullAudioSink_ NullAudioSink;
+struct NullAudioSink_ {
+    AudioSink hdr;
+
+    /* if set, write() takes as long as playing the data would */
+    gboolean realtime;
+    unsigned int bytes_per_sec;
+
+    gint64 started;
+    guint64 written;
+};
+
+static AudioSink *
+null_open(const AudioSinkModule *self, SampleInfo *sample_info, const char *arg, char **error_message)
+{
+    gboolean realtime = FALSE;
+
+    if (arg != NULL) {
+        if (strcmp(arg, "realtime") != 0) {
+            *error_message = g_strdup_printf("Invalid option for null audio sink: %s", arg);
+            return NULL;
+        }
+
+        realtime = TRUE;
+    }
+
+    NullAudioSink *sink = g_new0(NullAudioSink, 1);
+
+    sink->realtime = realtime;
+    sink->bytes_per_sec = MAX(sample_info->avgBytesPerSec, 1);
+
+    return &sink->hdr;
+}
+
+static gboolean
+null_write(AudioSink *self, const unsigned char *buf, size_t size)
+{
+    NullAudioSink *sink = (NullAudioSink *)self;
+
+    if (!sink->realtime) {
+        return TRUE;
+    }
+
+    gint64 now = g_get_monotonic_time();
+
+    if (sink->written == 0) {
+        sink->started = now;
+    }
+
+    sink->written += size;
+
+    /* like a sound card, return once the data before this buffer has been played */
+    gint64 due = sink->started + (gint64)((sink->written - size) * G_USEC_PER_SEC / sink->bytes_per_sec);
+    if (due > now) {
+        g_usleep(due - now);
+    }
+
+    return TRUE;
+}
+
+static gint64
+null_get_latency(AudioSink *self)
+{
+    NullAudioSink *sink = (NullAudioSink *)self;
+
+    if (!sink->realtime || sink->written == 0) {
+        return 0;
+    }
+
+    gint64 played_until = sink->started + (gint64)(sink->written * G_USEC_PER_SEC / sink->bytes_per_sec);
+
+    return MAX(played_until - g_get_monotonic_time(), 0);
+}
+
+static void
+null_close(AudioSink *self)
+{
+    g_free(self);
+}
+
+static const AudioSinkModule
+NULL_AUDIO_SINK_MODULE = {
+    .name = "null",
+    .description = "discard audio, \"null:realtime\" at playback speed",
+
+    .open = null_open,
+    .write = null_write,
+    .close = null_close,
+    .get_latency = null_get_latency,
+    .keep_open = TRUE,
+};
+
+const AudioSinkModule *
+audio_sink_module_null(void)
+{
+    return &NULL_AUDIO_SINK_MODULE;
+}
@@ -16,6 +16,9 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+/* fdopen(), fileno() and dup() for writing an archive to stdout */
+#define _POSIX_C_SOURCE 200809L
+
 #include "config.h"
 
 #include "track_break.h"
@@ -24,8 +27,26 @@
 #include "appinfo.h"
 #include "sample.h"
 #include "format.h"
+#include "format_io.h"
+#include "safe_output.h"
+#include "audio_sink.h"
+#include "waveform_render.h"
+#include "moodbar.h"
+#include "peaks.h"
 
 #include <stdio.h>
+#include <string.h>
+
+#if defined(CAIRO_HAS_SVG_SURFACE)
+#include <cairo-svg.h>
+#endif /* CAIRO_HAS_SVG_SURFACE */
+
+#if defined(G_OS_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif /* G_OS_WIN32 */
 
 
 static void
@@ -86,15 +107,37 @@ cmd_list(int argc, char *argv[])
 static int
 cmd_analyze(int argc, char *argv[])
 {
+    /* options come before the positional arguments */
+    while (argc > 1 && g_str_has_prefix(argv[1], "--")) {
+        if (g_str_has_prefix(argv[1], "--sink=")) {
+            char *error_message = NULL;
+            if (!audio_sink_set_default(argv[1] + strlen("--sink="), &error_message)) {
+                printf("%s\n", error_message);
+                g_free(error_message);
+                return 1;
+            }
+        } else {
+            printf("Unknown option: %s\n", argv[1]);
+            return 1;
+        }
+
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+    }
+
     if (argc != 2) {
-        printf("Usage: %s [filename.wav]\n", argv[0]);
+        printf("Usage: %s [--sink=SINK] [filename.wav]\n", argv[0]);
+        printf("\n");
+        printf("  --sink=SINK   Play the preview to SINK instead of the sound device:\n");
+        printf("                null, null:realtime or file:PATH (WAV)\n");
         return 1;
     }
 
     sample_init();
 
     char *error_message = NULL;
-    Sample *sample = sample_open(argv[1], &error_message);
+    Sample *sample = sample_open(argv[1], FALSE, &error_message);
     if (sample == NULL) {
         printf("Could not open %s: %s\n", argv[1], error_message);
         g_free(error_message);
@@ -123,22 +166,39 @@ cmd_analyze(int argc, char *argv[])
             (unsigned long long)num_sample_blocks * G_USEC_PER_SEC / analyze_duration);
 
     gint64 started = g_get_monotonic_time();
+    gint64 first_audio = 0;
 
     sample_play(sample, 0);
 
     do {
         gulong pos = sample_get_play_marker(sample);
 
+        if (first_audio == 0 && pos > 0) {
+            first_audio = g_get_monotonic_time();
+        }
+
         fprintf(stderr, "\r\033[KPreviewing... [%lu]", pos);
         fflush(stderr);
         g_usleep(G_USEC_PER_SEC / 30);
     } while (sample_is_playing(sample) && g_get_monotonic_time() < started + G_USEC_PER_SEC * 10);
 
+    gint64 play_duration = g_get_monotonic_time() - started;
+    gulong played_blocks = sample_get_play_marker(sample);
+
     fprintf(stderr, "\r\033[KPreviewing... [DONE]\n");
     fflush(stderr);
 
     sample_stop(sample);
 
+    printf("%lu sample blocks played in %.2f seconds = %.2fx realtime\n",
+            played_blocks,
+            (double)play_duration / (float)G_USEC_PER_SEC,
+            (double)played_blocks / CD_BLOCKS_PER_SEC * G_USEC_PER_SEC / play_duration);
+
+    if (first_audio != 0) {
+        printf("Playback started after %.1f ms\n", (double)(first_audio - started) / 1000.0);
+    }
+
     sample_close(sample);
 
     return 0;
@@ -148,6 +208,7 @@ struct SplitFinished {
     GMutex mutex;
     GCond cond;
     gboolean finished;
+    gboolean failed;
 };
 
 static void
@@ -170,7 +231,13 @@ split_on_file_progress_changed(double percentage, void *user_data)
 static void
 split_on_error(const char *message, void *user_data)
 {
+    struct SplitFinished *finished = user_data;
+
     g_warning("Error writing file: %s", message);
+
+    g_mutex_lock(&finished->mutex);
+    finished->failed = TRUE;
+    g_mutex_unlock(&finished->mutex);
 }
 
 static void
@@ -186,6 +253,32 @@ split_on_finished(void *user_data)
     g_mutex_unlock(&finished->mutex);
 }
 
+static void
+split_on_file_digests(const char *filename, const TrackDigests *digests, void *user_data)
+{
+    printf("\r\033[K  %s:", filename);
+
+    if (digests->md5 != NULL) {
+        printf(" md5=%s xxh64=%s", digests->md5, digests->xxh64);
+    }
+
+    if (digests->have_accuraterip) {
+        printf(" accuraterip_v1=%08x accuraterip_v2=%08x", digests->accuraterip_v1, digests->accuraterip_v2);
+    }
+
+    printf("\n");
+}
+
+static void
+split_on_file_verified(const char *filename, gboolean ok, const char *message, void *user_data)
+{
+    if (ok) {
+        printf("Verified: %s\n", filename);
+    } else {
+        printf("MISMATCH: %s: %s\n", filename, message);
+    }
+}
+
 static gboolean
 split_is_cancelled(void *user_data)
 {
@@ -215,31 +308,155 @@ split_ask_overwrite(const char *filename, void *user_data)
     }
 }
 
+static enum OverwriteDecision
+split_stream_ask_overwrite(const char *filename, void *user_data)
+{
+    /* stdin is the audio stream, we can't ask */
+    printf("\r\033[KFile '%s' exists, skipping\n", filename);
+
+    return OVERWRITE_DECISION_SKIP;
+}
+
 static int
 cmd_split(int argc, char *argv[])
 {
-    if (argc != 4) {
-        printf("Usage: %s [audio_file.wav] [track_breaks.txt] [output_folder]\n", argv[0]);
+    const char *stream_format = "wav";
+    const char *archive_filename = NULL;
+    gboolean print_checksums = FALSE;
+    gboolean verify = FALSE;
+
+    /* options come before the positional arguments */
+    while (argc > 1 && g_str_has_prefix(argv[1], "--")) {
+        enum SafeOutputDurability durability;
+
+        if (strcmp(argv[1], "--sequential") == 0) {
+            appconfig_set_sequential_split(1);
+        } else if (g_str_has_prefix(argv[1], "--durability=")) {
+            const char *value = argv[1] + strlen("--durability=");
+            if (!safe_output_parse_durability(value, &durability)) {
+                printf("Invalid durability level: %s\n", value);
+                return 1;
+            }
+            appconfig_set_output_durability(value);
+        } else if (g_str_has_prefix(argv[1], "--stream-format=")) {
+            stream_format = argv[1] + strlen("--stream-format=");
+        } else if (g_str_has_prefix(argv[1], "--tar=")) {
+            archive_filename = argv[1] + strlen("--tar=");
+        } else if (strcmp(argv[1], "--verify") == 0) {
+            verify = TRUE;
+        } else if (strcmp(argv[1], "--checksums") == 0) {
+            print_checksums = TRUE;
+        } else if (g_str_has_prefix(argv[1], "--checksum-file=")) {
+            enum TrackDigestSidecar sidecar;
+            const char *value = argv[1] + strlen("--checksum-file=");
+            if (!track_digest_parse_sidecar(value, &sidecar)) {
+                printf("Invalid checksum file type: %s\n", value);
+                return 1;
+            }
+            appconfig_set_checksum_file(value);
+        } else {
+            printf("Unknown option: %s\n", argv[1]);
+            return 1;
+        }
+
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+    }
+
+    if (verify && archive_filename != NULL) {
+        printf("--verify can't be used with --tar\n");
+        return 1;
+    }
+
+    /* an archive replaces the output folder */
+    int num_args = (archive_filename != NULL) ? 2 : 3;
+
+    if (argc != num_args && argc != num_args + 1) {
+        printf("Usage: %s [options] [audio_file.wav] [track_breaks.txt] [output_folder]\n", argv[0]);
+        printf("       %s [options] [audio_file.wav] [output_folder] (use markers embedded in the audio file)\n", argv[0]);
+        printf("       %s --tar=FILE [options] [audio_file.wav] [track_breaks.txt]\n", argv[0]);
+        printf("\n");
+        printf("  --sequential         Read the audio file only once, front to back\n");
+        printf("  --durability=LEVEL   Flush output files to disk before renaming them into\n");
+        printf("                       place: none, batch (default) or syncfs\n");
+        printf("  --stream-format=FMT  Format of the audio data if audio_file is '-' (stdin),\n");
+        printf("                       default: wav; a track break list is required\n");
+        printf("  --tar=FILE           Write all tracks into a single uncompressed tar archive\n");
+        printf("                       instead of a folder, '-' writes it to stdout\n");
+        printf("  --verify             Compare the sample data of each written file with the\n");
+        printf("                       source after splitting (WAV, AIFF and CDDA raw files)\n");
+        printf("  --checksums          Print MD5, XXH64 and AccurateRip checksums of each file\n");
+        printf("  --checksum-file=TYPE Write a checksum file next to the output files (or into\n");
+        printf("                       the archive): none (default), md5 or json\n");
+        printf("\n");
+        printf("Supported stream formats:\n");
+        format_init();
+        format_print_supported_streams();
         return 1;
     }
 
     int exitcode = 0;
 
     const char *audio_filename = argv[1];
-    const char *list_filename = argv[2];
-    const char *output_folder = argv[3];
+    const char *list_filename = (argc == num_args + 1) ? argv[2] : NULL;
+    const char *output_folder = (archive_filename == NULL) ? argv[argc - 1] : NULL;
+    gboolean streaming = (strcmp(audio_filename, "-") == 0);
+
+    FILE *archive_fp = NULL;
+    SafeOutput *archive_output = NULL;
+    SafeOutputFile *archive_file = NULL;
+
+    if (archive_filename != NULL && strcmp(archive_filename, "-") == 0) {
+        /* keep the real stdout for the archive, messages go to stderr */
+        fflush(stdout);
+        int archive_fd = dup(fileno(stdout));
+        if (archive_fd == -1 || dup2(fileno(stderr), fileno(stdout)) == -1 || (archive_fp = fdopen(archive_fd, "wb")) == NULL) {
+            printf("Could not write archive to stdout\n");
+            return 4;
+        }
+
+#if defined(G_OS_WIN32)
+        _setmode(archive_fd, _O_BINARY);
+#endif /* G_OS_WIN32 */
+    }
 
     sample_init();
 
-    if (!g_file_test(output_folder, G_FILE_TEST_IS_DIR)) {
+    if (output_folder != NULL && !g_file_test(output_folder, G_FILE_TEST_IS_DIR)) {
         printf("Directory does not exist: '%s'\n", output_folder);
         return 4;
     }
 
-    printf("Using audio file: %s\n", audio_filename);
+    if (streaming && list_filename == NULL) {
+        printf("A track break list is required when reading from stdin\n");
+        return 1;
+    }
 
     char *error_message = NULL;
-    Sample *sample = sample_open(audio_filename, &error_message);
+    Sample *sample;
+
+    if (streaming) {
+        printf("Using audio stream from stdin (%s)\n", stream_format);
+
+#if defined(G_OS_WIN32)
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif /* G_OS_WIN32 */
+
+        /* output files are named after the track break list */
+        gchar *basename = g_path_get_basename(list_filename);
+        gchar *extension = strrchr(basename, '.');
+        if (extension != NULL && extension != basename) {
+            *extension = '\0';
+        }
+
+        sample = sample_open_stream(stdin, stream_format, basename, &error_message);
+        g_free(basename);
+    } else {
+        printf("Using audio file: %s\n", audio_filename);
+        sample = sample_open(audio_filename, FALSE, &error_message);
+    }
+
     if (sample == NULL) {
         printf("Could not open %s: %s\n", argv[1], error_message);
         g_free(error_message);
@@ -248,28 +465,58 @@ cmd_split(int argc, char *argv[])
 
     sample_print_file_info(sample);
 
-    printf("Scanning audio file...\n");
-    do {
-        g_usleep(G_USEC_PER_SEC / 10);
-    } while (!sample_is_loaded(sample));
-    printf("File analyzed, %lu blocks\n", sample_get_num_sample_blocks(sample));
-
     TrackBreakList *list = track_break_list_new(sample_get_basename_without_extension(sample));
 
-    track_break_list_set_total_duration(list, sample_get_num_sample_blocks(sample));
+    if (streaming) {
+        /* length is unknown until the stream ends */
+        track_break_list_set_total_duration(list, (gulong)-1);
+    } else {
+        printf("Scanning audio file...\n");
+        do {
+            g_usleep(G_USEC_PER_SEC / 10);
+        } while (!sample_is_loaded(sample));
+        printf("File analyzed, %lu blocks\n", sample_get_num_sample_blocks(sample));
+
+        track_break_list_set_total_duration(list, sample_get_num_sample_blocks(sample));
+    }
+
+    gboolean have_list;
+    if (list_filename != NULL) {
+        printf("Using track break list: %s\n", list_filename);
+        have_list = list_read_file(list_filename, list);
+    } else {
+        printf("Using markers embedded in %s\n", audio_filename);
+        have_list = sample_read_embedded_track_breaks(sample, list);
+    }
 
-    printf("Using track break list: %s\n", list_filename);
-    if (list_read_file(list_filename, list)) {
+    if (have_list) {
         printf("Track breaks:\n");
         track_break_list_foreach(list, cmd_list_print_track_break, NULL);
         printf("\n");
 
-        printf("Using output folder: %s\n", output_folder);
+        if (archive_filename != NULL && archive_fp == NULL) {
+            enum SafeOutputDurability durability;
+            if (!safe_output_parse_durability(appconfig_get_output_durability(), &durability)) {
+                durability = SAFE_OUTPUT_DURABILITY_BATCH;
+            }
+
+            /* like split files, the archive only appears once it is complete */
+            archive_output = safe_output_new(durability);
+            archive_file = safe_output_add(archive_output, archive_filename);
+            archive_fp = fopen(safe_output_file_get_temp_filename(archive_file), "wb");
+        }
+
+        if (archive_filename != NULL) {
+            printf("Using output archive: %s\n", archive_filename);
+        } else {
+            printf("Using output folder: %s\n", output_folder);
+        }
 
         struct SplitFinished split_finished;
         g_mutex_init(&split_finished.mutex);
         g_cond_init(&split_finished.cond);
         split_finished.finished = FALSE;
+        split_finished.failed = FALSE;
 
         WriteStatusCallbacks
         write_status_callbacks = {
@@ -277,25 +524,77 @@ cmd_split(int argc, char *argv[])
             .on_file_progress_changed = split_on_file_progress_changed,
             .on_error = split_on_error,
             .on_finished = split_on_finished,
+            .on_file_digests = print_checksums ? split_on_file_digests : NULL,
 
             .is_cancelled = split_is_cancelled,
-            .ask_overwrite = split_ask_overwrite,
+            .ask_overwrite = streaming ? split_stream_ask_overwrite : split_ask_overwrite,
 
             .user_data = &split_finished,
         };
 
-        sample_write_files(sample, list, &write_status_callbacks, output_folder);
+        if (archive_filename != NULL && archive_fp == NULL) {
+            printf("Could not open %s for writing\n", archive_filename);
+            split_finished.failed = TRUE;
+        } else {
+            if (archive_fp != NULL) {
+                sample_write_archive(sample, list, &write_status_callbacks, archive_fp, archive_filename);
+            } else {
+                sample_write_files(sample, list, &write_status_callbacks, output_folder);
+            }
+
+            g_mutex_lock(&split_finished.mutex);
+            while (!split_finished.finished) {
+                g_cond_wait(&split_finished.cond, &split_finished.mutex);
+            }
+            g_mutex_unlock(&split_finished.mutex);
+        }
+
+        if (archive_fp != NULL && fclose(g_steal_pointer(&archive_fp)) != 0) {
+            split_on_error(archive_filename, &split_finished);
+        }
+
+        /* an archive that was cancelled is incomplete, but nothing failed */
+        gboolean cancelled = split_is_cancelled(&split_finished);
+        if (archive_filename != NULL && cancelled && !split_finished.failed) {
+            printf("Cancelled, %s was not completed\n", archive_filename);
+        }
+
+        if (archive_output != NULL) {
+            if (split_finished.failed || cancelled) {
+                safe_output_discard(archive_output, archive_file);
+            } else {
+                safe_output_commit(archive_output, split_on_error, &split_finished);
+            }
+            safe_output_free(archive_output);
+        }
+
+        if (archive_filename != NULL && (split_finished.failed || cancelled)) {
+            exitcode = 5;
+        }
 
-        g_mutex_lock(&split_finished.mutex);
-        while (!split_finished.finished) {
-            g_cond_wait(&split_finished.cond, &split_finished.mutex);
+        if (verify) {
+            printf("Verifying output files...\n");
+
+            int mismatches = sample_verify_files(sample, list, output_folder, split_on_file_verified, NULL);
+            if (mismatches == -1) {
+                printf("Files split from %s can't be verified\n", audio_filename);
+                exitcode = 6;
+            } else if (mismatches > 0) {
+                printf("%d file(s) do not match the source\n", mismatches);
+                exitcode = 6;
+            } else {
+                printf("All files match the source.\n");
+            }
         }
-        g_mutex_unlock(&split_finished.mutex);
+
         g_mutex_clear(&split_finished.mutex);
         g_cond_clear(&split_finished.cond);
-    } else {
+    } else if (list_filename != NULL) {
         printf("Could not open/parse %s\n", list_filename);
         exitcode = 3;
+    } else {
+        printf("No markers found in %s\n", audio_filename);
+        exitcode = 3;
     }
 
     track_break_list_free(list);
@@ -304,6 +603,382 @@ cmd_split(int argc, char *argv[])
     return exitcode;
 }
 
+static const char *
+RENDER_LIST_EXTENSIONS[] = { ".cue", ".toc", ".txt" };
+
+/**
+ * Track breaks for coloring the rendered waveform: a track break list
+ * next to the audio file with the same name, markers embedded in the
+ * file, or a single track.
+ **/
+static TrackBreakList *
+render_get_track_breaks(Sample *sample, const char *audio_filename)
+{
+    TrackBreakList *list = track_break_list_new(sample_get_basename_without_extension(sample));
+    track_break_list_set_total_duration(list, sample_get_num_sample_blocks(sample));
+
+    gchar *base_filename = g_strdup(audio_filename);
+    char *dot = strrchr(base_filename, '.');
+    if (dot != NULL && strchr(dot, G_DIR_SEPARATOR) == NULL) {
+        *dot = '\0';
+    }
+
+    gboolean have_list = FALSE;
+    for (size_t i=0; !have_list && i<G_N_ELEMENTS(RENDER_LIST_EXTENSIONS); ++i) {
+        gchar *list_filename = g_strconcat(base_filename, RENDER_LIST_EXTENSIONS[i], NULL);
+        if (g_file_test(list_filename, G_FILE_TEST_IS_REGULAR)) {
+            have_list = list_read_file(list_filename, list);
+        }
+        g_free(list_filename);
+    }
+
+    g_free(base_filename);
+
+    if (!have_list) {
+        sample_read_embedded_track_breaks(sample, list);
+    }
+
+    if (list->breaks == NULL) {
+        track_break_list_add_offset(list, TRUE, 0, NULL);
+    }
+
+    return list;
+}
+
+static gboolean
+render_write_image(cairo_surface_t *image, int width, int height, gboolean svg, const char *filename)
+{
+    cairo_status_t status;
+
+    if (svg) {
+#if defined(CAIRO_HAS_SVG_SURFACE)
+        /* the raster is embedded as it is, so both formats look the same */
+        cairo_surface_t *surface = cairo_svg_surface_create(filename, width, height);
+        cairo_t *cr = cairo_create(surface);
+        cairo_set_source_surface(cr, image, 0, 0);
+        cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        cairo_surface_finish(surface);
+        status = cairo_surface_status(surface);
+        cairo_surface_destroy(surface);
+#else
+        printf("SVG output is not supported by this build of cairo\n");
+        return FALSE;
+#endif /* CAIRO_HAS_SVG_SURFACE */
+    } else {
+        status = cairo_surface_write_to_png(image, filename);
+    }
+
+    if (status != CAIRO_STATUS_SUCCESS) {
+        printf("Could not write %s: %s\n", filename, cairo_status_to_string(status));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/**
+ * Open an audio file and wait for its analysis, with the progress on
+ * stderr. The peaks (and optionally the moodbar) of the analysis are all
+ * that "render" and "peaks" need, so the file is only decoded once.
+ **/
+static Sample *
+open_analyzed(const char *audio_filename, gboolean with_moodbar)
+{
+    char *error_message = NULL;
+    Sample *sample = sample_open(audio_filename, with_moodbar, &error_message);
+    if (sample == NULL) {
+        printf("Could not open %s: %s\n", audio_filename, error_message);
+        g_free(error_message);
+        return NULL;
+    }
+
+    do {
+        fprintf(stderr, "\r\033[KAnalyzing %s... [%3.0f%%]", sample_get_basename(sample), 100.0 * sample_get_load_percentage(sample));
+        fflush(stderr);
+        g_usleep(G_USEC_PER_SEC / 30);
+    } while (!sample_is_loaded(sample));
+
+    fprintf(stderr, "\r\033[K");
+    fflush(stderr);
+
+    return sample;
+}
+
+static gboolean
+render_file(const char *audio_filename, int width, int height, gboolean svg, gboolean moodbar, const char *output_folder)
+{
+    MoodbarData *moodbar_data = moodbar ? moodbar_open(audio_filename) : NULL;
+
+    /* the analysis only needs to compute the moodbar without a .mood file */
+    Sample *sample = open_analyzed(audio_filename, moodbar && moodbar_data == NULL);
+    if (sample == NULL) {
+        if (moodbar_data != NULL) {
+            moodbar_free(moodbar_data);
+        }
+        return FALSE;
+    }
+
+    TrackBreakList *list = render_get_track_breaks(sample, audio_filename);
+    GraphData *graph_data = sample_get_graph_data(sample);
+
+    cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    gboolean ok = (cairo_surface_status(image) == CAIRO_STATUS_SUCCESS);
+
+    if (ok) {
+        struct WaveformRaster raster;
+        waveform_raster_attach(&raster, image, width, height);
+        waveform_raster_fill(&raster, waveform_color_to_pixel(waveform_background_color));
+
+        if (graph_data != NULL && graph_data->data != NULL && graph_data->numSamples > 0) {
+            /* an existing .mood file, or else the moodbar computed by the analysis */
+            struct WaveformMoodbarLut moodbar_lut = { 0 };
+            const guint32 *moodbar_pixels = waveform_moodbar_lut_get(&moodbar_lut,
+                    moodbar_data ? moodbar_data : (moodbar ? sample_get_moodbar(sample) : NULL), width);
+
+            waveform_render_overview(&raster, graph_data, list, moodbar_pixels, FALSE, 0, 0);
+
+            waveform_moodbar_lut_clear(&moodbar_lut);
+        }
+
+        waveform_raster_end(image);
+
+        gchar *image_basename = g_strconcat(sample_get_basename_without_extension(sample), svg ? ".svg" : ".png", NULL);
+        gchar *image_filename = g_build_filename(output_folder ? output_folder : sample_get_dirname(sample), image_basename, NULL);
+
+        ok = render_write_image(image, width, height, svg, image_filename);
+        if (ok) {
+            printf("%s: %s (%d tracks)\n", audio_filename, image_filename, g_list_length(list->breaks));
+        }
+
+        g_free(image_filename);
+        g_free(image_basename);
+    } else {
+        printf("Could not create a %dx%d image\n", width, height);
+    }
+
+    cairo_surface_destroy(image);
+
+    if (moodbar_data != NULL) {
+        moodbar_free(moodbar_data);
+    }
+
+    track_break_list_free(list);
+    sample_close(sample);
+
+    return ok;
+}
+
+static int
+cmd_render(int argc, char *argv[])
+{
+    int width = 1200;
+    int height = 200;
+    gboolean svg = FALSE;
+    gboolean moodbar = FALSE;
+    const char *output_folder = NULL;
+
+    /* options come before the positional arguments */
+    while (argc > 1 && g_str_has_prefix(argv[1], "--")) {
+        if (g_str_has_prefix(argv[1], "--size=")) {
+            const char *value = argv[1] + strlen("--size=");
+            if (sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                printf("Invalid image size: %s\n", value);
+                return 1;
+            }
+        } else if (g_str_has_prefix(argv[1], "--format=")) {
+            const char *value = argv[1] + strlen("--format=");
+            if (strcmp(value, "png") == 0) {
+                svg = FALSE;
+            } else if (strcmp(value, "svg") == 0) {
+                svg = TRUE;
+            } else {
+                printf("Invalid image format: %s\n", value);
+                return 1;
+            }
+        } else if (g_str_has_prefix(argv[1], "--output-folder=")) {
+            output_folder = argv[1] + strlen("--output-folder=");
+        } else if (strcmp(argv[1], "--moodbar") == 0) {
+            moodbar = TRUE;
+        } else {
+            printf("Unknown option: %s\n", argv[1]);
+            return 1;
+        }
+
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+    }
+
+    if (argc < 2) {
+        printf("Usage: %s [options] [audio_file.wav] ...\n", argv[0]);
+        printf("\n");
+        printf("Render the waveform of each audio file to an image named after it, with\n");
+        printf("tracks colored by the track break list next to it (CUE/TOC/TXT with the\n");
+        printf("same name) or by the markers embedded in the file.\n");
+        printf("\n");
+        printf("  --size=WxH            Image size in pixels (default: 1200x200)\n");
+        printf("  --format=FMT          png (default) or svg\n");
+        printf("  --output-folder=DIR   Write the images to DIR instead of next to the\n");
+        printf("                        audio files\n");
+        printf("  --moodbar             Draw the moodbar (from the .mood file, if there\n");
+        printf("                        is one, or computed from the audio data)\n");
+        return 1;
+    }
+
+    if (output_folder != NULL && !g_file_test(output_folder, G_FILE_TEST_IS_DIR)) {
+        printf("Directory does not exist: '%s'\n", output_folder);
+        return 4;
+    }
+
+    sample_init();
+
+    int failed = 0;
+    for (int i=1; i<argc; ++i) {
+        if (!render_file(argv[i], width, height, svg, moodbar, output_folder)) {
+            ++failed;
+        }
+    }
+
+    if (failed > 0) {
+        printf("%d of %d file(s) could not be rendered\n", failed, argc - 1);
+        return 2;
+    }
+
+    return 0;
+}
+
+static gboolean
+peaks_file(const char *audio_filename, unsigned int samples_per_pixel, int bits, enum PeaksFormat format, const char *output_folder)
+{
+    Sample *sample = open_analyzed(audio_filename, FALSE);
+    if (sample == NULL) {
+        return FALSE;
+    }
+
+    gboolean ok = FALSE;
+    GraphData *graph_data = sample_get_graph_data(sample);
+    Peaks *peaks = NULL;
+
+    if (graph_data != NULL) {
+        peaks = peaks_new(graph_data, sample_get_sample_info(sample), samples_per_pixel, bits);
+    }
+
+    if (peaks != NULL && samples_per_pixel != 0 && peaks->samples_per_pixel != samples_per_pixel) {
+        fprintf(stderr, "%s: using %u instead of %u samples per pixel (a multiple of 1/75 s)\n",
+                audio_filename, peaks->samples_per_pixel, samples_per_pixel);
+    }
+
+    if (peaks == NULL) {
+        printf("Could not get the peaks of %s\n", audio_filename);
+        sample_close(sample);
+        return FALSE;
+    }
+
+    gchar *peaks_basename = g_strconcat(sample_get_basename_without_extension(sample), peaks_format_extension(format), NULL);
+    gchar *peaks_filename = g_build_filename(output_folder ? output_folder : sample_get_dirname(sample), peaks_basename, NULL);
+
+    FILE *fp = fopen(peaks_filename, "wb");
+    if (fp != NULL) {
+        ok = peaks_write(peaks, format, fp);
+        ok = (fclose(fp) == 0) && ok;
+    }
+
+    if (ok) {
+        printf("%s: %s (%lu pixels, %u samples per pixel)\n", audio_filename, peaks_filename, peaks->length, peaks->samples_per_pixel);
+    } else {
+        printf("Could not write %s\n", peaks_filename);
+    }
+
+    g_free(peaks_filename);
+    g_free(peaks_basename);
+
+    peaks_free(peaks);
+    sample_close(sample);
+
+    return ok;
+}
+
+static int
+cmd_peaks(int argc, char *argv[])
+{
+    /* 0 is one block of the analysis, the finest zoom level available */
+    int samples_per_pixel = 0;
+    int bits = 8;
+    enum PeaksFormat format = PEAKS_FORMAT_DAT;
+    const char *output_folder = NULL;
+
+    /* options come before the positional arguments */
+    while (argc > 1 && g_str_has_prefix(argv[1], "--")) {
+        if (g_str_has_prefix(argv[1], "--samples-per-pixel=")) {
+            const char *value = argv[1] + strlen("--samples-per-pixel=");
+            if (sscanf(value, "%d", &samples_per_pixel) != 1 || samples_per_pixel <= 0) {
+                printf("Invalid samples per pixel: %s\n", value);
+                return 1;
+            }
+        } else if (g_str_has_prefix(argv[1], "--bits=")) {
+            const char *value = argv[1] + strlen("--bits=");
+            if (sscanf(value, "%d", &bits) != 1 || (bits != 8 && bits != 16)) {
+                printf("Invalid number of bits: %s\n", value);
+                return 1;
+            }
+        } else if (g_str_has_prefix(argv[1], "--format=")) {
+            const char *value = argv[1] + strlen("--format=");
+            if (!peaks_parse_format(value, &format)) {
+                printf("Invalid peaks format: %s\n", value);
+                return 1;
+            }
+        } else if (g_str_has_prefix(argv[1], "--output-folder=")) {
+            output_folder = argv[1] + strlen("--output-folder=");
+        } else {
+            printf("Unknown option: %s\n", argv[1]);
+            return 1;
+        }
+
+        argv[1] = argv[0];
+        ++argv;
+        --argc;
+    }
+
+    if (argc < 2) {
+        printf("Usage: %s [options] [audio_file.wav] ...\n", argv[0]);
+        printf("\n");
+        printf("Export the waveform peaks of each audio file for web waveform players\n");
+        printf("(audiowaveform data format, as read by peaks.js and waveform-data.js),\n");
+        printf("to a file named after it.\n");
+        printf("\n");
+        printf("  --samples-per-pixel=N Zoom level, rounded to a multiple of 1/75 s\n");
+        printf("                        (default: 1/75 s, 588 samples at 44.1 kHz)\n");
+        printf("  --bits=N              8 (default) or 16 bits per value\n");
+        printf("  --format=FMT          dat (binary, default) or json\n");
+        printf("  --output-folder=DIR   Write the peaks to DIR instead of next to the\n");
+        printf("                        audio files\n");
+        return 1;
+    }
+
+    if (output_folder != NULL && !g_file_test(output_folder, G_FILE_TEST_IS_DIR)) {
+        printf("Directory does not exist: '%s'\n", output_folder);
+        return 4;
+    }
+
+    sample_init();
+
+    int failed = 0;
+    for (int i=1; i<argc; ++i) {
+        if (!peaks_file(argv[i], samples_per_pixel, bits, format, output_folder)) {
+            ++failed;
+        }
+    }
+
+    if (failed > 0) {
+        printf("Could not export the peaks of %d of %d file(s)\n", failed, argc - 1);
+        return 2;
+    }
+
+    return 0;
+}
+
 static int
 cmd_version(int argc, char *argv[])
 {
@@ -317,6 +992,12 @@ cmd_version(int argc, char *argv[])
     format_init();
     format_print_supported();
 
+    printf("\n== File I/O ==\n\n");
+    printf("Backend: %s\n", format_io_backend_name());
+
+    printf("\n== Audio output ==\n\n");
+    audio_sink_print_supported();
+
     return 0;
 }
 
@@ -341,6 +1022,8 @@ int main(int argc, char *argv[])
         { "list", cmd_list, "List track breaks from file (TXT/CUE/TOC)" },
         { "analyze", cmd_analyze, "Open, analyze and preview audio file" },
         { "split", cmd_split, "Split an audio file using a track break list to a folder" },
+        { "render", cmd_render, "Render the waveform of audio files to PNG/SVG images" },
+        { "peaks", cmd_peaks, "Export waveform peaks of audio files for web players (DAT/JSON)" },
         { "gen", cmd_wavgen, "Generate example WAV files (formerly 'wavgen')" },
         { "info", cmd_wavinfo, "Print audio format information (WAV/MP2/MP3/OGG) (formerly 'wavinfo')" },
         { "merge", cmd_wavmerge, "Merge multiple WAV files into a single file (formerly 'wavmerge')" },
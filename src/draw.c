@@ -21,97 +21,54 @@
 #include <math.h>
 
 #include "draw.h"
+#include "waveform_render.h"
 
 static void draw_sample_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawContext *ctx);
 static void draw_summary_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawContext *ctx);
+static void paint_sample_surface(struct WaveformSurface *self, cairo_t *cr, struct WaveformSurfaceDrawContext *ctx);
+static void paint_summary_surface(struct WaveformSurface *self, cairo_t *cr, struct WaveformSurfaceDrawContext *ctx);
 
-/**
- * Generated using the following Python 3 snippet (with some editing):
- *
- * import colorsys
- * for i in range(6):
- *     print('    { %3d, %3d, %3d, },' % tuple(int(x*255)
- *           for x in colorsys.hsv_to_rgb(i/8., 0.8, 0.8)))
- **/
-const unsigned char SAMPLE_COLORS_VALUES[][3] = {
-    { 204,  40,  40, },
-    { 204, 163,  40, },
-    { 122, 204,  40, },
-    {  40,  81, 204, },
-    {  40, 204, 204, },
-};
-
-#define SAMPLE_COLORS G_N_ELEMENTS(SAMPLE_COLORS_VALUES)
-
-#define SAMPLE_SHADES 3
-
-GdkRGBA sample_colors[SAMPLE_COLORS][SAMPLE_SHADES];
-GdkRGBA bg_color;
-GdkRGBA nowrite_color;
-
-static inline void
-set_cairo_source(cairo_t *cr, GdkRGBA color)
-{
-    cairo_set_source_rgb(cr, color.red, color.green, color.blue);
-}
-
-static inline void
-fill_cairo_rectangle(cairo_t *cr, GdkRGBA *color, int width, int height)
-{
-    set_cairo_source(cr, *color);
-    cairo_rectangle(cr, 0.f, 0.f, (float)width, (float)height);
-    cairo_fill(cr);
-}
-
-static inline void
-draw_cairo_line(cairo_t *cr, float x, float y0, float y1)
-{
-    cairo_move_to(cr, x-0.5f, y0);
-    cairo_line_to(cr, x-0.5f, y1);
-}
+static struct WaveformTiles *waveform_tiles_new();
+static void waveform_tiles_cancel(struct WaveformTiles *tiles);
+static void waveform_tiles_invalidate(struct WaveformTiles *tiles);
+static void waveform_tiles_damage(struct WaveformTiles *tiles, unsigned long first_block, unsigned long last_block);
+static void waveform_tiles_free(struct WaveformTiles *tiles);
 
-static void
-waveform_surface_static_init()
+static cairo_surface_t *
+waveform_raster_begin(struct WaveformRaster *raster, GtkWidget *widget, int width, int height)
 {
-    static gboolean inited = FALSE;
-    if (inited) {
-        return;
-    }
+    cairo_surface_t *surface = gdk_window_create_similar_image_surface(gtk_widget_get_window(widget),
+            CAIRO_FORMAT_RGB24, width, height, 0);
 
-    bg_color = (GdkRGBA){ .red = 1.f, .green = 1.f, .blue = 1.f };
-    nowrite_color = (GdkRGBA){ .red = 0.86f, .green = 0.86f, .blue = 0.86f };
-
-    for (int i=0; i<SAMPLE_COLORS; i++) {
-        for (int x=0; x<SAMPLE_SHADES; x++) {
-            float factor_white = 0.5f*((float)x/(float)SAMPLE_SHADES);
-            float factor_color = 1.f-factor_white;
-            sample_colors[i][x].red = SAMPLE_COLORS_VALUES[i][0]/255.f*factor_color+factor_white;
-            sample_colors[i][x].green = SAMPLE_COLORS_VALUES[i][1]/255.f*factor_color+factor_white;
-            sample_colors[i][x].blue = SAMPLE_COLORS_VALUES[i][2]/255.f*factor_color+factor_white;
+    if (surface == NULL || cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+        if (surface != NULL) {
+            cairo_surface_destroy(surface);
         }
+        return NULL;
     }
 
-    inited = TRUE;
+    waveform_raster_attach(raster, surface, width, height);
+
+    return surface;
 }
 
 struct WaveformSurface *waveform_surface_create_sample()
 {
-    waveform_surface_static_init();
-
     struct WaveformSurface *surface = calloc(sizeof(struct WaveformSurface), 1);
 
+    surface->tiles = waveform_tiles_new();
     surface->draw = draw_sample_surface;
+    surface->paint = paint_sample_surface;
 
     return surface;
 }
 
 struct WaveformSurface *waveform_surface_create_summary()
 {
-    waveform_surface_static_init();
-
     struct WaveformSurface *surface = calloc(sizeof(struct WaveformSurface), 1);
 
     surface->draw = draw_summary_surface;
+    surface->paint = paint_summary_surface;
 
     return surface;
 }
@@ -121,6 +78,18 @@ void waveform_surface_draw(struct WaveformSurface *surface, struct WaveformSurfa
     surface->draw(surface, ctx);
 }
 
+void waveform_surface_paint(struct WaveformSurface *surface, cairo_t *cr, struct WaveformSurfaceDrawContext *ctx)
+{
+    surface->paint(surface, cr, ctx);
+}
+
+void waveform_surface_cancel(struct WaveformSurface *surface)
+{
+    if (surface->tiles) {
+        waveform_tiles_cancel(surface->tiles);
+    }
+}
+
 void waveform_surface_invalidate(struct WaveformSurface *surface)
 {
     if (surface->surface) {
@@ -128,8 +97,33 @@ void waveform_surface_invalidate(struct WaveformSurface *surface)
         surface->surface = NULL;
     }
 
+    if (surface->tiles) {
+        waveform_tiles_invalidate(surface->tiles);
+    }
+
     surface->width = 0;
     surface->height = 0;
+    surface->damaged = FALSE;
+
+    waveform_moodbar_lut_clear(&surface->moodbar_lut);
+}
+
+void waveform_surface_invalidate_range(struct WaveformSurface *surface, unsigned long first_block, unsigned long last_block)
+{
+    if (surface->tiles) {
+        waveform_tiles_damage(surface->tiles, first_block, last_block);
+        return;
+    }
+
+    /* the summary repaints the union of all ranges at the next draw */
+    if (surface->damaged) {
+        surface->damage_first = MIN(surface->damage_first, first_block);
+        surface->damage_last = MAX(surface->damage_last, last_block);
+    } else {
+        surface->damage_first = first_block;
+        surface->damage_last = last_block;
+        surface->damaged = TRUE;
+    }
 }
 
 void waveform_surface_free(struct WaveformSurface *surface)
@@ -138,258 +132,644 @@ void waveform_surface_free(struct WaveformSurface *surface)
         cairo_surface_destroy(surface->surface);
     }
 
+    if (surface->tiles) {
+        waveform_tiles_free(surface->tiles);
+    }
+
+    waveform_moodbar_lut_clear(&surface->moodbar_lut);
+
     free(surface);
 }
 
-static GdkRGBA moodbar_sample_color(MoodbarData *moodbar, float position)
+long waveform_zoom_block_to_column(int zoom, long block)
 {
-    float index = position * moodbar->numFrames;
-    unsigned long iindex = index;
-    float fractional = index - iindex;
-    if (fractional == 0.f || iindex >= moodbar->numFrames - 1) {
-        return moodbar->frames[iindex];
-    } else {
-        GdkRGBA a = moodbar->frames[iindex];
-        GdkRGBA b = moodbar->frames[iindex+1];
-        return (GdkRGBA){
-            .red =   (1.f - fractional) * a.red   + fractional * b.red,
-            .green = (1.f - fractional) * a.green + fractional * b.green,
-            .blue =  (1.f - fractional) * a.blue  + fractional * b.blue,
-            .alpha = (1.f - fractional) * a.alpha + fractional * b.alpha,
-        };
+    return (zoom >= 0) ? (block << zoom) : (block >> -zoom);
+}
+
+long waveform_zoom_column_to_block(int zoom, long column)
+{
+    return (zoom >= 0) ? (column >> zoom) : (column << -zoom);
+}
+
+/**
+ * The sample view is made of tiles of a fixed width that are rendered by
+ * a worker thread and kept in a small LRU cache, so that the main thread
+ * only composites tiles that are ready. Everything a tile is rendered from
+ * is copied into its job on the main thread, except for zoomed in tiles,
+ * for which the worker reads the audio data with sample_get_peaks(). The
+ * sample must therefore not be closed before waveform_surface_cancel().
+ * The worker never touches the track break list or the moodbar.
+ **/
+#define WAVEFORM_TILE_WIDTH 256
+#define WAVEFORM_TILE_CACHE_SIZE 32
+
+struct WaveformTileKey {
+    /* the tile covers columns [index, index + 1) * WAVEFORM_TILE_WIDTH */
+    long index;
+    int zoom;
+    int height;
+    /* device pixels per logical pixel (HiDPI) */
+    int scale;
+    /* changes when the surface is invalidated */
+    guint data_revision;
+    /* changes when the moodbar is shown, hidden or replaced */
+    guint moodbar_revision;
+};
+
+struct WaveformTile {
+    struct WaveformTileKey key;
+    /* NULL while the tile is being rendered */
+    cairo_surface_t *surface;
+    guint64 last_used;
+};
+
+struct WaveformTileJob {
+    struct WaveformTileKey key;
+    /* columns with data, the rest of the tile is background */
+    int columns;
+    /* if set, the points are read from the audio data by the worker */
+    Sample *sample;
+    int xaxis;
+    int value_scale;
+    Points points[WAVEFORM_TILE_WIDTH];
+    guint8 colors[WAVEFORM_TILE_WIDTH];
+    gboolean have_moodbar;
+    guint32 moodbar[WAVEFORM_TILE_WIDTH];
+
+    /* result, NULL if the tile was not rendered */
+    cairo_surface_t *surface;
+};
+
+struct WaveformTiles {
+    GtkWidget *widget;
+    GThreadPool *pool;
+    GPtrArray *cache;
+    guint64 use_counter;
+
+    /* key of the tiles shown now, except for the index */
+    struct WaveformTileKey current;
+    /* the moodbar the current revision refers to */
+    MoodbarData *moodbar;
+    /* moodbar pixels of each block */
+    struct WaveformMoodbarLut moodbar_lut;
+
+    /* peaks of 2^(i+1) blocks each, calculated when zooming out */
+    GPtrArray *peaks;
+
+    /* jobs pushed to the worker that are not finished yet */
+    gint pending_jobs;
+
+    /* tiles outside of this range are no longer worth rendering */
+    gint first_wanted;
+    gint last_wanted;
+
+    /* rendered jobs, handed back to the main thread */
+    GMutex lock;
+    GList *finished;
+    guint finished_source_id;
+    /* signalled when pending_jobs drops, see waveform_tiles_cancel() */
+    GCond job_done;
+};
+
+static gboolean
+waveform_tile_key_equal(const struct WaveformTileKey *a, const struct WaveformTileKey *b)
+{
+    return a->index == b->index && a->zoom == b->zoom && a->height == b->height && a->scale == b->scale &&
+        a->data_revision == b->data_revision && a->moodbar_revision == b->moodbar_revision;
+}
+
+static void
+waveform_tile_free(gpointer data)
+{
+    struct WaveformTile *tile = data;
+
+    if (tile->surface) {
+        cairo_surface_destroy(tile->surface);
     }
+
+    g_free(tile);
 }
 
 static void
-draw_sample_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawContext *ctx)
+waveform_tile_job_free(struct WaveformTileJob *job)
 {
-    int xaxis;
-    int width, height;
-    int y_min, y_max;
-    int scale;
-    long i;
+    if (job->surface) {
+        cairo_surface_destroy(job->surface);
+    }
 
-    int shade;
+    g_free(job);
+}
 
-    GdkRGBA new_color;
+static gboolean
+waveform_tiles_finished(gpointer user_data);
 
-    {
-        GtkAllocation allocation;
-        gtk_widget_get_allocation(ctx->widget, &allocation);
+/* runs in the worker thread */
+static void
+waveform_tile_render(gpointer data, gpointer user_data)
+{
+    struct WaveformTileJob *job = data;
+    struct WaveformTiles *tiles = user_data;
 
-        width = allocation.width;
-        height = allocation.height;
+    if (job->key.index >= g_atomic_int_get(&tiles->first_wanted) &&
+            job->key.index <= g_atomic_int_get(&tiles->last_wanted)) {
+        cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+                WAVEFORM_TILE_WIDTH * job->key.scale, job->key.height * job->key.scale);
+
+        if (job->sample != NULL) {
+            job->columns = sample_get_peaks(job->sample, job->key.index * WAVEFORM_TILE_WIDTH,
+                    1 << job->key.zoom, job->points, job->columns);
+        }
+
+        if (cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS) {
+            struct WaveformRaster raster;
+
+            cairo_surface_set_device_scale(surface, job->key.scale, job->key.scale);
+            waveform_raster_attach(&raster, surface, WAVEFORM_TILE_WIDTH, job->key.height);
+
+            waveform_raster_fill(&raster, waveform_color_to_pixel(waveform_background_color));
+
+            for (int i=0; i<job->columns; i++) {
+                int y_min = job->xaxis + fabs((double)job->points[i].min) / job->value_scale;
+                int y_max = job->xaxis - job->points[i].max / job->value_scale;
+
+                if (job->have_moodbar) {
+                    waveform_raster_fill_span(&raster, i, 0, job->key.height, job->moodbar[i]);
+                }
+
+                waveform_raster_draw_column(&raster, i, y_min, y_max, job->xaxis, job->colors[i]);
+            }
+
+            waveform_raster_end(surface);
+            job->surface = surface;
+        } else {
+            cairo_surface_destroy(surface);
+        }
     }
 
-    if (self->surface != NULL && self->width == width && self->height == height && self->offset == ctx->pixmap_offset &&
-        (ctx->moodbarData && ctx->moodbarData->numFrames) == self->moodbar) {
-        return;
+    g_mutex_lock(&tiles->lock);
+    tiles->finished = g_list_prepend(tiles->finished, job);
+    if (tiles->finished_source_id == 0) {
+        tiles->finished_source_id = g_idle_add(waveform_tiles_finished, tiles);
+    }
+    g_atomic_int_add(&tiles->pending_jobs, -1);
+    g_cond_signal(&tiles->job_done);
+    g_mutex_unlock(&tiles->lock);
+}
+
+static struct WaveformTiles *
+waveform_tiles_new()
+{
+    struct WaveformTiles *tiles = g_new0(struct WaveformTiles, 1);
+
+    tiles->pool = g_thread_pool_new(waveform_tile_render, tiles, 1, FALSE, NULL);
+    tiles->cache = g_ptr_array_new_with_free_func(waveform_tile_free);
+    tiles->peaks = g_ptr_array_new_with_free_func(g_free);
+    g_mutex_init(&tiles->lock);
+    g_cond_init(&tiles->job_done);
+
+    return tiles;
+}
+
+static void
+waveform_tiles_cancel(struct WaveformTiles *tiles)
+{
+    /* let the worker skip all queued jobs, and wait for the one it is rendering */
+    g_atomic_int_set(&tiles->first_wanted, 1);
+    g_atomic_int_set(&tiles->last_wanted, 0);
+
+    g_mutex_lock(&tiles->lock);
+    while (g_atomic_int_get(&tiles->pending_jobs) > 0) {
+        g_cond_wait(&tiles->job_done, &tiles->lock);
     }
+    g_mutex_unlock(&tiles->lock);
+}
+
+static void
+waveform_tiles_invalidate(struct WaveformTiles *tiles)
+{
+    /* old tiles are still painted until their replacements are ready */
+    tiles->current.data_revision++;
+
+    g_ptr_array_set_size(tiles->peaks, 0);
+    waveform_moodbar_lut_clear(&tiles->moodbar_lut);
+}
+
+/**
+ * Re-render the tiles with columns starting at one of the blocks, all
+ * other tiles stay valid. Damaged tiles are painted until their
+ * replacement is ready; tiles that are being rendered are dropped, as
+ * their job already has the old colors.
+ **/
+static void
+waveform_tiles_damage(struct WaveformTiles *tiles, unsigned long first_block, unsigned long last_block)
+{
+    for (guint i=0; i<tiles->cache->len; ) {
+        struct WaveformTile *tile = g_ptr_array_index(tiles->cache, i);
+        long start = tile->key.index * WAVEFORM_TILE_WIDTH;
+
+        unsigned long tile_first = waveform_zoom_column_to_block(tile->key.zoom, start);
+        unsigned long tile_last = waveform_zoom_column_to_block(tile->key.zoom, start + WAVEFORM_TILE_WIDTH - 1);
 
-    if (self->surface) {
-        cairo_surface_destroy(self->surface);
+        if (tile_first > last_block || tile_last < first_block) {
+            i++;
+        } else if (tile->surface == NULL) {
+            g_ptr_array_remove_index_fast(tiles->cache, i);
+        } else {
+            /* revisions only ever increase, so this key is never requested again */
+            tile->key.data_revision = tiles->current.data_revision - 1;
+            i++;
+        }
     }
+}
 
-    self->surface = gdk_window_create_similar_surface(gtk_widget_get_window(ctx->widget),
-            CAIRO_CONTENT_COLOR, width, height);
+static void
+waveform_tiles_free(struct WaveformTiles *tiles)
+{
+    waveform_tiles_cancel(tiles);
+    g_thread_pool_free(tiles->pool, FALSE, TRUE);
 
-    if (!self->surface) {
-        printf("surface is NULL\n");
-        return;
+    if (tiles->finished_source_id) {
+        g_source_remove(tiles->finished_source_id);
     }
 
-    cairo_t *cr = cairo_create(self->surface);
-    cairo_set_line_width(cr, 1.f);
+    for (GList *cur = tiles->finished; cur != NULL; cur = g_list_next(cur)) {
+        waveform_tile_job_free(cur->data);
+    }
+    g_list_free(tiles->finished);
+
+    g_mutex_clear(&tiles->lock);
+    g_cond_clear(&tiles->job_done);
+    g_ptr_array_free(tiles->cache, TRUE);
+    g_ptr_array_free(tiles->peaks, TRUE);
+    waveform_moodbar_lut_clear(&tiles->moodbar_lut);
+    g_free(tiles);
+}
+
+static struct WaveformTile *
+waveform_tiles_lookup(struct WaveformTiles *tiles, const struct WaveformTileKey *key)
+{
+    for (guint i=0; i<tiles->cache->len; i++) {
+        struct WaveformTile *tile = g_ptr_array_index(tiles->cache, i);
 
-    /* clear sample_surface before drawing */
-    fill_cairo_rectangle(cr, &bg_color, width, height);
+        if (waveform_tile_key_equal(&tile->key, key)) {
+            return tile;
+        }
+    }
+
+    return NULL;
+}
 
-    if (ctx->graphData == NULL || ctx->graphData->data == NULL) {
-        cairo_destroy(cr);
+/* most recent ready tile of the same place and size, painted while the current one is rendered */
+static struct WaveformTile *
+waveform_tiles_lookup_stale(struct WaveformTiles *tiles, const struct WaveformTileKey *key)
+{
+    struct WaveformTile *result = NULL;
+
+    for (guint i=0; i<tiles->cache->len; i++) {
+        struct WaveformTile *tile = g_ptr_array_index(tiles->cache, i);
+
+        if (tile->surface != NULL && tile->key.index == key->index && tile->key.zoom == key->zoom && tile->key.height == key->height &&
+                tile->key.scale == key->scale && (result == NULL || tile->last_used > result->last_used)) {
+            result = tile;
+        }
+    }
+
+    return result;
+}
+
+static void
+waveform_tiles_evict(struct WaveformTiles *tiles)
+{
+    while (tiles->cache->len > WAVEFORM_TILE_CACHE_SIZE) {
+        guint victim = G_MAXUINT;
+
+        for (guint i=0; i<tiles->cache->len; i++) {
+            struct WaveformTile *tile = g_ptr_array_index(tiles->cache, i);
+
+            /* tiles that are being rendered are removed when they are finished */
+            if (tile->surface != NULL && (victim == G_MAXUINT ||
+                    tile->last_used < ((struct WaveformTile *)g_ptr_array_index(tiles->cache, victim))->last_used)) {
+                victim = i;
+            }
+        }
+
+        if (victim == G_MAXUINT) {
+            break;
+        }
+
+        g_ptr_array_remove_index_fast(tiles->cache, victim);
+    }
+}
+
+static gboolean
+waveform_tiles_finished(gpointer user_data)
+{
+    struct WaveformTiles *tiles = user_data;
+    gboolean updated = FALSE;
+
+    g_mutex_lock(&tiles->lock);
+    GList *finished = g_steal_pointer(&tiles->finished);
+    tiles->finished_source_id = 0;
+    g_mutex_unlock(&tiles->lock);
+
+    for (GList *cur = finished; cur != NULL; cur = g_list_next(cur)) {
+        struct WaveformTileJob *job = cur->data;
+        struct WaveformTile *tile = waveform_tiles_lookup(tiles, &job->key);
+
+        if (tile != NULL && tile->surface == NULL) {
+            if (job->surface != NULL) {
+                tile->surface = g_steal_pointer(&job->surface);
+                updated = TRUE;
+            } else {
+                g_ptr_array_remove_fast(tiles->cache, tile);
+            }
+        }
+
+        waveform_tile_job_free(job);
+    }
+    g_list_free(finished);
+
+    waveform_tiles_evict(tiles);
+
+    if (updated && tiles->widget != NULL) {
+        gtk_widget_queue_draw(tiles->widget);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/* start a new revision when the moodbar changed since the last redraw */
+static void
+waveform_tiles_update_revisions(struct WaveformTiles *tiles, struct WaveformSurfaceDrawContext *ctx)
+{
+    MoodbarData *moodbar = (ctx->moodbarData && ctx->moodbarData->numFrames) ? ctx->moodbarData : NULL;
+    if (moodbar != tiles->moodbar) {
+        tiles->moodbar = moodbar;
+        tiles->current.moodbar_revision++;
+    }
+}
+
+/* peaks when zoomed out to 2^level blocks per column, NULL if not available */
+static const Points *
+waveform_tiles_get_peaks(struct WaveformTiles *tiles, GraphData *graphData, int level)
+{
+    if (level == 0) {
+        return graphData->data;
+    }
+
+    /* each level is calculated from the one below, the first time it is needed */
+    while (tiles->peaks->len < level) {
+        int l = tiles->peaks->len + 1;
+        const Points *src = waveform_tiles_get_peaks(tiles, graphData, l - 1);
+        long src_size = waveform_zoom_block_to_column(-(l - 1), graphData->numSamples + (1L << (l - 1)) - 1);
+        long size = (src_size + 1) / 2;
+        Points *dst = g_new(Points, MAX(size, 1));
+
+        for (long i=0; i<size; i++) {
+            dst[i] = src[2*i];
+
+            if (2*i + 1 < src_size) {
+                dst[i].min = MIN(dst[i].min, src[2*i + 1].min);
+                dst[i].max = MAX(dst[i].max, src[2*i + 1].max);
+            }
+        }
+
+        g_ptr_array_add(tiles->peaks, dst);
+    }
+
+    return g_ptr_array_index(tiles->peaks, level - 1);
+}
+
+/* number of columns of the whole file at the current zoom level */
+static long
+waveform_tiles_get_columns(struct WaveformSurfaceDrawContext *ctx)
+{
+    if (ctx->zoom < 0) {
+        /* the last column may be partial */
+        return waveform_zoom_block_to_column(ctx->zoom, ctx->graphData->numSamples + (1L << -ctx->zoom) - 1);
+    }
+
+    return waveform_zoom_block_to_column(ctx->zoom, ctx->graphData->numSamples);
+}
+
+static void
+waveform_tiles_request(struct WaveformTiles *tiles, struct WaveformSurfaceDrawContext *ctx, long index)
+{
+    struct WaveformTileKey key = tiles->current;
+    key.index = index;
+
+    struct WaveformTile *tile = waveform_tiles_lookup(tiles, &key);
+    if (tile != NULL) {
+        tile->last_used = ++tiles->use_counter;
         return;
     }
 
-    xaxis = height / 2;
-    if (xaxis != 0) {
-        scale = ctx->graphData->maxSampleValue / xaxis;
-        if (scale == 0) {
-            scale = 1;
+    struct WaveformTileJob *job = g_new0(struct WaveformTileJob, 1);
+    GraphData *graphData = ctx->graphData;
+    long start = index * WAVEFORM_TILE_WIDTH;
+    const Points *peaks = NULL;
+    const guint32 *moodbar_pixels = waveform_moodbar_lut_get(&tiles->moodbar_lut, tiles->moodbar, graphData->numSamples);
+
+    job->key = key;
+    job->columns = CLAMP(waveform_tiles_get_columns(ctx) - start, 0, WAVEFORM_TILE_WIDTH);
+    job->have_moodbar = (tiles->moodbar != NULL);
+
+    if (key.zoom > 0) {
+        /* finer than the graph data, read from the audio data by the worker */
+        job->sample = ctx->sample;
+        if (job->sample == NULL) {
+            job->columns = 0;
         }
     } else {
-        scale = 1;
+        peaks = waveform_tiles_get_peaks(tiles, graphData, -key.zoom);
+    }
+
+    job->xaxis = key.height / 2;
+    if (job->xaxis != 0) {
+        job->value_scale = graphData->maxSampleValue / job->xaxis;
+        if (job->value_scale == 0) {
+            job->value_scale = 1;
+        }
+    } else {
+        job->value_scale = 1;
     }
 
-    /* draw sample graph */
     int tb_index = 0;
     GList *tbl = ctx->list->breaks;
-    for (i = 0; i < width && i < ctx->graphData->numSamples; i++) {
-        y_min = ctx->graphData->data[i + ctx->pixmap_offset].min;
-        y_max = ctx->graphData->data[i + ctx->pixmap_offset].max;
+    for (int i=0; i<job->columns; i++) {
+        long block = waveform_zoom_column_to_block(key.zoom, start + i);
 
-        y_min = xaxis + fabs((double)y_min) / scale;
-        y_max = xaxis - y_max / scale;
+        if (peaks != NULL) {
+            job->points[i] = peaks[start + i];
+        }
 
         /* find the track break we are drawing now */
-        while (tbl->next && (i + ctx->pixmap_offset) > ((TrackBreak *)(tbl->next->data))->offset) {
+        while (tbl->next && block > ((TrackBreak *)(tbl->next->data))->offset) {
             tbl = tbl->next;
             ++tb_index;
         }
 
-        if (ctx->moodbarData && ctx->moodbarData->numFrames) {
-            set_cairo_source(cr, moodbar_sample_color(ctx->moodbarData, (float)(i+ctx->pixmap_offset) / (float)ctx->graphData->numSamples));
-            draw_cairo_line(cr, i, 0.f, height);
-            cairo_stroke(cr);
-        }
-
-        for( shade=0; shade<SAMPLE_SHADES; shade++) {
-            TrackBreak *tb = tbl->data;
-            if (tb->write) {
-                new_color = sample_colors[tb_index % SAMPLE_COLORS][shade];
-            } else {
-                new_color = nowrite_color;
-            }
+        job->colors[i] = waveform_track_color(tbl->data, tb_index);
 
-            set_cairo_source(cr, new_color);
-            draw_cairo_line(cr, i, y_min+(xaxis-y_min)*shade/SAMPLE_SHADES, y_min+(xaxis-y_min)*(shade+1)/SAMPLE_SHADES);
-            draw_cairo_line(cr, i, y_max-(y_max-xaxis)*shade/SAMPLE_SHADES, y_max-(y_max-xaxis)*(shade+1)/SAMPLE_SHADES);
-            cairo_stroke(cr);
+        if (job->have_moodbar) {
+            job->moodbar[i] = moodbar_pixels[MIN((unsigned long)block, graphData->numSamples - 1)];
         }
     }
 
-    cairo_destroy(cr);
+    tile = g_new0(struct WaveformTile, 1);
+    tile->key = key;
+    tile->last_used = ++tiles->use_counter;
+    g_ptr_array_add(tiles->cache, tile);
 
-    self->width = width;
-    self->height = height;
-    self->offset = ctx->pixmap_offset;
-    self->moodbar = ctx->moodbarData && ctx->moodbarData->numFrames;
+    g_atomic_int_add(&tiles->pending_jobs, 1);
+    g_thread_pool_push(tiles->pool, job, NULL);
 }
 
 static void
-draw_summary_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawContext *ctx)
+draw_sample_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawContext *ctx)
 {
-    int xaxis;
+    struct WaveformTiles *tiles = self->tiles;
     int width, height;
-    int y_min, y_max;
-    int min, max;
-    int scale;
-    int i, k;
-    int loop_end, array_offset;
-    int shade;
-
-    float x_scale;
-
-    GdkRGBA new_color;
+    long offset, first, last;
 
     {
         GtkAllocation allocation;
         gtk_widget_get_allocation(ctx->widget, &allocation);
+
         width = allocation.width;
         height = allocation.height;
     }
 
-    if (self->surface != NULL && self->width == width && self->height == height &&
-        (ctx->moodbarData && ctx->moodbarData->numFrames) == self->moodbar) {
+    tiles->widget = ctx->widget;
+    tiles->current.zoom = ctx->zoom;
+    tiles->current.height = height;
+    tiles->current.scale = MAX(gtk_widget_get_scale_factor(ctx->widget), 1);
+    waveform_tiles_update_revisions(tiles, ctx);
+
+    self->width = width;
+    self->height = height;
+    self->offset = ctx->pixmap_offset;
+    self->moodbar = (tiles->moodbar != NULL);
+
+    if (ctx->graphData == NULL || ctx->graphData->data == NULL || ctx->graphData->numSamples == 0 ||
+            width <= 0 || height <= 0) {
         return;
     }
 
-    if (self->surface) {
-        cairo_surface_destroy(self->surface);
+    /* the visible tiles and one more on each side for scrolling */
+    offset = ctx->pixmap_offset;
+    first = MAX(offset / WAVEFORM_TILE_WIDTH - 1, 0);
+    last = MIN((offset + width - 1) / WAVEFORM_TILE_WIDTH + 1,
+            (waveform_tiles_get_columns(ctx) - 1) / WAVEFORM_TILE_WIDTH);
+
+    g_atomic_int_set(&tiles->first_wanted, first);
+    g_atomic_int_set(&tiles->last_wanted, last);
+
+    for (long index=first; index<=last; index++) {
+        waveform_tiles_request(tiles, ctx, index);
     }
 
-    self->surface = gdk_window_create_similar_surface(gtk_widget_get_window(ctx->widget),
-            CAIRO_CONTENT_COLOR, width, height);
+    waveform_tiles_evict(tiles);
+}
+
+static void
+paint_sample_surface(struct WaveformSurface *self, cairo_t *cr, struct WaveformSurfaceDrawContext *ctx)
+{
+    struct WaveformTiles *tiles = self->tiles;
+    struct WaveformTileKey key = tiles->current;
+    long offset = ctx->pixmap_offset;
+
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(ctx->widget, &allocation);
+
+    key.zoom = ctx->zoom;
 
+    for (key.index = offset / WAVEFORM_TILE_WIDTH; key.index * WAVEFORM_TILE_WIDTH < offset + allocation.width; key.index++) {
+        double x = key.index * WAVEFORM_TILE_WIDTH - offset;
+        struct WaveformTile *tile = waveform_tiles_lookup(tiles, &key);
+
+        if (tile == NULL || tile->surface == NULL) {
+            tile = waveform_tiles_lookup_stale(tiles, &key);
+        }
+
+        if (tile != NULL) {
+            tile->last_used = ++tiles->use_counter;
+            cairo_set_source_surface(cr, tile->surface, x, 0.f);
+        } else {
+            cairo_set_source_rgb(cr, waveform_background_color.red, waveform_background_color.green, waveform_background_color.blue);
+        }
+
+        cairo_rectangle(cr, x, 0.f, WAVEFORM_TILE_WIDTH, allocation.height);
+        cairo_fill(cr);
+    }
+}
+
+static void
+paint_summary_surface(struct WaveformSurface *self, cairo_t *cr, struct WaveformSurfaceDrawContext *ctx)
+{
     if (!self->surface) {
-        printf("summary_surface is NULL\n");
         return;
     }
 
-    cairo_t *cr = cairo_create(self->surface);
-    cairo_set_line_width(cr, 1.f);
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(ctx->widget, &allocation);
 
-    /* clear sample_surface before drawing */
-    fill_cairo_rectangle(cr, &bg_color, width, height);
+    cairo_set_source_surface(cr, self->surface, 0.f, 0.f);
+    cairo_rectangle(cr, 0.f, 0.f, (float)allocation.width, (float)allocation.height);
+    cairo_fill(cr);
+}
 
-    if (ctx->graphData == NULL || ctx->graphData->data == NULL) {
-        cairo_destroy(cr);
-        return;
-    }
+static void
+draw_summary_surface(struct WaveformSurface *self, struct WaveformSurfaceDrawContext *ctx)
+{
+    int width, height;
+    gboolean partial;
 
-    xaxis = height / 2;
-    if (xaxis != 0) {
-        scale = ctx->graphData->maxSampleValue / xaxis;
-        if (scale == 0) {
-            scale = 1;
-        }
-    } else {
-        scale = 1;
+    struct WaveformRaster raster;
+
+    {
+        GtkAllocation allocation;
+        gtk_widget_get_allocation(ctx->widget, &allocation);
+        width = allocation.width;
+        height = allocation.height;
     }
 
-    /* draw sample graph */
+    partial = (self->surface != NULL && self->width == width && self->height == height &&
+        (ctx->moodbarData && ctx->moodbarData->numFrames) == self->moodbar);
 
-    x_scale = (float)(ctx->graphData->numSamples) / (float)(width);
-    if (x_scale == 0) {
-        x_scale = 1;
+    if (partial && !self->damaged) {
+        return;
     }
 
-    int tb_index = 0;
-    GList *tbl = ctx->list->breaks;
-    for (i = 0; i < width && i < ctx->graphData->numSamples; i++) {
-        min = max = 0;
-        array_offset = (int)(i * x_scale);
-
-        if (x_scale != 1) {
-            loop_end = (int)x_scale;
-
-            for (k = 0; k < loop_end; k++) {
-                if (ctx->graphData->data[array_offset + k].max > max) {
-                    max = ctx->graphData->data[array_offset + k].max;
-                } else if (ctx->graphData->data[array_offset + k].min < min) {
-                    min = ctx->graphData->data[array_offset + k].min;
-                }
-            }
-        } else {
-            min = ctx->graphData->data[i].min;
-            max = ctx->graphData->data[i].max;
+    if (partial) {
+        /* only repaint the columns of the damaged blocks */
+        waveform_raster_attach(&raster, self->surface, width, height);
+    } else {
+        if (self->surface) {
+            cairo_surface_destroy(self->surface);
         }
 
-        y_min = min;
-        y_max = max;
-
-        y_min = xaxis + fabs((double)y_min) / scale;
-        y_max = xaxis - y_max / scale;
-
-        /* find the track break we are drawing now */
-        while (tbl->next && array_offset > ((TrackBreak *)(tbl->next->data))->offset) {
-            tbl = tbl->next;
-            ++tb_index;
-        }
+        self->surface = waveform_raster_begin(&raster, ctx->widget, width, height);
 
-        if (ctx->moodbarData && ctx->moodbarData->numFrames) {
-            set_cairo_source(cr, moodbar_sample_color(ctx->moodbarData, (float)(array_offset) / (float)(ctx->graphData->numSamples)));
-            draw_cairo_line(cr, i, 0.f, height);
-            cairo_stroke(cr);
+        if (!self->surface) {
+            printf("summary_surface is NULL\n");
+            return;
         }
 
-        for( shade=0; shade<SAMPLE_SHADES; shade++) {
-            TrackBreak *tb = tbl->data;
-            if (tb->write) {
-                new_color = sample_colors[tb_index % SAMPLE_COLORS][shade];
-            } else {
-                new_color = nowrite_color;
-            }
+        /* clear sample_surface before drawing */
+        waveform_raster_fill(&raster, waveform_color_to_pixel(waveform_background_color));
+    }
 
-            cairo_set_source_rgb(cr, new_color.red, new_color.green, new_color.blue);
-            draw_cairo_line(cr, i, y_min+(xaxis-y_min)*shade/SAMPLE_SHADES, y_min+(xaxis-y_min)*(shade+1)/SAMPLE_SHADES);
-            draw_cairo_line(cr, i, y_max-(y_max-xaxis)*shade/SAMPLE_SHADES, y_max-(y_max-xaxis)*(shade+1)/SAMPLE_SHADES);
-            cairo_stroke(cr);
-        }
+    if (ctx->graphData != NULL && ctx->graphData->data != NULL) {
+        waveform_render_overview(&raster, ctx->graphData, ctx->list,
+                waveform_moodbar_lut_get(&self->moodbar_lut, ctx->moodbarData, width),
+                partial, self->damage_first, self->damage_last);
     }
 
-    cairo_destroy(cr);
+    waveform_raster_end(self->surface);
 
+    self->damaged = FALSE;
     self->width = width;
     self->height = height;
     self->moodbar = ctx->moodbarData && ctx->moodbarData->numFrames;
 }
-
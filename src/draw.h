@@ -21,12 +21,14 @@
 
 #include "sample.h"
 #include "track_break.h"
-#include "moodbar.h"
+#include "waveform_render.h"
+
+#include <gtk/gtk.h>
 
 struct WaveformSurfaceDrawContext {
     // widget to draw into
     GtkWidget *widget;
-    // sample offset of sample view
+    // first visible column of sample view, in columns of the current zoom
     long pixmap_offset;
     // list of track breaks
     TrackBreakList *list;
@@ -34,8 +36,14 @@ struct WaveformSurfaceDrawContext {
     GraphData *graphData;
     // moodbar information
     MoodbarData *moodbarData;
+    // audio data for zoom levels below one block per column
+    Sample *sample;
+    // zoom level of the sample view, see waveform_zoom_block_to_column()
+    int zoom;
 };
 
+struct WaveformTiles;
+
 struct WaveformSurface {
     cairo_surface_t *surface;
     unsigned long width;
@@ -43,13 +51,33 @@ struct WaveformSurface {
     unsigned long offset;
     gboolean moodbar;
 
+    // blocks to repaint at the next draw (summary only, tiles are damaged right away)
+    gboolean damaged;
+    unsigned long damage_first;
+    unsigned long damage_last;
+
+    // tiles rendered in the background (sample view only)
+    struct WaveformTiles *tiles;
+
+    // moodbar pixels of each column (summary only, the tiles have their own)
+    struct WaveformMoodbarLut moodbar_lut;
+
     void (*draw)(struct WaveformSurface *, struct WaveformSurfaceDrawContext *);
+    void (*paint)(struct WaveformSurface *, cairo_t *, struct WaveformSurfaceDrawContext *);
 };
 
 struct WaveformSurface *waveform_surface_create_sample();
 struct WaveformSurface *waveform_surface_create_summary();
 
 void waveform_surface_draw(struct WaveformSurface *surface, struct WaveformSurfaceDrawContext *ctx);
+void waveform_surface_paint(struct WaveformSurface *surface, cairo_t *cr, struct WaveformSurfaceDrawContext *ctx);
+void waveform_surface_cancel(struct WaveformSurface *surface);
 void waveform_surface_invalidate(struct WaveformSurface *surface);
+// repaint the columns starting at blocks first_block..last_block, e.g. when the write flag of a track changed
+void waveform_surface_invalidate_range(struct WaveformSurface *surface, unsigned long first_block, unsigned long last_block);
 
 void waveform_surface_free(struct WaveformSurface *surface);
+
+// zoom > 0 shows 2^zoom columns per block, zoom < 0 shows 2^-zoom blocks per column
+long waveform_zoom_block_to_column(int zoom, long block);
+long waveform_zoom_column_to_block(int zoom, long column);
@@ -19,11 +19,15 @@
 #include "format.h"
 
 #include "format_wav.h"
+#include "format_aiff.h"
 #include "format_cdda_raw.h"
 #include "format_mp3.h"
 #include "format_ogg_vorbis.h"
+#include "format_io.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -54,6 +58,24 @@ format_module_filename_extension_check(const FormatModule *self, const char *fil
     return (g_ascii_strcasecmp(filename + strlen(filename) - strlen(extension), extension) == 0);
 }
 
+gboolean
+format_module_open_stream(const FormatModule *self, OpenedAudioFile *file, FILE *fp, char **error_message)
+{
+    if (fp == NULL) {
+        format_module_set_error_message(error_message, "No input stream");
+        return FALSE;
+    }
+
+    file->mod = self;
+    file->filename = g_strdup("<stdin>");
+    file->fp = fp;
+    file->file_size = 0;
+    file->streaming = TRUE;
+    file->stream_position = 0;
+
+    return TRUE;
+}
+
 gboolean
 format_module_open_file(const FormatModule *self, OpenedAudioFile *file, const char *filename, char **error_message)
 {
@@ -77,20 +99,506 @@ format_module_open_file(const FormatModule *self, OpenedAudioFile *file, const c
     return TRUE;
 }
 
+static void
+format_marker_free(gpointer data)
+{
+    FormatMarker *marker = data;
+
+    g_free(marker->label);
+    g_free(marker);
+}
+
+static gint
+format_marker_cmp(gconstpointer a, gconstpointer b)
+{
+    const FormatMarker *x = a;
+    const FormatMarker *y = b;
+
+    if (x->position < y->position) {
+        return -1;
+    } else if (x->position > y->position) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+void
+opened_audio_file_add_marker(OpenedAudioFile *file, unsigned long position, const char *label)
+{
+    FormatMarker *marker = g_new0(FormatMarker, 1);
+
+    marker->position = position;
+    marker->label = (label != NULL && *label != '\0') ? g_strdup(label) : NULL;
+
+    file->markers = g_list_insert_sorted(file->markers, marker, format_marker_cmp);
+}
+
 void
 opened_audio_file_close(OpenedAudioFile *file)
 {
+    if (file->markers) {
+        g_list_free_full(g_steal_pointer(&file->markers), format_marker_free);
+    }
+
     if (file->details) {
         g_free(g_steal_pointer(&file->details));
     }
 
+    if (file->stream_pushback) {
+        g_byte_array_unref(g_steal_pointer(&file->stream_pushback));
+        file->stream_pushback_offset = 0;
+    }
+
     if (file->fp) {
-        fclose(g_steal_pointer(&file->fp));
+        /* streams (stdin) are owned by the caller */
+        if (file->streaming) {
+            file->fp = NULL;
+        } else {
+            fclose(g_steal_pointer(&file->fp));
+        }
     }
 
     g_free(g_steal_pointer(&file->filename));
 }
 
+/* number of bytes put back with format_stream_unread() that were not read again */
+static gsize
+format_stream_pushback_length(OpenedAudioFile *file)
+{
+    return (file->stream_pushback != NULL) ? file->stream_pushback->len - file->stream_pushback_offset : 0;
+}
+
+size_t
+format_stream_read(OpenedAudioFile *file, unsigned char *buf, size_t size)
+{
+    size_t result = 0;
+
+    if (format_stream_pushback_length(file) > 0) {
+        result = MIN(size, format_stream_pushback_length(file));
+        memcpy(buf, file->stream_pushback->data + file->stream_pushback_offset, result);
+        file->stream_pushback_offset += result;
+
+        /* only move the read offset, and drop the buffer once it is used up */
+        if (format_stream_pushback_length(file) == 0) {
+            g_byte_array_unref(g_steal_pointer(&file->stream_pushback));
+            file->stream_pushback_offset = 0;
+        }
+    }
+
+    if (result < size) {
+        result += fread(buf + result, 1, size - result, file->fp);
+    }
+
+    file->stream_position += result;
+
+    return result;
+}
+
+int
+format_stream_getc(OpenedAudioFile *file)
+{
+    unsigned char ch;
+
+    if (format_stream_pushback_length(file) == 0) {
+        int result = fgetc(file->fp);
+        if (result != EOF) {
+            file->stream_position++;
+        }
+        return result;
+    }
+
+    return (format_stream_read(file, &ch, 1) == 1) ? ch : EOF;
+}
+
+void
+format_stream_unread(OpenedAudioFile *file, const unsigned char *buf, size_t size)
+{
+    if (file->stream_pushback == NULL) {
+        file->stream_pushback = g_byte_array_new();
+    }
+
+    if (size <= file->stream_pushback_offset) {
+        /* usually the data that was just read, put it back in place */
+        file->stream_pushback_offset -= size;
+        memcpy(file->stream_pushback->data + file->stream_pushback_offset, buf, size);
+    } else {
+        g_byte_array_remove_range(file->stream_pushback, 0, file->stream_pushback_offset);
+        file->stream_pushback_offset = 0;
+        g_byte_array_prepend(file->stream_pushback, buf, size);
+    }
+    file->stream_position -= size;
+}
+
+gboolean
+format_stream_skip(OpenedAudioFile *file, uint64_t size)
+{
+    unsigned char buf[4096];
+
+    if (!file->streaming && format_stream_pushback_length(file) == 0) {
+        if (fseeko(file->fp, size, SEEK_CUR) != 0) {
+            return FALSE;
+        }
+
+        file->stream_position += size;
+        return TRUE;
+    }
+
+    while (size > 0) {
+        size_t ret = format_stream_read(file, buf, MIN(size, sizeof(buf)));
+        if (ret == 0) {
+            return FALSE;
+        }
+        size -= ret;
+    }
+
+    return TRUE;
+}
+
+long
+format_read_data(OpenedAudioFile *file, uint64_t offset, unsigned char *buf, size_t size)
+{
+    if (!file->streaming) {
+        return format_io_read(file->fp, offset, buf, size);
+    }
+
+    if (offset < file->stream_position) {
+        g_warning("Cannot seek backwards in stream (from %" PRIu64 " to %" PRIu64 ")",
+                file->stream_position, offset);
+        return -1;
+    }
+
+    if (!format_stream_skip(file, offset - file->stream_position)) {
+        return 0;
+    }
+
+    return format_stream_read(file, buf, size);
+}
+
+void
+format_swap_sample_bytes(unsigned char *buf, size_t size, int bits_per_sample)
+{
+    size_t i = 0;
+
+    if (bits_per_sample == 16) {
+        static const uint64_t MASK = 0x00ff00ff00ff00ffull;
+
+        /* Swap four 16-bit samples at a time */
+        for (; i + 8 <= size; i += 8) {
+            uint64_t word;
+            memcpy(&word, buf + i, 8);
+            word = ((word & MASK) << 8) | ((word >> 8) & MASK);
+            memcpy(buf + i, &word, 8);
+        }
+
+        for (; i + 2 <= size; i += 2) {
+            unsigned char tmp = buf[i];
+            buf[i] = buf[i+1];
+            buf[i+1] = tmp;
+        }
+    } else if (bits_per_sample == 24) {
+        /* Swap four 24-bit samples (three 32-bit words) at a time */
+        for (; i + 12 <= size; i += 12) {
+            uint32_t w[3];
+            memcpy(w, buf + i, 12);
+            w[0] = GUINT32_FROM_LE(w[0]);
+            w[1] = GUINT32_FROM_LE(w[1]);
+            w[2] = GUINT32_FROM_LE(w[2]);
+
+            /* bytes a0 a1 a2 b0 | b1 b2 c0 c1 | c2 d0 d1 d2 -> a2 a1 a0 b2 | b1 b0 c2 c1 | c0 d2 d1 d0 */
+            uint32_t r0 = (w[0] & 0x0000ff00u) | ((w[0] >> 16) & 0xffu) | ((w[0] & 0xffu) << 16) | ((w[1] & 0x0000ff00u) << 16);
+            uint32_t r1 = (w[1] & 0xff0000ffu) | ((w[0] >> 16) & 0x0000ff00u) | ((w[2] & 0xffu) << 16);
+            uint32_t r2 = (w[2] & 0x00ff0000u) | ((w[1] >> 16) & 0xffu) | ((w[2] >> 16) & 0x0000ff00u) | ((w[2] & 0x0000ff00u) << 16);
+
+            w[0] = GUINT32_TO_LE(r0);
+            w[1] = GUINT32_TO_LE(r1);
+            w[2] = GUINT32_TO_LE(r2);
+            memcpy(buf + i, w, 12);
+        }
+
+        for (; i + 3 <= size; i += 3) {
+            unsigned char tmp = buf[i];
+            buf[i] = buf[i+2];
+            buf[i+2] = tmp;
+        }
+    } else if (bits_per_sample == 32) {
+        for (; i + 4 <= size; i += 4) {
+            uint32_t word;
+            memcpy(&word, buf + i, 4);
+            word = GUINT32_SWAP_LE_BE(word);
+            memcpy(buf + i, &word, 4);
+        }
+    }
+}
+
+/* Size of the sequential reads done by format_raw_write_regions() */
+#define RAW_REGIONS_BUFFER_SIZE (1024 * 1024)
+
+struct RawRegionOutput {
+    FILE *fp;
+    unsigned long start;
+    unsigned long end;
+    unsigned long bytes_written;
+    gboolean shared;
+    gboolean started;
+    gboolean finished;
+    gboolean failed;
+};
+
+static void
+raw_region_report_data(int i, enum FormatRegionDataType type, const unsigned char *buf, size_t size, const FormatRegionCallbacks *callbacks)
+{
+    if (callbacks->on_region_data != NULL && size > 0) {
+        callbacks->on_region_data(i, type, buf, size, callbacks->user_data);
+    }
+}
+
+static gboolean
+raw_region_write_header(OpenedAudioFile *file, const FormatRawLayout *layout, struct RawRegionOutput *out, int i, enum FormatRegionDataType type, unsigned long num_bytes, const FormatRegionCallbacks *callbacks)
+{
+    if (layout->build_header == NULL) {
+        return TRUE;
+    }
+
+    unsigned char *header = g_malloc0(layout->header_size);
+    layout->build_header(file, header, num_bytes);
+
+    gboolean result = (fwrite(header, layout->header_size, 1, out->fp) == 1);
+    raw_region_report_data(i, type, header, layout->header_size, callbacks);
+
+    g_free(header);
+
+    return result;
+}
+
+static void
+raw_region_start(OpenedAudioFile *file, const FormatRawLayout *layout, FormatRegion *regions, struct RawRegionOutput *outputs, int i, const FormatRegionCallbacks *callbacks)
+{
+    struct RawRegionOutput *out = &outputs[i];
+
+    out->started = TRUE;
+
+    if (callbacks->on_region_started != NULL) {
+        callbacks->on_region_started(i, callbacks->user_data);
+    }
+
+    if (regions[i].output_fp != NULL) {
+        out->fp = regions[i].output_fp;
+        out->shared = TRUE;
+    } else if ((out->fp = fopen(regions[i].output_filename, "wb")) == NULL) {
+        g_warning("Error opening %s for writing", regions[i].output_filename);
+        out->failed = TRUE;
+        return;
+    }
+
+    if (!raw_region_write_header(file, layout, out, i, FORMAT_REGION_DATA_HEADER, out->end - out->start, callbacks)) {
+        g_message("Could not write header to %s", regions[i].output_filename);
+        out->failed = TRUE;
+    }
+}
+
+static void
+raw_region_finish(OpenedAudioFile *file, const FormatRawLayout *layout, FormatRegion *regions, struct RawRegionOutput *outputs, int i, const FormatRegionCallbacks *callbacks)
+{
+    struct RawRegionOutput *out = &outputs[i];
+
+    out->finished = TRUE;
+
+    if (out->fp == NULL) {
+        goto finished;
+    }
+
+    if (!out->failed && out->bytes_written != out->end - out->start) {
+        if (out->shared) {
+            /* the size was announced up front (e.g. in an archive header) */
+            g_message("Source data ended before the end of %s", regions[i].output_filename);
+            out->failed = TRUE;
+        } else if (layout->build_header != NULL) {
+            /* data ended early (stream of unknown length, truncated file), fix the header */
+            if (fseeko(out->fp, 0, SEEK_SET) != 0 ||
+                    !raw_region_write_header(file, layout, out, i, FORMAT_REGION_DATA_HEADER_REWRITTEN, out->bytes_written, callbacks) ||
+                    fseeko(out->fp, 0, SEEK_END) != 0) {
+                out->failed = TRUE;
+            }
+        }
+    }
+
+    if (!out->failed && layout->pad_to_even && (out->bytes_written & 1)) {
+        static const unsigned char PADDING[1] = { 0 };
+
+        if (fwrite(PADDING, 1, 1, out->fp) != 1) {
+            out->failed = TRUE;
+        }
+
+        raw_region_report_data(i, FORMAT_REGION_DATA_OTHER, PADDING, 1, callbacks);
+    }
+
+    if (out->shared) {
+        out->fp = NULL;
+    } else if (fclose(g_steal_pointer(&out->fp)) != 0) {
+        out->failed = TRUE;
+    }
+
+    if (out->failed) {
+        g_message("Error writing to file %s", regions[i].output_filename);
+    }
+
+    regions[i].written = !out->failed;
+
+finished:
+    if (callbacks->on_region_finished != NULL) {
+        callbacks->on_region_finished(i, callbacks->user_data);
+    }
+}
+
+int
+format_raw_write_regions(OpenedAudioFile *file, const FormatRawLayout *layout, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks)
+{
+    struct RawRegionOutput *outputs = g_new0(struct RawRegionOutput, n_regions);
+    unsigned char *buf = malloc(RAW_REGIONS_BUFFER_SIZE);
+    unsigned long pos = 0, last_end = 0;
+    int first_unfinished = 0;
+    int current = -1;
+    int result = 0;
+    int i;
+
+    if (buf == NULL) {
+        g_free(outputs);
+        return -1;
+    }
+
+    for (i=0; i<n_regions; ++i) {
+        struct RawRegionOutput *out = &outputs[i];
+
+        regions[i].written = FALSE;
+
+        out->start = MIN(regions[i].start_pos, layout->data_size);
+        out->end = (regions[i].end_pos == 0) ? layout->data_size : MIN(regions[i].end_pos, layout->data_size);
+        out->end = MAX(out->end, out->start);
+
+        last_end = MAX(last_end, out->end);
+    }
+
+    while (TRUE) {
+        /* regions ending at the current position (including empty ones) are done */
+        for (i=first_unfinished; i<n_regions && outputs[i].start <= pos; ++i) {
+            if (!outputs[i].finished && outputs[i].end <= pos) {
+                if (!outputs[i].started) {
+                    raw_region_start(file, layout, regions, outputs, i, callbacks);
+                }
+                raw_region_finish(file, layout, regions, outputs, i, callbacks);
+            }
+        }
+
+        while (first_unfinished < n_regions && outputs[first_unfinished].finished) {
+            ++first_unfinished;
+        }
+
+        if (first_unfinished == n_regions) {
+            break;
+        }
+
+        if (callbacks->is_cancelled != NULL && callbacks->is_cancelled(callbacks->user_data)) {
+            result = -1;
+            break;
+        }
+
+        /* skip over data that is not part of any region (never seeks backwards) */
+        if (outputs[first_unfinished].start > pos) {
+            pos = outputs[first_unfinished].start;
+            continue;
+        }
+
+        long ret = format_read_data(file, layout->data_offset + pos, buf, MIN(RAW_REGIONS_BUFFER_SIZE, last_end - pos));
+        if (ret < 0) {
+            g_warning("Could not read sample data from %s", file->filename);
+            result = -1;
+            break;
+        }
+
+        if (ret == 0) {
+            /* end of data, all remaining regions end here */
+            for (i=first_unfinished; i<n_regions; ++i) {
+                if (!outputs[i].finished) {
+                    if (!outputs[i].started) {
+                        raw_region_start(file, layout, regions, outputs, i, callbacks);
+                    }
+                    raw_region_finish(file, layout, regions, outputs, i, callbacks);
+                }
+            }
+            break;
+        }
+
+        unsigned long chunk_end = pos + ret;
+
+        for (i=first_unfinished; i<n_regions && outputs[i].start < chunk_end; ++i) {
+            struct RawRegionOutput *out = &outputs[i];
+
+            if (out->finished) {
+                continue;
+            }
+
+            if (!out->started) {
+                raw_region_start(file, layout, regions, outputs, i, callbacks);
+                current = i;
+            }
+
+            unsigned long from = MAX(out->start, pos);
+            unsigned long to = MIN(out->end, chunk_end);
+
+            if (!out->failed && fwrite(buf + (from - pos), 1, to - from, out->fp) < to - from) {
+                out->failed = TRUE;
+            }
+
+            raw_region_report_data(i, layout->big_endian ? FORMAT_REGION_DATA_SAMPLES_BE : FORMAT_REGION_DATA_SAMPLES_LE,
+                    buf + (from - pos), to - from, callbacks);
+
+            out->bytes_written += to - from;
+
+            if (out->end <= chunk_end) {
+                raw_region_finish(file, layout, regions, outputs, i, callbacks);
+            }
+        }
+
+        if (current != -1 && callbacks->on_region_progress != NULL) {
+            struct RawRegionOutput *out = &outputs[current];
+            unsigned long done = MIN(chunk_end, out->end) - out->start;
+            callbacks->on_region_progress((out->end > out->start) ? (double)done / (double)(out->end - out->start) : 1.0, callbacks->user_data);
+        }
+
+        pos = chunk_end;
+    }
+
+    /* after an error or cancellation, incomplete files are not marked as written */
+    for (i=0; i<n_regions; ++i) {
+        if (outputs[i].fp != NULL && !outputs[i].shared) {
+            fclose(outputs[i].fp);
+        }
+    }
+
+    free(buf);
+    g_free(outputs);
+
+    return result;
+}
+
+gboolean
+format_raw_get_output_size(const FormatRawLayout *layout, unsigned long start_pos, unsigned long end_pos, uint64_t *size)
+{
+    if (end_pos == 0 && layout->data_size == FORMAT_STREAM_SIZE_UNKNOWN) {
+        return FALSE;
+    }
+
+    /* same clamping as in format_raw_write_regions() */
+    unsigned long start = MIN(start_pos, layout->data_size);
+    unsigned long end = (end_pos == 0) ? layout->data_size : MIN(end_pos, layout->data_size);
+    unsigned long num_bytes = MAX(end, start) - start;
+
+    *size = layout->header_size + num_bytes + ((layout->pad_to_even && (num_bytes & 1)) ? 1 : 0);
+
+    return TRUE;
+}
+
 static GList *
 g_modules = NULL;
 
@@ -103,6 +611,7 @@ format_init(void)
     static const format_module_load_func
     CANDIDATES[] = {
         &format_module_wav,
+        &format_module_aiff,
         &format_module_cdda_raw,
         &format_module_mp3,
         &format_module_ogg_vorbis,
@@ -163,6 +672,40 @@ format_open_file(const char *filename, char **error_message)
     return NULL;
 }
 
+OpenedAudioFile *
+format_open_stream(FILE *fp, const char *format_name, char **error_message)
+{
+    GList *cur = g_list_first(g_modules);
+    while (cur != NULL) {
+        const FormatModule *mod = cur->data;
+
+        if (mod->open_stream != NULL && strcmp(mod->default_file_extension + 1, format_name) == 0) {
+            return mod->open_stream(mod, fp, error_message);
+        }
+
+        cur = g_list_next(cur);
+    }
+
+    format_module_set_error_message(error_message, "Streaming not supported for format '%s'", format_name);
+
+    return NULL;
+}
+
+void
+format_print_supported_streams(void)
+{
+    GList *cur = g_list_first(g_modules);
+    while (cur != NULL) {
+        const FormatModule *mod = cur->data;
+
+        if (mod->open_stream != NULL) {
+            printf("  %-10s %s\n", mod->default_file_extension + 1, mod->name);
+        }
+
+        cur = g_list_next(cur);
+    }
+}
+
 static char *
 do_format_duration(uint64_t duration)
 {
@@ -191,6 +734,18 @@ format_print_file_info(OpenedAudioFile *file)
 
     printf("\n");
 
+    int index = 0;
+    GList *cur = g_list_first(file->markers);
+    while (cur != NULL) {
+        FormatMarker *marker = cur->data;
+
+        char *position = do_format_duration((uint64_t)marker->position * 1000 / (uint64_t)si->avgBytesPerSec);
+        printf("Marker %3d:     %s%s%s\n", ++index, position, marker->label ? " " : "", marker->label ? marker->label : "");
+        g_free(position);
+
+        cur = g_list_next(cur);
+    }
+
     g_free(duration);
 }
 
@@ -211,3 +766,25 @@ format_write_file(OpenedAudioFile *file, const char *output_filename, unsigned l
 {
     return file->mod->write_file(file, output_filename, start_pos, end_pos, report_progress, report_progress_user_data);
 }
+
+gboolean
+format_can_write_regions(OpenedAudioFile *file)
+{
+    return file->mod->write_regions != NULL;
+}
+
+int
+format_write_regions(OpenedAudioFile *file, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks)
+{
+    return file->mod->write_regions(file, regions, n_regions, callbacks);
+}
+
+gboolean
+format_get_output_size(OpenedAudioFile *file, unsigned long start_pos, unsigned long end_pos, uint64_t *size)
+{
+    if (file->mod->get_output_size == NULL) {
+        return FALSE;
+    }
+
+    return file->mod->get_output_size(file, start_pos, end_pos, size);
+}
@@ -27,19 +27,88 @@
 
 typedef struct FormatModule_ FormatModule;
 typedef struct OpenedAudioFile_ OpenedAudioFile;
+typedef struct FormatMarker_ FormatMarker;
+typedef struct FormatRegion_ FormatRegion;
+typedef struct FormatRegionCallbacks_ FormatRegionCallbacks;
 
 typedef void (*report_progress_func)(double progress, void *user_data);
 
+/* Kind of data passed to FormatRegionCallbacks.on_region_data */
+enum FormatRegionDataType {
+    /* file header, written before the sample data */
+    FORMAT_REGION_DATA_HEADER = 0,
+    /* the header was written again with a different size (data ended early) */
+    FORMAT_REGION_DATA_HEADER_REWRITTEN,
+    /* PCM samples, in little-endian or big-endian byte order */
+    FORMAT_REGION_DATA_SAMPLES_LE,
+    FORMAT_REGION_DATA_SAMPLES_BE,
+    /* anything else, e.g. padding or compressed frames */
+    FORMAT_REGION_DATA_OTHER,
+};
+
+struct FormatRegion_ {
+    /* range in bytes of decoded sample data, end_pos == 0 means until the end */
+    unsigned long start_pos;
+    unsigned long end_pos;
+
+    const char *output_filename;
+
+    /**
+     * optional, if set the data is appended to this already opened file
+     * instead of creating output_filename (which is then only used for
+     * messages). Regions sharing a file must be in order and must not
+     * overlap, and the file is not closed by the format module.
+     **/
+    FILE *output_fp;
+
+    /* set by the format module once the output file is complete */
+    gboolean written;
+};
+
+struct FormatRegionCallbacks_ {
+    /* called when the first data of a region is about to be written */
+    void (*on_region_started)(int index, void *user_data);
+    /* called after the last data of a region was written (or it failed) */
+    void (*on_region_finished)(int index, void *user_data);
+    /**
+     * optional, sees all data written to the output of a region in
+     * order, e.g. for calculating checksums without reading it again
+     **/
+    void (*on_region_data)(int index, enum FormatRegionDataType type, const unsigned char *buf, size_t size, void *user_data);
+    /* progress of the region that was started last */
+    report_progress_func on_region_progress;
+    gboolean (*is_cancelled)(void *user_data);
+
+    void *user_data;
+};
+
 struct FormatModule_ {
     const char *name;
     const char *library_name;
     const char *default_file_extension;
 
     OpenedAudioFile *(*open_file)(const FormatModule *self, const char *filename, char **error_message);
+    /* Optional: Open a non-seekable stream (e.g. stdin), only write_regions is supported */
+    OpenedAudioFile *(*open_stream)(const FormatModule *self, FILE *fp, char **error_message);
     void (*close_file)(const FormatModule *self, OpenedAudioFile *file);
 
     long (*read_samples)(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos);
     int (*write_file)(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data);
+
+    /**
+     * Optional: Write multiple regions (sorted by start_pos) while reading
+     * the source file exactly once from front to back. Data between
+     * regions is skipped, overlapping regions are written to all of
+     * their output files.
+     **/
+    int (*write_regions)(OpenedAudioFile *self, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks);
+
+    /**
+     * optional, exact size of the file that write_file/write_regions
+     * would produce for the given range, FALSE if it is not known
+     * before the data has been written
+     **/
+    gboolean (*get_output_size)(OpenedAudioFile *self, unsigned long start_pos, unsigned long end_pos, uint64_t *size);
 };
 
 typedef const FormatModule *(*format_module_load_func)(void);
@@ -47,6 +116,13 @@ typedef const FormatModule *(*format_module_load_func)(void);
 void
 format_module_set_error_message(char **error_message, const char *fmt, ...);
 
+struct FormatMarker_ {
+    /* position in bytes of decoded sample data */
+    unsigned long position;
+    /* optional label, NULL if none */
+    char *label;
+};
+
 struct OpenedAudioFile_ {
     const FormatModule *mod;
 
@@ -55,17 +131,101 @@ struct OpenedAudioFile_ {
     SampleInfo sample_info;
     char *details;
     uint64_t file_size;
+
+    /* markers embedded in the file (list of FormatMarker *, sorted by position) */
+    GList *markers;
+
+    /* TRUE if fp is a pipe that can only be read once, front to back */
+    gboolean streaming;
+    /* number of bytes consumed by format_stream_read() and friends */
+    uint64_t stream_position;
+    /* data that was read ahead and put back with format_stream_unread() */
+    GByteArray *stream_pushback;
+    /* bytes of stream_pushback that were already consumed again */
+    gsize stream_pushback_offset;
 };
 
+/* Data size of a stream that does not specify it (read until end of stream) */
+#define FORMAT_STREAM_SIZE_UNKNOWN ((unsigned long)-1)
+
 gboolean
 format_module_filename_extension_check(const FormatModule *self, const char *filename, const char *extension);
 
 gboolean
 format_module_open_file(const FormatModule *self, OpenedAudioFile *file, const char *filename, char **error_message);
 
+gboolean
+format_module_open_stream(const FormatModule *self, OpenedAudioFile *file, FILE *fp, char **error_message);
+
 void
 opened_audio_file_close(OpenedAudioFile *file);
 
+/**
+ * Sequential reading from the current position, for both streams and
+ * regular files. Returns the number of bytes read (short at the end).
+ **/
+size_t
+format_stream_read(OpenedAudioFile *file, unsigned char *buf, size_t size);
+
+int
+format_stream_getc(OpenedAudioFile *file);
+
+/**
+ * Put back data that was read ahead (e.g. for probing the format),
+ * the next read will return it again.
+ **/
+void
+format_stream_unread(OpenedAudioFile *file, const unsigned char *buf, size_t size);
+
+gboolean
+format_stream_skip(OpenedAudioFile *file, uint64_t size);
+
+/**
+ * Read size bytes at offset. For streams, offset must not be before
+ * the current stream position (data in between is skipped).
+ **/
+long
+format_read_data(OpenedAudioFile *file, uint64_t offset, unsigned char *buf, size_t size);
+
+void
+opened_audio_file_add_marker(OpenedAudioFile *file, unsigned long position, const char *label);
+
+/**
+ * Convert a buffer of big-endian PCM samples to host byte order (or
+ * vice versa) in place. Works on whole machine words where possible,
+ * so that compilers can vectorize it instead of swapping byte by byte.
+ **/
+void
+format_swap_sample_bytes(unsigned char *buf, size_t size, int bits_per_sample);
+
+typedef struct FormatRawLayout_ FormatRawLayout;
+struct FormatRawLayout_ {
+    /* location of the sample data in the source file */
+    uint64_t data_offset;
+    unsigned long data_size;
+
+    /* optional, fills in the header_size bytes before the sample data of each output file */
+    void (*build_header)(OpenedAudioFile *self, unsigned char *header, unsigned long num_bytes);
+    size_t header_size;
+    /* sample data is followed by a pad byte if its size is odd */
+    gboolean pad_to_even;
+    /* byte order of the sample data */
+    gboolean big_endian;
+};
+
+/**
+ * Implementation of write_regions for formats that store sample data
+ * verbatim in a single contiguous block of the file.
+ **/
+int
+format_raw_write_regions(OpenedAudioFile *file, const FormatRawLayout *layout, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks);
+
+/**
+ * Implementation of get_output_size for the same kind of formats.
+ **/
+gboolean
+format_raw_get_output_size(const FormatRawLayout *layout, unsigned long start_pos, unsigned long end_pos, uint64_t *size);
+
 
 /* Public API */
 
@@ -78,6 +238,16 @@ format_print_supported(void);
 OpenedAudioFile *
 format_open_file(const char *filename, char **error_message);
 
+/**
+ * Open a stream in the given format, which is the default file
+ * extension of a format module without the leading dot ("wav", ...).
+ **/
+OpenedAudioFile *
+format_open_stream(FILE *fp, const char *format_name, char **error_message);
+
+void
+format_print_supported_streams(void);
+
 void
 format_print_file_info(OpenedAudioFile *file);
 
@@ -89,3 +259,12 @@ format_read_samples(OpenedAudioFile *file, unsigned char *buf, size_t buf_size,
 
 int
 format_write_file(OpenedAudioFile *file, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data);
+
+gboolean
+format_can_write_regions(OpenedAudioFile *file);
+
+int
+format_write_regions(OpenedAudioFile *file, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks);
+
+gboolean
+format_get_output_size(OpenedAudioFile *file, unsigned long start_pos, unsigned long end_pos, uint64_t *size);
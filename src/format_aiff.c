@@ -0,0 +1,553 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "format_aiff.h"
+#include "format_io.h"
+#include "gettext.h"
+
+/**
+ * Audio Interchange File Format (AIFF) and AIFF-C, as written by most
+ * Mac-based audio software. All numbers in the file are big-endian.
+ *
+ * Only uncompressed PCM is supported. AIFF and AIFF-C with compression
+ * type "NONE" or "twos" store big-endian samples, AIFF-C with "sowt"
+ * stores little-endian samples. Samples are converted to little-endian
+ * (like WAV) when reading for playback and display, but written out
+ * verbatim when splitting.
+ */
+
+#define FormID "FORM"
+#define AiffID "AIFF"
+#define AifcID "AIFC"
+#define CommonID "COMM"
+#define SoundDataID "SSND"
+
+#define COMPRESSION_NONE "NONE"
+#define COMPRESSION_TWOS "twos"
+#define COMPRESSION_SOWT "sowt"
+
+#define FormatVersionID "FVER"
+#define AIFC_VERSION_1 (0xA2805140)
+
+#define CHUNK_HEADER_SIZE (8)
+#define COMMON_CHUNK_SIZE (18)
+#define SOUND_DATA_HEADER_SIZE (8)
+
+typedef struct OpenedAIFFFile_ OpenedAIFFFile;
+struct OpenedAIFFFile_ {
+    OpenedAudioFile hdr;
+
+    gboolean aifc;
+    gboolean little_endian;
+
+    unsigned long dataPtr;
+    unsigned long dataSize;
+};
+
+static uint32_t
+read_be32(const unsigned char *buf)
+{
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+static uint16_t
+read_be16(const unsigned char *buf)
+{
+    return ((uint16_t)buf[0] << 8) | buf[1];
+}
+
+static void
+write_be32(unsigned char *buf, uint32_t value)
+{
+    buf[0] = (value >> 24) & 0xff;
+    buf[1] = (value >> 16) & 0xff;
+    buf[2] = (value >> 8) & 0xff;
+    buf[3] = value & 0xff;
+}
+
+static void
+write_be16(unsigned char *buf, uint16_t value)
+{
+    buf[0] = (value >> 8) & 0xff;
+    buf[1] = value & 0xff;
+}
+
+/**
+ * Decode an IEEE 754 80-bit extended precision number, which is how
+ * AIFF stores the sample rate.
+ **/
+static double
+read_extended(const unsigned char *buf)
+{
+    int sign = (buf[0] & 0x80) ? -1 : 1;
+    int exponent = ((buf[0] & 0x7f) << 8) | buf[1];
+    uint64_t mantissa = ((uint64_t)read_be32(buf + 2) << 32) | read_be32(buf + 6);
+
+    if (exponent == 0 && mantissa == 0) {
+        return 0.0;
+    }
+
+    if (exponent == 0x7fff) {
+        return 0.0;
+    }
+
+    return sign * ldexp((double)mantissa, exponent - 16383 - 63);
+}
+
+static void
+write_extended(unsigned char *buf, unsigned int value)
+{
+    int exponent = 16383 + 63;
+    uint64_t mantissa = value;
+
+    memset(buf, 0, 10);
+
+    if (value == 0) {
+        return;
+    }
+
+    /* Normalize so that the explicit integer bit is set */
+    while (!(mantissa & 0x8000000000000000ull)) {
+        mantissa <<= 1;
+        exponent--;
+    }
+
+    write_be16(buf, exponent);
+    write_be32(buf + 2, mantissa >> 32);
+    write_be32(buf + 6, mantissa & 0xffffffff);
+}
+
+static gboolean
+read_chunk_header(FILE *fp, char *chunk_id, uint32_t *chunk_size)
+{
+    unsigned char buf[CHUNK_HEADER_SIZE];
+
+    if (fread(buf, sizeof(buf), 1, fp) < 1) {
+        return FALSE;
+    }
+
+    memcpy(chunk_id, buf, 4);
+    chunk_id[4] = '\0';
+    *chunk_size = read_be32(buf + 4);
+
+    return TRUE;
+}
+
+static void
+aiff_close_file(const FormatModule *self, OpenedAudioFile *file)
+{
+    OpenedAIFFFile *aiff = (OpenedAIFFFile *)file;
+
+    opened_audio_file_close(&aiff->hdr);
+    g_free(aiff);
+}
+
+static OpenedAudioFile *
+aiff_open_file(const FormatModule *self, const char *filename, char **error_message)
+{
+    const char *CHUNK_ERROR_MESSAGE = _("Error reading chunk. Maybe the AIFF file you are trying to load is truncated?");
+
+    unsigned char buf[COMMON_CHUNK_SIZE + 4];
+    char chunk_id[5];
+    uint32_t chunk_size;
+    gboolean have_common = FALSE;
+    gboolean have_sound_data = FALSE;
+    uint32_t sound_data_size = 0;
+
+    OpenedAIFFFile *aiff = g_new0(OpenedAIFFFile, 1);
+
+    if (!format_module_open_file(self, &aiff->hdr, filename, error_message)) {
+        g_free(aiff);
+        return NULL;
+    }
+
+    /* read in file header */
+
+    if (fread(buf, 12, 1, aiff->hdr.fp) < 1) {
+        format_module_set_error_message(error_message, "%s", _("Cannot read AIFF header."));
+        goto error;
+    }
+
+    if (memcmp(buf, FormID, 4) != 0 || (memcmp(buf + 8, AiffID, 4) != 0 && memcmp(buf + 8, AifcID, 4) != 0)) {
+        format_module_set_error_message(error_message, _("%s is not an AIFF file."), aiff->hdr.filename);
+        goto error;
+    }
+
+    aiff->aifc = (memcmp(buf + 8, AifcID, 4) == 0);
+
+    /* walk chunks until we have seen both the common and sound data chunks */
+
+    while (!(have_common && have_sound_data)) {
+        if (!read_chunk_header(aiff->hdr.fp, chunk_id, &chunk_size)) {
+            format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
+            goto error;
+        }
+
+        /* chunks are padded to an even number of bytes */
+        uint32_t skip_size = chunk_size + (chunk_size & 1);
+
+        if (memcmp(chunk_id, CommonID, 4) == 0) {
+            size_t common_size = aiff->aifc ? (COMMON_CHUNK_SIZE + 4) : COMMON_CHUNK_SIZE;
+
+            if (chunk_size < common_size || fread(buf, common_size, 1, aiff->hdr.fp) < 1) {
+                format_module_set_error_message(error_message, _("Error reading common chunk: %s"), strerror(errno));
+                goto error;
+            }
+
+            SampleInfo *si = &aiff->hdr.sample_info;
+
+            si->channels = read_be16(buf);
+            si->bitsPerSample = read_be16(buf + 6);
+            si->samplesPerSec = (unsigned int)read_extended(buf + 8);
+
+            if (aiff->aifc) {
+                if (memcmp(buf + 18, COMPRESSION_SOWT, 4) == 0) {
+                    aiff->little_endian = TRUE;
+                } else if (memcmp(buf + 18, COMPRESSION_NONE, 4) != 0 && memcmp(buf + 18, COMPRESSION_TWOS, 4) != 0) {
+                    format_module_set_error_message(error_message, "%s", _("Loading compressed AIFF-C data is not supported."));
+                    goto error;
+                }
+            }
+
+            if (si->channels == 0 || si->samplesPerSec == 0 ||
+                    (si->bitsPerSample != 8 && si->bitsPerSample != 16 && si->bitsPerSample != 24)) {
+                format_module_set_error_message(error_message, _("Unsupported AIFF format: %d Hz / %d ch / %d bit"),
+                        si->samplesPerSec, si->channels, si->bitsPerSample);
+                goto error;
+            }
+
+            si->blockAlign     = si->channels * (si->bitsPerSample / 8);
+            si->avgBytesPerSec = si->blockAlign * si->samplesPerSec;
+            si->blockSize      = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
+
+            skip_size -= common_size;
+            have_common = TRUE;
+        } else if (memcmp(chunk_id, SoundDataID, 4) == 0) {
+            if (chunk_size < SOUND_DATA_HEADER_SIZE || fread(buf, SOUND_DATA_HEADER_SIZE, 1, aiff->hdr.fp) < 1) {
+                format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
+                goto error;
+            }
+
+            /* sample data starts "offset" bytes after the sound data header */
+            uint32_t offset = read_be32(buf);
+            if (offset > chunk_size - SOUND_DATA_HEADER_SIZE) {
+                format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
+                goto error;
+            }
+
+            long x;
+            if ((x = ftell(aiff->hdr.fp)) < 0) {
+                format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
+                goto error;
+            }
+
+            aiff->dataPtr = x + offset;
+            sound_data_size = chunk_size - SOUND_DATA_HEADER_SIZE - offset;
+
+            skip_size -= SOUND_DATA_HEADER_SIZE;
+            have_sound_data = TRUE;
+
+            if (have_common) {
+                /* no need to seek over the data, we're done */
+                break;
+            }
+        } else {
+            g_debug("Skipping AIFF chunk %s (%u bytes)", chunk_id, chunk_size);
+        }
+
+        if (fseek(aiff->hdr.fp, skip_size, SEEK_CUR)) {
+            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), skip_size, aiff->hdr.filename, strerror(errno));
+            goto error;
+        }
+    }
+
+    if (aiff->dataPtr > aiff->hdr.file_size) {
+        format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
+        goto error;
+    }
+
+    /**
+     * Like for WAV files, use the real file size if the sound data
+     * chunk claims to be larger than the file (truncated file).
+     **/
+    if (aiff->dataPtr + sound_data_size > aiff->hdr.file_size) {
+        g_warning("Real file size is %lu, but AIFF header says it should be %lu. Using real file size instead.",
+                (unsigned long)aiff->hdr.file_size, aiff->dataPtr + sound_data_size);
+        aiff->dataSize = aiff->hdr.file_size - aiff->dataPtr;
+    } else {
+        aiff->dataSize = sound_data_size;
+    }
+
+    /* only whole sample frames */
+    aiff->dataSize -= aiff->dataSize % aiff->hdr.sample_info.blockAlign;
+
+    aiff->hdr.sample_info.numBytes = aiff->dataSize;
+
+    aiff->hdr.details = g_strdup_printf("%s, %s", aiff->aifc ? "AIFF-C" : "AIFF",
+            aiff->little_endian ? "little-endian" : "big-endian");
+
+    return &aiff->hdr;
+
+error:
+    aiff_close_file(self, &aiff->hdr);
+
+    return NULL;
+}
+
+static long
+aiff_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, unsigned long start_pos)
+{
+    OpenedAIFFFile *aiff = (OpenedAIFFFile *)self;
+
+    if (start_pos > aiff->dataSize) {
+        return -1;
+    }
+
+    if (start_pos + buf_size > aiff->dataSize) {
+        buf_size = aiff->dataSize - start_pos;
+    }
+
+    long ret = format_io_read(aiff->hdr.fp, start_pos + aiff->dataPtr, buf, buf_size);
+    if (ret < 0) {
+        return -1;
+    }
+
+    /* convert to the little-endian layout used for WAV */
+    if (aiff->hdr.sample_info.bitsPerSample == 8) {
+        /* 8-bit AIFF is signed, 8-bit WAV is unsigned */
+        for (long i = 0; i < ret; i++) {
+            buf[i] ^= 0x80;
+        }
+    } else if (!aiff->little_endian) {
+        format_swap_sample_bytes(buf, ret, aiff->hdr.sample_info.bitsPerSample);
+    }
+
+    return ret;
+}
+
+static size_t
+aiff_get_header_size(OpenedAIFFFile *aiff)
+{
+    /* little-endian data can only be stored in AIFF-C ("sowt") */
+    gboolean aifc = aiff->little_endian;
+    size_t common_size = aifc ? (COMMON_CHUNK_SIZE + 4 + 2) : COMMON_CHUNK_SIZE;
+    size_t version_size = aifc ? (CHUNK_HEADER_SIZE + 4) : 0;
+
+    return 12 + version_size + CHUNK_HEADER_SIZE + common_size + CHUNK_HEADER_SIZE + SOUND_DATA_HEADER_SIZE;
+}
+
+/* Largest header written by aiff_build_file_header() (AIFF-C) */
+#define AIFF_MAX_HEADER_SIZE (12 + CHUNK_HEADER_SIZE + 4 + CHUNK_HEADER_SIZE + COMMON_CHUNK_SIZE + 4 + 2 + CHUNK_HEADER_SIZE + SOUND_DATA_HEADER_SIZE)
+
+/**
+ * Fill in the aiff_get_header_size() bytes of the header for an output
+ * file with num_bytes of sample data.
+ **/
+static void
+aiff_build_file_header(unsigned char *buf, OpenedAIFFFile *aiff, unsigned long num_bytes)
+{
+    SampleInfo *si = &aiff->hdr.sample_info;
+
+    /* little-endian data can only be stored in AIFF-C ("sowt") */
+    gboolean aifc = aiff->little_endian;
+    size_t common_size = aifc ? (COMMON_CHUNK_SIZE + 4 + 2) : COMMON_CHUNK_SIZE;
+    size_t version_size = aifc ? (CHUNK_HEADER_SIZE + 4) : 0;
+    size_t header_size = aiff_get_header_size(aiff);
+
+    unsigned char *ptr = buf;
+
+    /* form header */
+    memcpy(ptr, FormID, 4);
+    write_be32(ptr + 4, header_size - 8 + num_bytes + (num_bytes & 1));
+    memcpy(ptr + 8, aifc ? AifcID : AiffID, 4);
+    ptr += 12;
+
+    /* format version chunk (mandatory for AIFF-C) */
+    if (aifc) {
+        memcpy(ptr, FormatVersionID, 4);
+        write_be32(ptr + 4, 4);
+        write_be32(ptr + 8, AIFC_VERSION_1);
+        ptr += version_size;
+    }
+
+    /* common chunk */
+    memcpy(ptr, CommonID, 4);
+    write_be32(ptr + 4, common_size);
+    ptr += CHUNK_HEADER_SIZE;
+
+    write_be16(ptr, si->channels);
+    write_be32(ptr + 2, num_bytes / si->blockAlign);
+    write_be16(ptr + 6, si->bitsPerSample);
+    write_extended(ptr + 8, si->samplesPerSec);
+    if (aifc) {
+        memcpy(ptr + 18, COMPRESSION_SOWT, 4);
+        /* empty pascal string for the compression name, padded */
+        ptr[22] = 0;
+        ptr[23] = 0;
+    }
+    ptr += common_size;
+
+    /* sound data chunk */
+    memcpy(ptr, SoundDataID, 4);
+    write_be32(ptr + 4, SOUND_DATA_HEADER_SIZE + num_bytes);
+    write_be32(ptr + 8, 0);  /* offset */
+    write_be32(ptr + 12, 0); /* block size */
+}
+
+static int
+aiff_write_file_header(FILE *fp, OpenedAIFFFile *aiff, unsigned long num_bytes)
+{
+    unsigned char buf[AIFF_MAX_HEADER_SIZE];
+
+    aiff_build_file_header(buf, aiff, num_bytes);
+
+    if (fwrite(buf, aiff_get_header_size(aiff), 1, fp) < 1) {
+        return 1;
+    }
+
+    return 0;
+}
+
+static int
+aiff_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long start_pos, unsigned long end_pos, report_progress_func report_progress, void *report_progress_user_data)
+{
+    OpenedAIFFFile *aiff = (OpenedAIFFFile *)self;
+
+    FILE *new_fp = NULL;
+    unsigned long num_bytes;
+
+    if (start_pos > aiff->dataSize) {
+        goto error;
+    }
+
+    if (end_pos == 0 || end_pos > aiff->dataSize) {
+        end_pos = aiff->dataSize;
+    }
+
+    num_bytes = end_pos - start_pos;
+
+    if ((new_fp = fopen(output_filename, "wb")) == NULL) {
+        g_warning("Error opening %s for writing", output_filename);
+        goto error;
+    }
+
+    if (aiff_write_file_header(new_fp, aiff, num_bytes) != 0) {
+        g_message("Could not write AIFF header to %s", output_filename);
+        goto error;
+    }
+
+    report_progress(0.0, report_progress_user_data);
+
+    /* sample data is copied verbatim, no conversion needed */
+    if (format_io_copy(aiff->hdr.fp, aiff->dataPtr + start_pos, new_fp, num_bytes, report_progress, report_progress_user_data) != 0) {
+        g_message("Error writing to file %s", output_filename);
+        goto error;
+    }
+
+    /* pad sound data chunk to an even size */
+    if ((num_bytes & 1) && fputc(0, new_fp) == EOF) {
+        g_message("Error writing to file %s", output_filename);
+        goto error;
+    }
+
+    if (fclose(new_fp) != 0) {
+        g_message("Error writing to file %s", output_filename);
+        return -1;
+    }
+
+    report_progress(1.0, report_progress_user_data);
+
+    return 0;
+
+error:
+    if (new_fp != NULL) {
+        fclose(new_fp);
+    }
+
+    return -1;
+}
+
+static void
+aiff_build_region_header(OpenedAudioFile *self, unsigned char *header, unsigned long num_bytes)
+{
+    aiff_build_file_header(header, (OpenedAIFFFile *)self, num_bytes);
+}
+
+static FormatRawLayout
+aiff_get_raw_layout(OpenedAudioFile *self)
+{
+    OpenedAIFFFile *aiff = (OpenedAIFFFile *)self;
+
+    FormatRawLayout layout = {
+        .data_offset = aiff->dataPtr,
+        .data_size = aiff->dataSize,
+        .build_header = aiff_build_region_header,
+        .header_size = aiff_get_header_size(aiff),
+        /* sound data chunk is padded to an even size */
+        .pad_to_even = TRUE,
+        .big_endian = !aiff->little_endian,
+    };
+
+    return layout;
+}
+
+static int
+aiff_write_regions(OpenedAudioFile *self, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks)
+{
+    FormatRawLayout layout = aiff_get_raw_layout(self);
+
+    return format_raw_write_regions(self, &layout, regions, n_regions, callbacks);
+}
+
+static gboolean
+aiff_get_output_size(OpenedAudioFile *self, unsigned long start_pos, unsigned long end_pos, uint64_t *size)
+{
+    FormatRawLayout layout = aiff_get_raw_layout(self);
+
+    return format_raw_get_output_size(&layout, start_pos, end_pos, size);
+}
+
+static const FormatModule
+AIFF_FORMAT_MODULE = {
+    .name = "Audio Interchange File Format (AIFF/AIFF-C)",
+    .library_name = "built-in",
+    .default_file_extension = ".aiff",
+
+    .open_file = aiff_open_file,
+    .close_file = aiff_close_file,
+
+    .read_samples = aiff_read_samples,
+    .write_file = aiff_write_file,
+    .write_regions = aiff_write_regions,
+    .get_output_size = aiff_get_output_size,
+};
+
+const FormatModule *
+format_module_aiff(void)
+{
+    return &AIFF_FORMAT_MODULE;
+}
@@ -1,6 +1,5 @@
-/*
- * libao output module for wavbreaker
- * Copyright (C) 2015 Thomas Perl
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -17,13 +16,9 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-#ifndef AOAUDIO_H
-#define AOAUDIO_H
+#pragma once
 
-#include "sample_info.h"
+#include "format.h"
 
-void ao_audio_close_device();
-int ao_audio_open_device(SampleInfo *);
-int ao_audio_write(unsigned char *, int);
-
-#endif /* AOAUDIO_H */
+const FormatModule *
+format_module_aiff(void);
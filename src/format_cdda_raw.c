@@ -21,6 +21,7 @@
 #include <sys/stat.h>
 
 #include "format_cdda_raw.h"
+#include "format_io.h"
 
 
 /**
@@ -48,6 +49,34 @@ cdda_raw_close_file(const FormatModule *self, OpenedAudioFile *file)
     g_free(cdda);
 }
 
+static void
+cdda_raw_set_sample_info(SampleInfo *si)
+{
+    si->channels = 2;
+    si->samplesPerSec = 44100;
+    si->bitsPerSample = 16;
+    si->avgBytesPerSec = si->bitsPerSample/8 * si->samplesPerSec * si->channels;
+    si->blockAlign = 4;
+    si->blockSize = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
+}
+
+static OpenedAudioFile *
+cdda_raw_open_stream(const FormatModule *self, FILE *fp, char **error_message)
+{
+    OpenedCDDAFile *cdda = g_new0(OpenedCDDAFile, 1);
+
+    if (!format_module_open_stream(self, &cdda->hdr, fp, error_message)) {
+        g_free(cdda);
+        return NULL;
+    }
+
+    /* no header, the stream is read until it ends */
+    cdda->file_size = FORMAT_STREAM_SIZE_UNKNOWN;
+    cdda_raw_set_sample_info(&cdda->hdr.sample_info);
+
+    return &cdda->hdr;
+}
+
 static OpenedAudioFile *
 cdda_raw_open_file(const FormatModule *self, const char *filename, char **error_message)
 {
@@ -71,16 +100,8 @@ cdda_raw_open_file(const FormatModule *self, const char *filename, char **error_
     }
 
     cdda->file_size = statBuf.st_size;
-
-    SampleInfo *si = &cdda->hdr.sample_info;
-
-    si->numBytes = statBuf.st_size;
-    si->channels = 2;
-    si->samplesPerSec = 44100;
-    si->bitsPerSample = 16;
-    si->avgBytesPerSec = si->bitsPerSample/8 * si->samplesPerSec * si->channels;
-    si->blockAlign = 4;
-    si->blockSize = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
+    cdda_raw_set_sample_info(&cdda->hdr.sample_info);
+    cdda->hdr.sample_info.numBytes = statBuf.st_size;
 
     return &cdda->hdr;
 
@@ -95,33 +116,19 @@ cdda_raw_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size
 {
     OpenedCDDAFile *cdda = (OpenedCDDAFile *)self;
 
-    size_t i = 0;
-    size_t ret;
+    long ret;
 
-    if (fseek(cdda->hdr.fp, start_pos, SEEK_SET)) {
+    if (start_pos > cdda->file_size) {
         return -1;
     }
 
-    if (start_pos > cdda->file_size) {
+    ret = format_io_read(cdda->hdr.fp, start_pos, buf, buf_size);
+    if (ret < 0) {
         return -1;
     }
 
-    ret = fread(buf, 1, buf_size, cdda->hdr.fp);
-
 #if G_BYTE_ORDER == G_LITTLE_ENDIAN
-    for (i = 0; i < ret / 4; i++) {
-        unsigned char tmp;
-
-        /* left channel */
-        tmp = buf[i*4+0];
-        buf[i*4+0] = buf[i*4+1];
-        buf[i*4+1] = tmp;
-
-        /* right channel */
-        tmp = buf[i*4+2];
-        buf[i*4+2] = buf[i*4+3];
-        buf[i*4+3] = tmp;
-    }
+    format_swap_sample_bytes(buf, ret, 16);
 #endif /* G_LITTLE_ENDIAN */
 
     return ret;
@@ -132,19 +139,14 @@ cdda_raw_write_file(OpenedAudioFile *self, const char *output_filename, unsigned
 {
     OpenedCDDAFile *cdda = (OpenedCDDAFile *)self;
 
-    int buf_size = cdda->hdr.sample_info.blockSize;
-
-    size_t ret;
     FILE *new_fp;
-    unsigned long cur_pos;
-    unsigned char buf[buf_size];
 
-    if (end_pos == 0) {
-        if (fseek(cdda->hdr.fp, 0, SEEK_END)) {
-            return -1;
-        }
+    if (start_pos > cdda->file_size) {
+        return -1;
+    }
 
-        end_pos = ftell(cdda->hdr.fp);
+    if (end_pos == 0 || end_pos > cdda->file_size) {
+        end_pos = cdda->file_size;
     }
 
     if ((new_fp = fopen(output_filename, "wb")) == NULL) {
@@ -152,45 +154,56 @@ cdda_raw_write_file(OpenedAudioFile *self, const char *output_filename, unsigned
         return -1;
     }
 
-    cur_pos = start_pos;
+    report_progress(0.0, report_progress_user_data);
 
-    if (fseek(cdda->hdr.fp, cur_pos, SEEK_SET)) {
+    if (format_io_copy(cdda->hdr.fp, start_pos, new_fp, end_pos - start_pos, report_progress, report_progress_user_data) != 0) {
+        g_warning("Error writing to file %s", output_filename);
         fclose(new_fp);
         return -1;
     }
 
-    report_progress(0.0, report_progress_user_data);
+    report_progress(1.0, report_progress_user_data);
 
-    if (cur_pos > cdda->file_size) {
-        fclose(new_fp);
+    if (fclose(new_fp) != 0) {
+        g_warning("Error writing to file %s", output_filename);
         return -1;
     }
 
-    if (cur_pos + buf_size > end_pos) {
-        buf_size = end_pos - cur_pos;
-    }
+    return 0;
+}
 
-    while ((ret = fread(buf, 1, buf_size, cdda->hdr.fp)) > 0 &&
-            cur_pos < end_pos) {
+static FormatRawLayout
+cdda_raw_get_raw_layout(OpenedAudioFile *self)
+{
+    OpenedCDDAFile *cdda = (OpenedCDDAFile *)self;
 
-        if ((fwrite(buf, 1, ret, new_fp)) < ret) {
-            g_warning("Error writing to file %s", output_filename);
-            fclose(new_fp);
-            return -1;
-        }
-        cur_pos += ret;
+    /* headerless, big-endian samples are copied verbatim */
+    FormatRawLayout layout = {
+        .data_offset = 0,
+        .data_size = cdda->file_size,
+        .build_header = NULL,
+        .header_size = 0,
+        .pad_to_even = FALSE,
+        .big_endian = TRUE,
+    };
+
+    return layout;
+}
 
-        report_progress((double)(cur_pos - start_pos) / (double)(end_pos - start_pos), report_progress_user_data);
+static int
+cdda_raw_write_regions(OpenedAudioFile *self, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks)
+{
+    FormatRawLayout layout = cdda_raw_get_raw_layout(self);
 
-        if (cur_pos + buf_size > end_pos) {
-            buf_size = end_pos - cur_pos;
-        }
-    }
+    return format_raw_write_regions(self, &layout, regions, n_regions, callbacks);
+}
 
-    report_progress(1.0, report_progress_user_data);
+static gboolean
+cdda_raw_get_output_size(OpenedAudioFile *self, unsigned long start_pos, unsigned long end_pos, uint64_t *size)
+{
+    FormatRawLayout layout = cdda_raw_get_raw_layout(self);
 
-    fclose(new_fp);
-    return ret;
+    return format_raw_get_output_size(&layout, start_pos, end_pos, size);
 }
 
 static const FormatModule
@@ -200,10 +213,13 @@ CDDA_RAW_FORMAT_MODULE = {
     .default_file_extension = ".cdda.raw",
 
     .open_file = cdda_raw_open_file,
+    .open_stream = cdda_raw_open_stream,
     .close_file = cdda_raw_close_file,
 
     .read_samples = cdda_raw_read_samples,
     .write_file = cdda_raw_write_file,
+    .write_regions = cdda_raw_write_regions,
+    .get_output_size = cdda_raw_get_output_size,
 };
 
 const FormatModule *
@@ -0,0 +1,470 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* pread(), pwrite() and fileno() with -std=c99, before any system header */
+#define _GNU_SOURCE
+
+#include <config.h>
+
+#include "format_io.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Size of a single read request for batched reads */
+#define FORMAT_IO_READ_SEGMENT_SIZE (64 * 1024)
+
+/* Size of the buffer used for each read/write pair when copying */
+#define FORMAT_IO_COPY_BUFFER_SIZE (256 * 1024)
+
+/* Number of requests kept in flight */
+#define FORMAT_IO_QUEUE_DEPTH (16)
+
+static long
+stdio_read(FILE *fp, uint64_t offset, unsigned char *buf, size_t size)
+{
+    if (fseeko(fp, offset, SEEK_SET)) {
+        return -1;
+    }
+
+    return fread(buf, 1, size, fp);
+}
+
+static int
+stdio_copy(FILE *src, uint64_t offset, FILE *dst, uint64_t length, uint64_t done, uint64_t total,
+        report_progress_func report_progress, void *report_progress_user_data)
+{
+    unsigned char *buf = malloc(FORMAT_IO_COPY_BUFFER_SIZE);
+
+    if (buf == NULL || fseeko(src, offset, SEEK_SET)) {
+        free(buf);
+        return -1;
+    }
+
+    while (length > 0) {
+        size_t chunk = MIN(length, FORMAT_IO_COPY_BUFFER_SIZE);
+        size_t ret = fread(buf, 1, chunk, src);
+
+        if (ret == 0) {
+            /* the header of the output already promised the full length */
+            g_warning("Unexpected end of file when copying sample data");
+            free(buf);
+            return -1;
+        }
+
+        if (fwrite(buf, 1, ret, dst) < ret) {
+            free(buf);
+            return -1;
+        }
+
+        length -= ret;
+        done += ret;
+
+        if (report_progress != NULL) {
+            report_progress((double)done / (double)total, report_progress_user_data);
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+#if defined(HAVE_LIBURING)
+
+#include <liburing.h>
+#include <unistd.h>
+
+struct FormatIORing {
+    struct io_uring ring;
+};
+
+/* set by the first thread that fails to set up a ring, read by all of them */
+static gint
+g_io_uring_unavailable = FALSE;
+
+static void
+format_io_ring_free(gpointer data)
+{
+    struct FormatIORing *r = data;
+
+    io_uring_queue_exit(&r->ring);
+    g_free(r);
+}
+
+/* Each thread (analysis, playback, writing) gets its own ring */
+static GPrivate
+g_ring_key = G_PRIVATE_INIT(format_io_ring_free);
+
+static struct io_uring *
+format_io_get_ring(void)
+{
+    if (g_atomic_int_get(&g_io_uring_unavailable)) {
+        return NULL;
+    }
+
+    struct FormatIORing *r = g_private_get(&g_ring_key);
+    if (r == NULL) {
+        r = g_new0(struct FormatIORing, 1);
+
+        int res = io_uring_queue_init(2 * FORMAT_IO_QUEUE_DEPTH, &r->ring, 0);
+        if (res < 0) {
+            g_message("io_uring not available (%s), using stdio", strerror(-res));
+            g_atomic_int_set(&g_io_uring_unavailable, TRUE);
+            g_free(r);
+            return NULL;
+        }
+
+        g_private_set(&g_ring_key, r);
+    }
+
+    return &r->ring;
+}
+
+/**
+ * Tear down the ring of this thread, which cancels everything that is
+ * still queued or in flight on it. The next request sets up a new one.
+ **/
+static void
+format_io_discard_ring(void)
+{
+    g_private_replace(&g_ring_key, NULL);
+}
+
+/* wait for a completion, retrying when interrupted by a signal */
+static int
+uring_wait(struct io_uring *ring, struct io_uring_cqe **cqe)
+{
+    int res;
+
+    do {
+        res = io_uring_wait_cqe(ring, cqe);
+    } while (res == -EINTR);
+
+    return res;
+}
+
+/**
+ * After an error, wait for the requests that are still in flight, as they
+ * point into buffers of the caller. If even that fails, the ring is
+ * discarded.
+ **/
+static void
+uring_reap(struct io_uring *ring, size_t in_flight)
+{
+    while (in_flight > 0) {
+        struct io_uring_cqe *cqe;
+        if (uring_wait(ring, &cqe) < 0) {
+            format_io_discard_ring();
+            return;
+        }
+
+        io_uring_cqe_seen(ring, cqe);
+        in_flight--;
+    }
+}
+
+static long
+uring_read(struct io_uring *ring, int fd, uint64_t offset, unsigned char *buf, size_t size)
+{
+    size_t submitted = 0;
+    size_t num_segments = (size + FORMAT_IO_READ_SEGMENT_SIZE - 1) / FORMAT_IO_READ_SEGMENT_SIZE;
+    size_t completed = 0;
+
+    /* bytes read into each segment, or -1 if not complete */
+    long results[FORMAT_IO_QUEUE_DEPTH];
+    long total = 0;
+    gboolean short_read = FALSE;
+
+    while (completed < num_segments) {
+        size_t batch = MIN(num_segments - submitted, FORMAT_IO_QUEUE_DEPTH);
+        size_t batch_start = submitted;
+
+        for (size_t i=0; i<batch; ++i) {
+            size_t seg_offset = (batch_start + i) * FORMAT_IO_READ_SEGMENT_SIZE;
+            size_t seg_size = MIN(FORMAT_IO_READ_SEGMENT_SIZE, size - seg_offset);
+
+            struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+            io_uring_prep_read(sqe, fd, buf + seg_offset, seg_size, offset + seg_offset);
+            io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+            results[i] = -1;
+        }
+
+        submitted += batch;
+
+        int res = io_uring_submit(ring);
+        if (res < (int)batch) {
+            /* requests that were not submitted are still queued in the ring */
+            uring_reap(ring, MAX(res, 0));
+            format_io_discard_ring();
+            errno = (res < 0) ? -res : EIO;
+            return -1;
+        }
+
+        for (size_t i=0; i<batch; ++i) {
+            struct io_uring_cqe *cqe;
+            if ((res = uring_wait(ring, &cqe)) < 0) {
+                uring_reap(ring, batch - i);
+                errno = -res;
+                return -1;
+            }
+
+            size_t idx = (uintptr_t)io_uring_cqe_get_data(cqe);
+            results[idx] = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+        }
+
+        /* Sum up contiguous data, stop at the first short read */
+        for (size_t i=0; i<batch && !short_read; ++i) {
+            size_t seg_offset = (batch_start + i) * FORMAT_IO_READ_SEGMENT_SIZE;
+            size_t seg_size = MIN(FORMAT_IO_READ_SEGMENT_SIZE, size - seg_offset);
+
+            if (results[i] < 0) {
+                errno = -results[i];
+                return -1;
+            }
+
+            total += results[i];
+
+            if ((size_t)results[i] < seg_size) {
+                short_read = TRUE;
+            }
+        }
+
+        completed += batch;
+
+        if (short_read) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+struct CopySlot {
+    unsigned char *buf;
+    uint64_t offset;
+    size_t size;
+    long read_result;
+};
+
+static gboolean
+uring_copy_sync(int src_fd, int dst_fd, struct CopySlot *slot, uint64_t dst_offset, size_t already_read)
+{
+    /* Fallback for a short read or write: finish this slot synchronously */
+    size_t pos = already_read;
+
+    while (pos < slot->size) {
+        ssize_t res = pread(src_fd, slot->buf + pos, slot->size - pos, slot->offset + pos);
+        if (res <= 0) {
+            return FALSE;
+        }
+        pos += res;
+    }
+
+    pos = 0;
+    while (pos < slot->size) {
+        ssize_t res = pwrite(dst_fd, slot->buf + pos, slot->size - pos, dst_offset + pos);
+        if (res <= 0) {
+            return FALSE;
+        }
+        pos += res;
+    }
+
+    return TRUE;
+}
+
+static int
+uring_copy(struct io_uring *ring, int src_fd, uint64_t offset, int dst_fd, uint64_t dst_start, uint64_t length,
+        report_progress_func report_progress, void *report_progress_user_data)
+{
+    enum { SLOTS = FORMAT_IO_QUEUE_DEPTH / 2 };
+
+    struct CopySlot slots[SLOTS];
+    uint64_t next_offset = offset;
+    uint64_t end_offset = offset + length;
+    uint64_t done = 0;
+    int in_flight = 0;
+    int result = 0;
+
+    memset(slots, 0, sizeof(slots));
+
+    for (int i=0; i<SLOTS; ++i) {
+        slots[i].buf = malloc(FORMAT_IO_COPY_BUFFER_SIZE);
+        if (slots[i].buf == NULL) {
+            result = -1;
+            goto cleanup;
+        }
+    }
+
+    /* user data: slot index * 2 + (0 = read, 1 = write) */
+#define QUEUE_PAIR(i) do { \
+        struct CopySlot *slot = &slots[i]; \
+        slot->offset = next_offset; \
+        slot->size = MIN(FORMAT_IO_COPY_BUFFER_SIZE, end_offset - next_offset); \
+        slot->read_result = -1; \
+        next_offset += slot->size; \
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring); \
+        io_uring_prep_read(sqe, src_fd, slot->buf, slot->size, slot->offset); \
+        io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK); \
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)((i) * 2)); \
+        sqe = io_uring_get_sqe(ring); \
+        io_uring_prep_write(sqe, dst_fd, slot->buf, slot->size, dst_start + (slot->offset - offset)); \
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)((i) * 2 + 1)); \
+        in_flight++; \
+    } while (0)
+
+    for (int i=0; i<SLOTS && next_offset < end_offset; ++i) {
+        QUEUE_PAIR(i);
+    }
+
+    while (in_flight > 0) {
+        if (io_uring_submit(ring) < 0) {
+            /* nothing can be waited for reliably, the slots are still in use */
+            format_io_discard_ring();
+            in_flight = 0;
+            result = -1;
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        if (uring_wait(ring, &cqe) < 0) {
+            result = -1;
+            break;
+        }
+
+        uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+
+        int i = data / 2;
+        struct CopySlot *slot = &slots[i];
+
+        if ((data % 2) == 0) {
+            /* read completed, the linked write follows */
+            slot->read_result = res;
+            continue;
+        }
+
+        /* write completed (or was cancelled due to a short read) */
+        uint64_t dst_offset = dst_start + (slot->offset - offset);
+        if (slot->read_result < 0 && slot->read_result != -ECANCELED) {
+            g_warning("Error reading sample data: %s", strerror(-slot->read_result));
+            result = -1;
+        } else if (res < 0 && res != -ECANCELED) {
+            g_warning("Error writing sample data: %s", strerror(-res));
+            result = -1;
+        } else if (res < 0 || (size_t)res < slot->size) {
+            if (!uring_copy_sync(src_fd, dst_fd, slot, dst_offset, MAX(slot->read_result, 0))) {
+                g_warning("Short read or write when copying sample data");
+                result = -1;
+            }
+        }
+
+        in_flight--;
+        done += slot->size;
+
+        if (report_progress != NULL) {
+            report_progress((double)done / (double)length, report_progress_user_data);
+        }
+
+        if (result == 0 && next_offset < end_offset) {
+            QUEUE_PAIR(i);
+        }
+    }
+
+#undef QUEUE_PAIR
+
+    /* Drain remaining completions after an error, the slot buffers are still in use */
+    while (in_flight > 0) {
+        struct io_uring_cqe *cqe;
+        if (uring_wait(ring, &cqe) < 0) {
+            format_io_discard_ring();
+            break;
+        }
+
+        if (((uintptr_t)io_uring_cqe_get_data(cqe) % 2) == 1) {
+            in_flight--;
+        }
+        io_uring_cqe_seen(ring, cqe);
+    }
+
+cleanup:
+    for (int i=0; i<SLOTS; ++i) {
+        free(slots[i].buf);
+    }
+
+    return result;
+}
+
+#endif /* HAVE_LIBURING */
+
+const char *
+format_io_backend_name(void)
+{
+#if defined(HAVE_LIBURING)
+    if (format_io_get_ring() != NULL) {
+        return "io_uring";
+    }
+#endif /* HAVE_LIBURING */
+
+    return "stdio";
+}
+
+long
+format_io_read(FILE *fp, uint64_t offset, unsigned char *buf, size_t size)
+{
+#if defined(HAVE_LIBURING)
+    struct io_uring *ring;
+
+    if (size > FORMAT_IO_READ_SEGMENT_SIZE && (ring = format_io_get_ring()) != NULL) {
+        return uring_read(ring, fileno(fp), offset, buf, size);
+    }
+#endif /* HAVE_LIBURING */
+
+    return stdio_read(fp, offset, buf, size);
+}
+
+int
+format_io_copy(FILE *src, uint64_t offset, FILE *dst, uint64_t length, report_progress_func report_progress, void *report_progress_user_data)
+{
+#if defined(HAVE_LIBURING)
+    struct io_uring *ring;
+
+    if (length > FORMAT_IO_COPY_BUFFER_SIZE && (ring = format_io_get_ring()) != NULL) {
+        /* Anything buffered (e.g. the file header) must hit the file first */
+        if (fflush(dst) != 0) {
+            return -1;
+        }
+
+        off_t dst_start = ftello(dst);
+        if (dst_start < 0) {
+            return -1;
+        }
+
+        if (uring_copy(ring, fileno(src), offset, fileno(dst), dst_start, length,
+                    report_progress, report_progress_user_data) != 0) {
+            return -1;
+        }
+
+        return fseeko(dst, dst_start + length, SEEK_SET) ? -1 : 0;
+    }
+#endif /* HAVE_LIBURING */
+
+    return stdio_copy(src, offset, dst, length, 0, length, report_progress, report_progress_user_data);
+}
@@ -0,0 +1,52 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "format.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Block I/O helpers for format modules that store samples verbatim in
+ * the file (WAV, AIFF, CDDA raw). If wavbreaker was built with liburing
+ * and the kernel supports io_uring, large reads are split into several
+ * requests that are submitted together, and copies keep multiple
+ * read/write pairs in flight. Otherwise (or if setting up io_uring fails
+ * at runtime), plain stdio is used.
+ **/
+
+const char *
+format_io_backend_name(void);
+
+/**
+ * Read up to size bytes at offset from fp into buf.
+ * Returns the number of bytes read, or -1 on error.
+ **/
+long
+format_io_read(FILE *fp, uint64_t offset, unsigned char *buf, size_t size);
+
+/**
+ * Copy length bytes starting at offset in src to the current position
+ * of dst, leaving dst positioned after the copied data.
+ * Returns 0 on success, -1 on error.
+ **/
+int
+format_io_copy(FILE *src, uint64_t offset, FILE *dst, uint64_t length, report_progress_func report_progress, void *report_progress_user_data);
@@ -44,13 +44,21 @@ mp3_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, uns
     size_t result;
     gboolean retried = FALSE;
 
+    if (mp3->mpg123 == NULL) {
+        /* opened as a stream, no decoding */
+        return -1;
+    }
+
     if (mp3->mpg123_offset != start_pos) {
 retry:
         mpg123_seek(mp3->mpg123, start_pos / mp3->hdr.sample_info.blockAlign, SEEK_SET);
         mp3->mpg123_offset = start_pos;
     }
 
-    if (mpg123_read(mp3->mpg123, buf, buf_size, &result) == MPG123_OK) {
+    int err = mpg123_read(mp3->mpg123, buf, buf_size, &result);
+
+    /* the last read of a stream may return partial data along with MPG123_DONE */
+    if (err == MPG123_OK || (err == MPG123_DONE && result > 0)) {
         mp3->mpg123_offset += result;
         return result;
     } else {
@@ -211,16 +219,280 @@ mp3_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long
     return 0;
 }
 
+struct MP3RegionOutput {
+    FILE *fp;
+    uint32_t start_samples;
+    uint32_t end_samples;
+    gboolean shared;
+    gboolean started;
+    gboolean finished;
+    gboolean failed;
+};
+
+static void
+mp3_region_start(FormatRegion *regions, struct MP3RegionOutput *outputs, int i, const FormatRegionCallbacks *callbacks)
+{
+    struct MP3RegionOutput *out = &outputs[i];
+
+    out->started = TRUE;
+
+    if (callbacks->on_region_started != NULL) {
+        callbacks->on_region_started(i, callbacks->user_data);
+    }
+
+    if (regions[i].output_fp != NULL) {
+        out->fp = regions[i].output_fp;
+        out->shared = TRUE;
+    } else if ((out->fp = fopen(regions[i].output_filename, "wb")) == NULL) {
+        g_warning("Could not open '%s' for writing", regions[i].output_filename);
+        out->failed = TRUE;
+    }
+}
+
+static void
+mp3_region_finish(FormatRegion *regions, struct MP3RegionOutput *outputs, int i, const FormatRegionCallbacks *callbacks)
+{
+    struct MP3RegionOutput *out = &outputs[i];
+
+    out->finished = TRUE;
+
+    if (out->shared) {
+        out->fp = NULL;
+    } else if (out->fp != NULL && fclose(g_steal_pointer(&out->fp)) != 0) {
+        out->failed = TRUE;
+    }
+
+    regions[i].written = !out->failed;
+
+    if (callbacks->on_region_finished != NULL) {
+        callbacks->on_region_finished(i, callbacks->user_data);
+    }
+}
+
+static int
+mp3_write_regions(OpenedAudioFile *self, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks)
+{
+    OpenedMP3File *mp3 = (OpenedMP3File *)self;
+    SampleInfo *si = &mp3->hdr.sample_info;
+
+    struct MP3RegionOutput *outputs = g_new0(struct MP3RegionOutput, n_regions);
+    int first_unfinished = 0;
+    int current = -1;
+    int result = 0;
+    int i;
+
+    for (i=0; i<n_regions; ++i) {
+        regions[i].written = FALSE;
+
+        /* same rounding to CD blocks as mp3_write_file() */
+        outputs[i].start_samples = regions[i].start_pos / si->blockSize * si->samplesPerSec / CD_BLOCKS_PER_SEC;
+        outputs[i].end_samples = regions[i].end_pos / si->blockSize * si->samplesPerSec / CD_BLOCKS_PER_SEC;
+
+        if (outputs[i].end_samples == 0) {
+            /* streams are read until they end */
+            outputs[i].end_samples = mp3->hdr.streaming ? UINT32_MAX : si->numBytes / si->blockAlign;
+        }
+    }
+
+    if (!mp3->hdr.streaming) {
+        if (fseek(mp3->hdr.fp, 0, SEEK_SET)) {
+            g_free(outputs);
+            return -1;
+        }
+
+        mp3->hdr.stream_position = 0;
+    }
+
+    uint32_t header = 0x00000000;
+    uint32_t sample_position = 0;
+    uint32_t file_offset = 0;
+    uint32_t last_frame_end = 0;
+
+    size_t frame_buf_size = 2048;
+    unsigned char *frame = g_malloc(frame_buf_size);
+
+    /* scan the file front to back, each frame is read exactly once */
+    while (first_unfinished < n_regions) {
+        int a = format_stream_getc(&mp3->hdr);
+        if (a == EOF) {
+            break;
+        }
+
+        file_offset++;
+        header = ((header & 0xffffff) << 8) | (a & 0xff);
+
+        uint32_t bitrate = 0;
+        uint32_t frequency = 0;
+        uint32_t samples = 0;
+        uint32_t framesize = 0;
+
+        if (!mp3_parse_header(header, &bitrate, &frequency, &samples, &framesize) || framesize < 4) {
+            continue;
+        }
+
+        if (callbacks->is_cancelled != NULL && callbacks->is_cancelled(callbacks->user_data)) {
+            result = -1;
+            break;
+        }
+
+        uint32_t frame_start = file_offset - 4;
+
+        if (last_frame_end < frame_start) {
+            g_warning("Skipped non-frame data in MP3 @ 0x%08x (%d bytes)",
+                    last_frame_end, frame_start - last_frame_end);
+        }
+
+        if (framesize > frame_buf_size) {
+            frame_buf_size = framesize;
+            frame = g_realloc(frame, frame_buf_size);
+        }
+
+        frame[0] = (header >> 24) & 0xff;
+        frame[1] = (header >> 16) & 0xff;
+        frame[2] = (header >> 8) & 0xff;
+        frame[3] = header & 0xff;
+
+        if (format_stream_read(&mp3->hdr, frame + 4, framesize - 4) != framesize - 4) {
+            g_warning("Tried to read over the end of the input file");
+            break;
+        }
+
+        for (i=first_unfinished; i<n_regions && outputs[i].start_samples <= sample_position; ++i) {
+            struct MP3RegionOutput *out = &outputs[i];
+
+            if (out->finished) {
+                continue;
+            }
+
+            if (!out->started) {
+                mp3_region_start(regions, outputs, i, callbacks);
+                current = i;
+            }
+
+            if (!out->failed && fwrite(frame, 1, framesize, out->fp) != framesize) {
+                g_warning("Failed to write %d bytes to output file", framesize);
+                out->failed = TRUE;
+            }
+
+            if (callbacks->on_region_data != NULL) {
+                callbacks->on_region_data(i, FORMAT_REGION_DATA_OTHER, frame, framesize, callbacks->user_data);
+            }
+
+            if (out->end_samples <= sample_position + samples) {
+                mp3_region_finish(regions, outputs, i, callbacks);
+            }
+        }
+
+        if (current != -1 && callbacks->on_region_progress != NULL) {
+            struct MP3RegionOutput *out = &outputs[current];
+            callbacks->on_region_progress((double)(sample_position - out->start_samples) /
+                    (double)MAX(1, out->end_samples - out->start_samples), callbacks->user_data);
+        }
+
+        while (first_unfinished < n_regions && outputs[first_unfinished].finished) {
+            ++first_unfinished;
+        }
+
+        sample_position += samples;
+
+        file_offset = frame_start + framesize;
+        last_frame_end = file_offset;
+
+        header = 0x00000000;
+    }
+
+    for (i=first_unfinished; i<n_regions; ++i) {
+        if (result == 0 && !outputs[i].finished) {
+            /* end of input, like mp3_write_file() the output ends here */
+            if (!outputs[i].started) {
+                mp3_region_start(regions, outputs, i, callbacks);
+            }
+            mp3_region_finish(regions, outputs, i, callbacks);
+        } else if (outputs[i].fp != NULL && !outputs[i].shared) {
+            fclose(outputs[i].fp);
+        }
+    }
+
+    g_free(frame);
+    g_free(outputs);
+
+    return result;
+}
+
 static void
 mp3_close_file(const FormatModule *self, OpenedAudioFile *file)
 {
     OpenedMP3File *mp3 = (OpenedMP3File *)file;
 
     opened_audio_file_close(&mp3->hdr);
-    mpg123_close(g_steal_pointer(&mp3->mpg123));
+    if (mp3->mpg123 != NULL) {
+        mpg123_close(g_steal_pointer(&mp3->mpg123));
+    }
     g_free(mp3);
 }
 
+/* Give up looking for the first frame after this many bytes (e.g. large ID3 tags) */
+#define MP3_STREAM_PROBE_LIMIT (4 * 1024 * 1024)
+
+/**
+ * Only frame-based splitting is supported for streams, so instead of
+ * initializing the decoder we look for the first frame header to get
+ * the audio format, and put everything we read back into the stream.
+ **/
+static OpenedAudioFile *
+mp3_open_stream(const FormatModule *self, FILE *fp, char **error_message)
+{
+    OpenedMP3File *mp3 = g_new0(OpenedMP3File, 1);
+
+    if (!format_module_open_stream(self, &mp3->hdr, fp, error_message)) {
+        g_free(mp3);
+        return NULL;
+    }
+
+    GByteArray *probe = g_byte_array_new();
+    uint32_t header = 0x00000000;
+    gboolean found = FALSE;
+
+    while (!found && probe->len < MP3_STREAM_PROBE_LIMIT) {
+        int a = format_stream_getc(&mp3->hdr);
+        if (a == EOF) {
+            break;
+        }
+
+        guint8 byte = a;
+        g_byte_array_append(probe, &byte, 1);
+        header = ((header & 0xffffff) << 8) | byte;
+
+        uint32_t bitrate, frequency, samples, framesize;
+        if (mp3_parse_header(header, &bitrate, &frequency, &samples, &framesize)) {
+            SampleInfo *si = &mp3->hdr.sample_info;
+
+            /* channel mode 0b11 is single channel */
+            si->channels = (((header >> 6) & 0x3) == 0x3) ? 1 : 2;
+            si->samplesPerSec = frequency;
+            si->bitsPerSample = 16;
+            si->blockAlign = si->channels * (si->bitsPerSample / 8);
+            si->avgBytesPerSec = si->blockAlign * si->samplesPerSec;
+            si->blockSize = si->avgBytesPerSec / CD_BLOCKS_PER_SEC;
+
+            mp3->hdr.details = g_strdup_printf("MPEG stream, %u kbps", bitrate);
+
+            found = TRUE;
+        }
+    }
+
+    format_stream_unread(&mp3->hdr, probe->data, probe->len);
+    g_byte_array_unref(probe);
+
+    if (!found) {
+        format_module_set_error_message(error_message, "No MPEG audio frame found in stream");
+        mp3_close_file(self, &mp3->hdr);
+        return NULL;
+    }
+
+    return &mp3->hdr;
+}
+
 static OpenedAudioFile *
 mp3_open_file(const FormatModule *self, const char *filename, char **error_message)
 {
@@ -333,10 +605,12 @@ MP3_FORMAT_MODULE = {
     .default_file_extension = ".mp3",
 
     .open_file = mp3_open_file,
+    .open_stream = mp3_open_stream,
     .close_file = mp3_close_file,
 
     .read_samples = mp3_read_samples,
     .write_file = mp3_write_file,
+    .write_regions = mp3_write_regions,
 };
 
 const FormatModule *
@@ -20,16 +20,28 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include <glib.h>
 
 #include "format_wav.h"
+#include "format_io.h"
 #include "gettext.h"
 
 #define RiffID "RIFF"
 #define WaveID "WAVE"
 #define FormatID "fmt "
 #define WaveDataID "data"
+#define CueID "cue "
+#define ListID "LIST"
+#define AssocDataListID "adtl"
+#define LabelID "labl"
+#define BroadcastExtID "bext"
+
+#define BEXT_DESCRIPTION_LENGTH (256)
+
+/* labels of even thousands of cue points fit into this */
+#define ADTL_MAX_SIZE (1024 * 1024)
 
 typedef char ID[4];
 
@@ -54,6 +66,21 @@ typedef struct {
 //	unsigned short  extraNonPcm;
 } FormatChunk;
 
+typedef struct {
+	unsigned int dwName;
+	unsigned int dwPosition;
+	ID fccChunk;
+	unsigned int dwChunkStart;
+	unsigned int dwBlockStart;
+	unsigned int dwSampleOffset;
+} CuePoint;
+
+
+/* Size of the header written by wav_write_file_header() */
+#define WAV_FILE_HEADER_SIZE (sizeof(WaveHeader) + sizeof(ChunkHeader) + sizeof(FormatChunk) + sizeof(ChunkHeader))
+
+static void
+wav_build_file_header(unsigned char *buf, SampleInfo *sample_info, unsigned long num_bytes);
 
 typedef struct OpenedWavFile_ OpenedWavFile;
 struct OpenedWavFile_ {
@@ -72,6 +99,54 @@ wav_close_file(const FormatModule *self, OpenedAudioFile *file)
     g_free(wav);
 }
 
+/**
+ * Parse the sub-chunks of an associated data list, and store the text
+ * of each label ("labl") chunk in the labels table, keyed by cue point ID.
+ **/
+static void
+wav_parse_adtl(const unsigned char *data, size_t size, GHashTable *labels)
+{
+    size_t pos = 0;
+
+    while (pos + sizeof(ChunkHeader) <= size) {
+        ChunkHeader sub;
+        memcpy(&sub, data + pos, sizeof(ChunkHeader));
+        pos += sizeof(ChunkHeader);
+
+        if (sub.chunkSize < 0 || pos + sub.chunkSize > size) {
+            break;
+        }
+
+        if (memcmp(sub.chunkID, LabelID, 4) == 0 && sub.chunkSize > 4) {
+            unsigned int cue_id;
+            memcpy(&cue_id, data + pos, sizeof(cue_id));
+
+            gchar *label = g_strndup((const gchar *)data + pos + 4, sub.chunkSize - 4);
+            g_hash_table_insert(labels, GUINT_TO_POINTER(cue_id), g_strstrip(label));
+        }
+
+        pos += sub.chunkSize + (sub.chunkSize & 1);
+    }
+}
+
+static gboolean
+wav_apply_format_chunk(OpenedWavFile *wav, const FormatChunk *fmtChunk, char **error_message)
+{
+    if (fmtChunk->wFormatTag != 1) {
+        format_module_set_error_message(error_message, "%s", _("Loading compressed wave data is not supported."));
+        return FALSE;
+    }
+
+    wav->hdr.sample_info.channels       = fmtChunk->wChannels;
+    wav->hdr.sample_info.samplesPerSec  = fmtChunk->dwSamplesPerSec;
+    wav->hdr.sample_info.avgBytesPerSec = fmtChunk->dwAvgBytesPerSec;
+    wav->hdr.sample_info.blockAlign     = fmtChunk->wBlockAlign;
+    wav->hdr.sample_info.bitsPerSample  = fmtChunk->wBitsPerSample;
+    wav->hdr.sample_info.blockSize      = wav->hdr.sample_info.avgBytesPerSec / CD_BLOCKS_PER_SEC;
+
+    return TRUE;
+}
+
 static OpenedAudioFile *
 wav_open_file(const FormatModule *self, const char *filename, char **error_message)
 {
@@ -110,82 +185,117 @@ wav_open_file(const FormatModule *self, const char *filename, char **error_messa
         goto error;
     }
 
-    /* read in format chunk header */
+    /**
+     * Walk all chunks. Besides the format and data chunks, we look at
+     * cue points and their labels as well as the broadcast extension,
+     * which can come after the data chunk.
+     **/
 
-    if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
-        format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
-        goto error;
-    }
+    gboolean have_format = FALSE;
+    gboolean have_data = FALSE;
+    unsigned int dataChunkSize = 0;
 
-    while (memcmp(chunkHdr.chunkID, FormatID, 4)) {
-        memcpy(str, chunkHdr.chunkID, 4);
-        str[4] = '\0';
-        g_warning("Chunk %s is not a Format Chunk", str);
+    GHashTable *cue_points = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GHashTable *cue_labels = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
 
-        if (fseek(wav->hdr.fp, chunkHdr.chunkSize, SEEK_CUR)) {
-            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), chunkHdr.chunkSize, wav->hdr.filename, strerror(errno));
-            goto error;
-        }
+    while (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) == 1) {
+        /* chunks are padded to an even number of bytes */
+        unsigned long skip_size = (unsigned int)chunkHdr.chunkSize + ((unsigned int)chunkHdr.chunkSize & 1);
 
-        if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
-            format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
-            goto error;
-        }
-    }
+        if (memcmp(chunkHdr.chunkID, FormatID, 4) == 0) {
+            /* read in format chunk data */
 
-    /* read in format chunk data */
+            if (chunkHdr.chunkSize < (int)sizeof(FormatChunk) || fread(&fmtChunk, sizeof(FormatChunk), 1, wav->hdr.fp) < 1) {
+                format_module_set_error_message(error_message, _("Error reading format chunk: %s"), strerror(errno));
+                goto error_free_cues;
+            }
 
-    if (fread(&fmtChunk, sizeof(FormatChunk), 1, wav->hdr.fp) < 1) {
-        format_module_set_error_message(error_message, _("Error reading format chunk: %s"), strerror(errno));
-        goto error;
-    }
+            if (!wav_apply_format_chunk(wav, &fmtChunk, error_message)) {
+                goto error_free_cues;
+            }
 
-    if (fmtChunk.wFormatTag != 1) {
-        format_module_set_error_message(error_message, "%s", _("Loading compressed wave data is not supported."));
-        goto error;
-    }
+            // if we have a FormatChunk that is larger than standard size, skip over extra data
+            skip_size -= sizeof(FormatChunk);
+            have_format = TRUE;
+        } else if (memcmp(chunkHdr.chunkID, WaveDataID, 4) == 0) {
+            long x;
+            if ((x = ftell(wav->hdr.fp)) >= 0) {
+                wav->wavDataPtr = x;
+            }
 
-    wav->hdr.sample_info.channels       = fmtChunk.wChannels;
-    wav->hdr.sample_info.samplesPerSec  = fmtChunk.dwSamplesPerSec;
-    wav->hdr.sample_info.avgBytesPerSec = fmtChunk.dwAvgBytesPerSec;
-    wav->hdr.sample_info.blockAlign     = fmtChunk.wBlockAlign;
-    wav->hdr.sample_info.bitsPerSample  = fmtChunk.wBitsPerSample;
-    wav->hdr.sample_info.blockSize      = wav->hdr.sample_info.avgBytesPerSec / CD_BLOCKS_PER_SEC;
+            dataChunkSize = chunkHdr.chunkSize;
+            have_data = TRUE;
 
-    // if we have a FormatChunk that is larger than standard size, skip over extra data
-    if (chunkHdr.chunkSize > sizeof(FormatChunk)) {
-        if (fseek(wav->hdr.fp, chunkHdr.chunkSize - sizeof(FormatChunk), SEEK_CUR)) {
-            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), chunkHdr.chunkSize, wav->hdr.filename, strerror(errno));
-            goto error;
-        }
-    }
+            if (wav->wavDataPtr + skip_size >= wav->hdr.file_size) {
+                /* nothing (or only a truncated part of the data) follows */
+                break;
+            }
+        } else if (memcmp(chunkHdr.chunkID, CueID, 4) == 0) {
+            uint32_t num_cue_points;
 
-    /* read in wav data header */
+            if (fread(&num_cue_points, sizeof(num_cue_points), 1, wav->hdr.fp) == 1) {
+                skip_size -= sizeof(num_cue_points);
 
-    if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
-        format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
-        goto error;
-    }
+                for (uint32_t i=0; i<num_cue_points && skip_size >= sizeof(CuePoint); ++i) {
+                    CuePoint cue;
+                    if (fread(&cue, sizeof(CuePoint), 1, wav->hdr.fp) < 1) {
+                        break;
+                    }
+                    skip_size -= sizeof(CuePoint);
 
-    while (memcmp(chunkHdr.chunkID, WaveDataID, 4)) {
-        memcpy(str, chunkHdr.chunkID, 4);
-        str[4] = '\0';
-        g_warning("Chunk %s is not a Format Chunk", str);
+                    g_hash_table_insert(cue_points, GUINT_TO_POINTER(cue.dwName), GUINT_TO_POINTER(cue.dwSampleOffset));
+                }
+            }
+        } else if (memcmp(chunkHdr.chunkID, ListID, 4) == 0 && chunkHdr.chunkSize > 4) {
+            char list_type[4];
 
-        if (fseek(wav->hdr.fp, chunkHdr.chunkSize, SEEK_CUR)) {
-            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), chunkHdr.chunkSize, wav->hdr.filename, strerror(errno));
-            goto error;
+            if (fread(list_type, sizeof(list_type), 1, wav->hdr.fp) == 1) {
+                skip_size -= sizeof(list_type);
+
+                /* only labels are read, the size comes from the file and is checked first */
+                long pos = ftell(wav->hdr.fp);
+                unsigned long list_size = chunkHdr.chunkSize - sizeof(list_type);
+
+                if (memcmp(list_type, AssocDataListID, 4) == 0 && pos >= 0 &&
+                        list_size <= ADTL_MAX_SIZE && pos + list_size <= wav->hdr.file_size) {
+                    unsigned char *list = g_malloc(list_size);
+
+                    if (fread(list, list_size, 1, wav->hdr.fp) == 1) {
+                        wav_parse_adtl(list, list_size, cue_labels);
+                        skip_size -= list_size;
+                    } else if (fseek(wav->hdr.fp, pos, SEEK_SET) != 0) {
+                        skip_size = 0;
+                    }
+
+                    g_free(list);
+                }
+            }
+        } else if (memcmp(chunkHdr.chunkID, BroadcastExtID, 4) == 0 && chunkHdr.chunkSize >= BEXT_DESCRIPTION_LENGTH) {
+            char description[BEXT_DESCRIPTION_LENGTH + 1];
+
+            if (fread(description, BEXT_DESCRIPTION_LENGTH, 1, wav->hdr.fp) == 1) {
+                description[BEXT_DESCRIPTION_LENGTH] = '\0';
+                g_strstrip(description);
+                if (*description != '\0') {
+                    wav->hdr.details = g_strdup_printf("Broadcast Wave, %s", description);
+                }
+                skip_size -= BEXT_DESCRIPTION_LENGTH;
+            }
+        } else {
+            memcpy(str, chunkHdr.chunkID, 4);
+            str[4] = '\0';
+            g_debug("Skipping chunk %s (%d bytes)", str, chunkHdr.chunkSize);
         }
 
-        if (fread(&chunkHdr, sizeof(ChunkHeader), 1, wav->hdr.fp) < 1) {
-            format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
-            goto error;
+        if (skip_size > 0 && fseek(wav->hdr.fp, skip_size, SEEK_CUR)) {
+            format_module_set_error_message(error_message, _("Error seeking to %u in %s: %s"), chunkHdr.chunkSize, wav->hdr.filename, strerror(errno));
+            goto error_free_cues;
         }
     }
 
-    long x;
-    if ((x = ftell(wav->hdr.fp)) >= 0) {
-        wav->wavDataPtr = x;
+    if (!have_format || !have_data) {
+        format_module_set_error_message(error_message, "%s", CHUNK_ERROR_MESSAGE);
+        goto error_free_cues;
     }
 
     /**
@@ -193,18 +303,114 @@ wav_open_file(const FormatModule *self, const char *filename, char **error_messa
      * use the header's size info here, but use the 
      * real file size, minus the header's size.
      ***/
-    if (wav->wavDataSize != 0 && chunkHdr.chunkSize > wav->wavDataSize) {
-        g_warning("Real file size is %lu, but wave header says it should be %d. Using real file size instead.",
-                wav->wavDataSize, chunkHdr.chunkSize);
+    if (wav->wavDataSize != 0 && dataChunkSize > wav->wavDataSize) {
+        g_warning("Real file size is %lu, but wave header says it should be %u. Using real file size instead.",
+                wav->wavDataSize, dataChunkSize);
         wav->wavDataSize = wav->wavDataSize - wav->wavDataPtr;
     } else {
-        wav->wavDataSize = chunkHdr.chunkSize;
+        wav->wavDataSize = dataChunkSize;
     }
 
+    /* cue point offsets are in sample frames */
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, cue_points);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        unsigned long position = (unsigned long)GPOINTER_TO_UINT(value) * wav->hdr.sample_info.blockAlign;
+
+        if (position <= wav->wavDataSize) {
+            opened_audio_file_add_marker(&wav->hdr, position, g_hash_table_lookup(cue_labels, key));
+        }
+    }
+
+    g_hash_table_destroy(cue_labels);
+    g_hash_table_destroy(cue_points);
+
     wav->hdr.sample_info.numBytes = wav->wavDataSize;
 
     return &wav->hdr;
 
+error_free_cues:
+    g_hash_table_destroy(cue_labels);
+    g_hash_table_destroy(cue_points);
+
+error:
+    wav_close_file(self, &wav->hdr);
+
+    return NULL;
+}
+
+/**
+ * Parse the header of a WAV stream up to the start of the data chunk,
+ * without seeking. Chunks before the data chunk are skipped, anything
+ * after it is never looked at.
+ **/
+static OpenedAudioFile *
+wav_open_stream(const FormatModule *self, FILE *fp, char **error_message)
+{
+    WaveHeader wavHdr;
+    ChunkHeader chunkHdr;
+    FormatChunk fmtChunk;
+    gboolean have_format = FALSE;
+
+    OpenedWavFile *wav = g_new0(OpenedWavFile, 1);
+
+    if (!format_module_open_stream(self, &wav->hdr, fp, error_message)) {
+        g_free(wav);
+        return NULL;
+    }
+
+    if (format_stream_read(&wav->hdr, (unsigned char *)&wavHdr, sizeof(WaveHeader)) < sizeof(WaveHeader)) {
+        format_module_set_error_message(error_message, "%s", _("Cannot read wave header."));
+        goto error;
+    }
+
+    if (memcmp(wavHdr.riffID, RiffID, 4) || memcmp(wavHdr.wavID, WaveID, 4)) {
+        format_module_set_error_message(error_message, _("%s is not a wave file."), wav->hdr.filename);
+        goto error;
+    }
+
+    while (format_stream_read(&wav->hdr, (unsigned char *)&chunkHdr, sizeof(ChunkHeader)) == sizeof(ChunkHeader)) {
+        unsigned long skip_size = (unsigned int)chunkHdr.chunkSize + ((unsigned int)chunkHdr.chunkSize & 1);
+
+        if (memcmp(chunkHdr.chunkID, FormatID, 4) == 0) {
+            if (chunkHdr.chunkSize < (int)sizeof(FormatChunk) ||
+                    format_stream_read(&wav->hdr, (unsigned char *)&fmtChunk, sizeof(FormatChunk)) < sizeof(FormatChunk)) {
+                format_module_set_error_message(error_message, "%s", _("Error reading format chunk"));
+                goto error;
+            }
+
+            if (!wav_apply_format_chunk(wav, &fmtChunk, error_message)) {
+                goto error;
+            }
+
+            skip_size -= sizeof(FormatChunk);
+            have_format = TRUE;
+        } else if (memcmp(chunkHdr.chunkID, WaveDataID, 4) == 0) {
+            if (!have_format) {
+                break;
+            }
+
+            wav->wavDataPtr = wav->hdr.stream_position;
+
+            /* encoders writing to a pipe can't know the size in advance */
+            if (chunkHdr.chunkSize == 0 || chunkHdr.chunkSize == -1 || (unsigned int)chunkHdr.chunkSize == 0x7fffffff) {
+                wav->wavDataSize = FORMAT_STREAM_SIZE_UNKNOWN;
+            } else {
+                wav->wavDataSize = (unsigned int)chunkHdr.chunkSize;
+                wav->hdr.sample_info.numBytes = wav->wavDataSize;
+            }
+
+            return &wav->hdr;
+        }
+
+        if (!format_stream_skip(&wav->hdr, skip_size)) {
+            break;
+        }
+    }
+
+    format_module_set_error_message(error_message, "%s", _("Error reading chunk. Maybe the wave file you are trying to load is truncated?"));
+
 error:
     wav_close_file(self, &wav->hdr);
 
@@ -216,10 +422,6 @@ wav_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, uns
 {
     OpenedWavFile *wav = (OpenedWavFile *)self;
 
-    if (fseek(wav->hdr.fp, start_pos + wav->wavDataPtr, SEEK_SET)) {
-        return -1;
-    }
-
     if (start_pos > wav->wavDataSize) {
         return -1;
     }
@@ -228,7 +430,7 @@ wav_read_samples(OpenedAudioFile *self, unsigned char *buf, size_t buf_size, uns
         buf_size = wav->wavDataSize - start_pos;
     }
 
-    return fread(buf, 1, buf_size, wav->hdr.fp);
+    return format_io_read(wav->hdr.fp, start_pos + wav->wavDataPtr, buf, buf_size);
 }
 
 int
@@ -236,70 +438,91 @@ wav_write_file(OpenedAudioFile *self, const char *output_filename, unsigned long
 {
     OpenedWavFile *wav = (OpenedWavFile *)self;
 
-    int buf_size = wav->hdr.sample_info.blockSize;
-
-    int ret;
     FILE *new_fp = NULL;
-    unsigned long cur_pos, num_bytes;
-    unsigned char *buf = malloc(buf_size);
+    unsigned long num_bytes;
 
     if (start_pos > wav->wavDataSize) {
         goto error;
     }
 
+    if (end_pos == 0 || end_pos > wav->wavDataSize) {
+        end_pos = wav->wavDataSize;
+    }
+
+    num_bytes = end_pos - start_pos;
+
     if ((new_fp = fopen(output_filename, "wb")) == NULL) {
         g_warning("Error opening %s for writing", output_filename);
         goto error;
     }
 
-    start_pos += wav->wavDataPtr;
-    if (end_pos != 0) {
-        end_pos += wav->wavDataPtr;
-        num_bytes = end_pos - start_pos;
-    } else {
-        num_bytes = wav->wavDataSize + wav->wavDataPtr - start_pos;
-    }
-    cur_pos = start_pos;
-
     if ((wav_write_file_header(new_fp, &wav->hdr.sample_info, num_bytes)) != 0) {
         g_message("Could not write WAV header to %s", output_filename);
         goto error;
     }
 
-    if (fseek(wav->hdr.fp, cur_pos, SEEK_SET)) {
-        g_message("Could not seek to read position in %s", wav->hdr.filename);
-        goto error;
-    }
-
     report_progress(0.0, report_progress_user_data);
 
-    while ((ret = fread(buf, 1, buf_size, wav->hdr.fp)) > 0 &&
-                (cur_pos < end_pos || end_pos == 0)) {
-        if ((fwrite(buf, 1, ret, new_fp)) < ret) {
-            g_message("Error writing to file %s", output_filename);
-            goto error;
-        }
-
-        cur_pos += ret;
-        report_progress((double)(cur_pos - start_pos) / num_bytes, report_progress_user_data);
+    if (format_io_copy(wav->hdr.fp, wav->wavDataPtr + start_pos, new_fp, num_bytes, report_progress, report_progress_user_data) != 0) {
+        g_message("Error writing to file %s", output_filename);
+        goto error;
     }
 
-    free(buf);
-    fclose(new_fp);
+    if (fclose(new_fp) != 0) {
+        g_message("Error writing to file %s", output_filename);
+        return -1;
+    }
 
     report_progress(1.0, report_progress_user_data);
 
-    return ret;
+    return 0;
 
 error:
     if (new_fp != NULL) {
         fclose(new_fp);
     }
 
-    free(buf);
     return -1;
 }
 
+static void
+wav_build_region_header(OpenedAudioFile *self, unsigned char *header, unsigned long num_bytes)
+{
+    wav_build_file_header(header, &self->sample_info, num_bytes);
+}
+
+static FormatRawLayout
+wav_get_raw_layout(OpenedAudioFile *self)
+{
+    OpenedWavFile *wav = (OpenedWavFile *)self;
+
+    FormatRawLayout layout = {
+        .data_offset = wav->wavDataPtr,
+        .data_size = wav->wavDataSize,
+        .build_header = wav_build_region_header,
+        .header_size = WAV_FILE_HEADER_SIZE,
+        .pad_to_even = FALSE,
+        .big_endian = FALSE,
+    };
+
+    return layout;
+}
+
+static int
+wav_write_regions(OpenedAudioFile *self, FormatRegion *regions, int n_regions, const FormatRegionCallbacks *callbacks)
+{
+    FormatRawLayout layout = wav_get_raw_layout(self);
+
+    return format_raw_write_regions(self, &layout, regions, n_regions, callbacks);
+}
+
+static gboolean
+wav_get_output_size(OpenedAudioFile *self, unsigned long start_pos, unsigned long end_pos, uint64_t *size)
+{
+    FormatRawLayout layout = wav_get_raw_layout(self);
+
+    return format_raw_get_output_size(&layout, start_pos, end_pos, size);
+}
 
 static const FormatModule
 WAV_FORMAT_MODULE = {
@@ -308,10 +531,13 @@ WAV_FORMAT_MODULE = {
     .default_file_extension = ".wav",
 
     .open_file = wav_open_file,
+    .open_stream = wav_open_stream,
     .close_file = wav_close_file,
 
     .read_samples = wav_read_samples,
     .write_file = wav_write_file,
+    .write_regions = wav_write_regions,
+    .get_output_size = wav_get_output_size,
 };
 
 const FormatModule *
@@ -321,36 +547,30 @@ format_module_wav()
 }
 
 
-int
-wav_write_file_header(FILE *fp,
-                      SampleInfo *sample_info,
-                      unsigned long num_bytes)
+static void
+wav_build_file_header(unsigned char *buf, SampleInfo *sample_info, unsigned long num_bytes)
 {
     WaveHeader wavHdr;
     ChunkHeader chunkHdr;
     FormatChunk fmtChunk;
 
-    /* Write wave header */
+    /* Wave header */
     memcpy(wavHdr.riffID, RiffID, 4);
     wavHdr.totSize = num_bytes + sizeof(ChunkHeader) + sizeof(FormatChunk)
                                + sizeof(ChunkHeader) + 4;
     memcpy(wavHdr.wavID, WaveID, 4);
 
-    if ((fwrite(&wavHdr, sizeof(WaveHeader), 1, fp)) < 1) {
-        printf("error writing wave header\n");
-        return 1;
-    }
+    memcpy(buf, &wavHdr, sizeof(WaveHeader));
+    buf += sizeof(WaveHeader);
 
-    /* Write format chunk header */
+    /* Format chunk header */
     memcpy(chunkHdr.chunkID, FormatID, 4);
     chunkHdr.chunkSize = sizeof(FormatChunk);
 
-    if ((fwrite(&chunkHdr, sizeof(ChunkHeader), 1, fp)) < 1) {
-        printf("error writing fmt chunk header\n");
-        return 1; 
-    }
+    memcpy(buf, &chunkHdr, sizeof(ChunkHeader));
+    buf += sizeof(ChunkHeader);
 
-    /* Write format chunk data */
+    /* Format chunk data */
     fmtChunk.wFormatTag            = 1;
     fmtChunk.wChannels            = sample_info->channels;
     fmtChunk.dwSamplesPerSec    = sample_info->samplesPerSec;
@@ -358,18 +578,28 @@ wav_write_file_header(FILE *fp,
     fmtChunk.wBlockAlign        = sample_info->blockAlign;
     fmtChunk.wBitsPerSample        = sample_info->bitsPerSample;
 
-    if (fwrite(&fmtChunk, sizeof(FormatChunk), 1, fp) < 1) {
-        printf("error writing format chunk\n");
-        return 1;
-    }
+    memcpy(buf, &fmtChunk, sizeof(FormatChunk));
+    buf += sizeof(FormatChunk);
 
-    /* Write data chunk header */
+    /* Data chunk header */
     memcpy(chunkHdr.chunkID, WaveDataID, 4);
     chunkHdr.chunkSize = num_bytes;
 
-    if ((fwrite(&chunkHdr, sizeof(ChunkHeader), 1, fp)) < 1) {
-        printf("error writing data chunk header\n");
-        return 1; 
+    memcpy(buf, &chunkHdr, sizeof(ChunkHeader));
+}
+
+int
+wav_write_file_header(FILE *fp,
+                      SampleInfo *sample_info,
+                      unsigned long num_bytes)
+{
+    unsigned char buf[WAV_FILE_HEADER_SIZE];
+
+    wav_build_file_header(buf, sample_info, num_bytes);
+
+    if ((fwrite(buf, sizeof(buf), 1, fp)) < 1) {
+        printf("error writing wave header\n");
+        return 1;
     }
 
     return 0;
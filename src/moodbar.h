@@ -19,22 +19,34 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-#include <gtk/gtk.h>
+#include <glib.h>
+
+/**
+ * Moodbar data and .mood files (3 bytes per frame), shared by the GUI and
+ * "wavcli render". Nothing in here needs GTK or a display.
+ **/
 
 typedef struct MoodbarData_ MoodbarData;
 struct MoodbarData_ {
     unsigned long numFrames;
-    GdkRGBA *frames;
+    /* red, green and blue of each frame, as stored in .mood files */
+    guint8 *rgb;
 };
 
-void
-moodbar_generate(GtkWidget *window, const gchar *filename);
-
-void
-moodbar_abort();
+/* name of the .mood file of an audio file (free() it) */
+gchar *
+moodbar_get_filename(const gchar *filename);
 
+/**
+ * Read the .mood file of an audio file (same name, ".mood" extension),
+ * NULL if there is none or moodbar support is disabled.
+ **/
 MoodbarData *
 moodbar_open(const gchar *filename);
 
+/* write a .mood file */
+gboolean
+moodbar_write(const MoodbarData *data, const gchar *filename);
+
 void
 moodbar_free(MoodbarData *data);
@@ -0,0 +1,292 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "moodbar_analysis.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* one FFT per block, of the largest power of two that fits into it */
+#define FFT_MIN_SIZE 64
+#define FFT_MAX_SIZE 1024
+
+/* upper edges (in Hz) of Bark bands 7, 15 and 23, for red, green and blue */
+static const float BAND_EDGES[3] = { 920.f, 3150.f, 15500.f };
+
+/* the quietest and loudest 0.2% of each color are clipped when normalizing */
+#define NORMALIZE_CLIP_PERMILLE 2
+
+struct MoodbarAnalysis_ {
+    int channels;
+    int bytes_per_sample;
+    int frame_size;
+
+    unsigned long num_blocks;
+    unsigned long num_frames;
+
+    int fft_size;
+    float *window;
+    unsigned int *bitrev;
+    /* the twiddle factors of the stage with butterflies of size 2*half start at index half */
+    float *twiddle_re;
+    float *twiddle_im;
+    /* color (0..2) of each frequency bin, -1 if it is not used */
+    signed char *bin_color;
+
+    float *re;
+    float *im;
+
+    /* sum of the colors of the blocks of each moodbar frame */
+    double *sums;
+    unsigned long *counts;
+};
+
+MoodbarAnalysis *
+moodbar_analysis_new(const SampleInfo *sample_info, unsigned long num_blocks)
+{
+    int bits = sample_info->bitsPerSample;
+    int channels = sample_info->channels;
+
+    if ((bits != 8 && bits != 16 && bits != 24) || channels == 0 || num_blocks == 0 ||
+            sample_info->blockAlign < channels * bits / 8) {
+        return NULL;
+    }
+
+    int fft_size = FFT_MIN_SIZE;
+    while (fft_size < FFT_MAX_SIZE && fft_size * 2 * sample_info->blockAlign <= sample_info->blockSize) {
+        fft_size *= 2;
+    }
+
+    MoodbarAnalysis *analysis = g_new0(MoodbarAnalysis, 1);
+
+    analysis->channels = channels;
+    analysis->bytes_per_sample = bits / 8;
+    analysis->frame_size = sample_info->blockAlign;
+    analysis->num_blocks = num_blocks;
+    analysis->num_frames = MIN(num_blocks, MOODBAR_ANALYSIS_FRAMES);
+    analysis->fft_size = fft_size;
+
+    analysis->window = g_new(float, fft_size);
+    analysis->bitrev = g_new(unsigned int, fft_size);
+    analysis->twiddle_re = g_new0(float, fft_size);
+    analysis->twiddle_im = g_new0(float, fft_size);
+    analysis->bin_color = g_new(signed char, fft_size / 2);
+    analysis->re = g_new(float, fft_size);
+    analysis->im = g_new(float, fft_size);
+    analysis->sums = g_new0(double, analysis->num_frames * 3);
+    analysis->counts = g_new0(unsigned long, analysis->num_frames);
+
+    int log2_size = 0;
+    while ((1 << log2_size) < fft_size) {
+        ++log2_size;
+    }
+
+    for (int i=0; i<fft_size; ++i) {
+        /* Hann window */
+        analysis->window[i] = 0.5f - 0.5f * cosf(2.f * (float)G_PI * i / fft_size);
+
+        unsigned int reversed = 0;
+        for (int bit=0; bit<log2_size; ++bit) {
+            reversed |= ((i >> bit) & 1) << (log2_size - 1 - bit);
+        }
+        analysis->bitrev[i] = reversed;
+    }
+
+    for (int half=1; half<fft_size; half*=2) {
+        for (int k=0; k<half; ++k) {
+            analysis->twiddle_re[half + k] = cosf((float)G_PI * k / half);
+            analysis->twiddle_im[half + k] = -sinf((float)G_PI * k / half);
+        }
+    }
+
+    for (int i=0; i<fft_size/2; ++i) {
+        float frequency = (float)i * sample_info->samplesPerSec / fft_size;
+
+        analysis->bin_color[i] = -1;
+        for (int color=0; i > 0 && color<3; ++color) {
+            if (frequency < BAND_EDGES[color]) {
+                analysis->bin_color[i] = color;
+                break;
+            }
+        }
+    }
+
+    return analysis;
+}
+
+/* sample of one channel as float in [-1, 1) */
+static inline float
+decode_sample(const unsigned char *p, int bytes_per_sample)
+{
+    switch (bytes_per_sample) {
+        case 1:
+            return ((int)p[0] - 128) / 128.f;
+        case 2:
+            return (int16_t)(p[0] | (p[1] << 8)) / 32768.f;
+        default:
+            return ((int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8) / 8388608.f;
+    }
+}
+
+/**
+ * In-place radix-2 FFT of data in bit-reversed order. Real and imaginary
+ * parts are kept in separate arrays, and each stage has its own row of
+ * twiddle factors, so the inner loop reads everything sequentially and
+ * the compiler can vectorize it.
+ **/
+static void
+fft(MoodbarAnalysis *analysis)
+{
+    int n = analysis->fft_size;
+
+    for (int half=1; half<n; half*=2) {
+        const float *restrict wr = analysis->twiddle_re + half;
+        const float *restrict wi = analysis->twiddle_im + half;
+
+        for (int start=0; start<n; start+=2*half) {
+            float *restrict ar = analysis->re + start;
+            float *restrict ai = analysis->im + start;
+            float *restrict br = analysis->re + start + half;
+            float *restrict bi = analysis->im + start + half;
+
+            for (int k=0; k<half; ++k) {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+void
+moodbar_analysis_add_block(MoodbarAnalysis *analysis, unsigned long block, const unsigned char *buf, long size)
+{
+    int n = analysis->fft_size;
+    long frames = MIN(size / analysis->frame_size, n);
+
+    if (frames == 0 || block >= analysis->num_blocks) {
+        return;
+    }
+
+    /* downmix to mono, a partial block at the end of the file is padded with silence */
+    for (int i=0; i<n; ++i) {
+        float value = 0.f;
+
+        if (i < frames) {
+            const unsigned char *frame = buf + (size_t)i * analysis->frame_size;
+            for (int channel=0; channel<analysis->channels; ++channel) {
+                value += decode_sample(frame + channel * analysis->bytes_per_sample, analysis->bytes_per_sample);
+            }
+            value /= analysis->channels;
+        }
+
+        analysis->re[analysis->bitrev[i]] = value * analysis->window[i];
+        analysis->im[i] = 0.f;
+    }
+
+    fft(analysis);
+
+    float rgb[3] = { 0.f, 0.f, 0.f };
+    for (int i=1; i<n/2; ++i) {
+        int color = analysis->bin_color[i];
+        if (color >= 0) {
+            rgb[color] += sqrtf(analysis->re[i] * analysis->re[i] + analysis->im[i] * analysis->im[i]);
+        }
+    }
+
+    unsigned long frame = block * analysis->num_frames / analysis->num_blocks;
+    for (int color=0; color<3; ++color) {
+        analysis->sums[frame * 3 + color] += rgb[color];
+    }
+    analysis->counts[frame]++;
+}
+
+static int
+compare_float(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+MoodbarData *
+moodbar_analysis_finish(MoodbarAnalysis *analysis)
+{
+    unsigned long num_frames = analysis->num_frames;
+
+    MoodbarData *result = g_new0(MoodbarData, 1);
+    result->numFrames = num_frames;
+    result->rgb = g_new(guint8, num_frames * 3);
+
+    float *values = g_new(float, num_frames);
+    float *sorted = g_new(float, num_frames);
+
+    for (int color=0; color<3; ++color) {
+        for (unsigned long i=0; i<num_frames; ++i) {
+            if (analysis->counts[i] > 0) {
+                values[i] = analysis->sums[i * 3 + color] / analysis->counts[i];
+            } else {
+                /* frames without blocks (if the file is shorter than expected) */
+                values[i] = (i > 0) ? values[i - 1] : 0.f;
+            }
+        }
+
+        /* stretch each color to the full range, like the "moodbar" tool */
+        memcpy(sorted, values, num_frames * sizeof(float));
+        qsort(sorted, num_frames, sizeof(float), compare_float);
+
+        unsigned long clip = num_frames * NORMALIZE_CLIP_PERMILLE / 1000;
+        float lo = sorted[clip];
+        float hi = sorted[num_frames - 1 - clip];
+        float range = hi - lo;
+
+        for (unsigned long i=0; i<num_frames; ++i) {
+            float value = (range > 0.f) ? CLAMP((values[i] - lo) / range, 0.f, 1.f) : 0.f;
+            result->rgb[i * 3 + color] = value * 255.f + 0.5f;
+        }
+    }
+
+    g_free(sorted);
+    g_free(values);
+
+    moodbar_analysis_free(analysis);
+
+    return result;
+}
+
+void
+moodbar_analysis_free(MoodbarAnalysis *analysis)
+{
+    g_free(analysis->window);
+    g_free(analysis->bitrev);
+    g_free(analysis->twiddle_re);
+    g_free(analysis->twiddle_im);
+    g_free(analysis->bin_color);
+    g_free(analysis->re);
+    g_free(analysis->im);
+    g_free(analysis->sums);
+    g_free(analysis->counts);
+    g_free(analysis);
+}
@@ -0,0 +1,55 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "sample_info.h"
+#include "moodbar.h"
+
+#include <glib.h>
+
+/**
+ * Moodbar colors computed from the audio data as it is analyzed, like the
+ * "moodbar" tool does: the spectrum of each block is split into low, mid
+ * and high frequencies (Bark bands 0-7, 8-15 and 16-23), which become the
+ * red, green and blue parts of the color of the moodbar frame the block
+ * belongs to.
+ **/
+
+/* number of frames of a moodbar, the same as .mood files of the "moodbar" tool */
+#define MOODBAR_ANALYSIS_FRAMES 1000
+
+typedef struct MoodbarAnalysis_ MoodbarAnalysis;
+
+/**
+ * Start the analysis of num_blocks blocks of sample_info->blockSize bytes,
+ * NULL if the sample format is not supported.
+ **/
+MoodbarAnalysis *
+moodbar_analysis_new(const SampleInfo *sample_info, unsigned long num_blocks);
+
+/* add the (possibly partial) block with the given index */
+void
+moodbar_analysis_add_block(MoodbarAnalysis *analysis, unsigned long block, const unsigned char *buf, long size);
+
+/* normalize the colors and free the analysis */
+MoodbarData *
+moodbar_analysis_finish(MoodbarAnalysis *analysis);
+
+void
+moodbar_analysis_free(MoodbarAnalysis *analysis);
@@ -0,0 +1,197 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "peaks.h"
+
+#include <string.h>
+
+#define PEAKS_VERSION 2
+
+/* flags of the binary format */
+#define PEAKS_FLAG_8_BIT 1
+
+Peaks *
+peaks_new(const GraphData *graph_data, const SampleInfo *sample_info, unsigned int samples_per_pixel, int bits)
+{
+    int source_bits = sample_info->bitsPerSample;
+
+    if ((source_bits != 8 && source_bits != 16 && source_bits != 24) || (bits != 8 && bits != 16) ||
+            graph_data->data == NULL || sample_info->samplesPerSec < CD_BLOCKS_PER_SEC) {
+        return NULL;
+    }
+
+    unsigned int samples_per_block = sample_info->samplesPerSec / CD_BLOCKS_PER_SEC;
+    unsigned long blocks_per_pixel = MAX((samples_per_pixel + samples_per_block / 2) / samples_per_block, 1);
+
+    Peaks *peaks = g_new0(Peaks, 1);
+
+    peaks->sample_rate = sample_info->samplesPerSec;
+    peaks->samples_per_pixel = blocks_per_pixel * samples_per_block;
+    peaks->bits = bits;
+    peaks->length = (graph_data->numSamples + blocks_per_pixel - 1) / blocks_per_pixel;
+    peaks->data = g_new(gint16, MAX(peaks->length, 1) * 2);
+
+    for (unsigned long i=0; i<peaks->length; i++) {
+        unsigned long first = i * blocks_per_pixel;
+        unsigned long last = MIN(first + blocks_per_pixel, graph_data->numSamples);
+        int min = 0, max = 0;
+
+        for (unsigned long block=first; block<last; block++) {
+            min = MIN(min, graph_data->data[block].min);
+            max = MAX(max, graph_data->data[block].max);
+        }
+
+        /* the graph data has the range of the samples in the file */
+        if (source_bits > bits) {
+            min >>= source_bits - bits;
+            max >>= source_bits - bits;
+        } else {
+            min <<= bits - source_bits;
+            max <<= bits - source_bits;
+        }
+
+        peaks->data[i * 2] = min;
+        peaks->data[i * 2 + 1] = max;
+    }
+
+    return peaks;
+}
+
+static const struct {
+    const char *name;
+    const char *extension;
+    enum PeaksFormat format;
+} FORMAT_NAMES[] = {
+    { "dat", ".dat", PEAKS_FORMAT_DAT },
+    { "json", ".json", PEAKS_FORMAT_JSON },
+};
+
+gboolean
+peaks_parse_format(const char *str, enum PeaksFormat *format)
+{
+    for (size_t i=0; str != NULL && i<G_N_ELEMENTS(FORMAT_NAMES); ++i) {
+        if (strcmp(str, FORMAT_NAMES[i].name) == 0) {
+            *format = FORMAT_NAMES[i].format;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+const char *
+peaks_format_extension(enum PeaksFormat format)
+{
+    for (size_t i=0; i<G_N_ELEMENTS(FORMAT_NAMES); ++i) {
+        if (FORMAT_NAMES[i].format == format) {
+            return FORMAT_NAMES[i].extension;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+peaks_put_le32(unsigned char *p, guint32 value)
+{
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static gboolean
+peaks_write_dat(const Peaks *peaks, FILE *fp)
+{
+    unsigned char header[24];
+
+    /* version, flags, sample rate, samples per pixel, length, channels */
+    peaks_put_le32(header, PEAKS_VERSION);
+    peaks_put_le32(header + 4, (peaks->bits == 8) ? PEAKS_FLAG_8_BIT : 0);
+    peaks_put_le32(header + 8, peaks->sample_rate);
+    peaks_put_le32(header + 12, peaks->samples_per_pixel);
+    peaks_put_le32(header + 16, peaks->length);
+    peaks_put_le32(header + 20, 1);
+
+    if (fwrite(header, sizeof(header), 1, fp) != 1) {
+        return FALSE;
+    }
+
+    int bytes_per_value = peaks->bits / 8;
+    size_t size = peaks->length * 2 * bytes_per_value;
+    unsigned char *buf = g_malloc(MAX(size, 1));
+
+    for (unsigned long i=0; i<peaks->length * 2; i++) {
+        guint16 value = (guint16)peaks->data[i];
+
+        if (bytes_per_value == 1) {
+            buf[i] = value & 0xff;
+        } else {
+            buf[i * 2] = value & 0xff;
+            buf[i * 2 + 1] = value >> 8;
+        }
+    }
+
+    gboolean ok = (size == 0 || fwrite(buf, size, 1, fp) == 1);
+    g_free(buf);
+
+    return ok;
+}
+
+static gboolean
+peaks_write_json(const Peaks *peaks, FILE *fp)
+{
+    GString *str = g_string_new(NULL);
+
+    g_string_append_printf(str, "{\"version\":%d,\"channels\":1,\"sample_rate\":%u,\"samples_per_pixel\":%u,"
+            "\"bits\":%d,\"length\":%lu,\"data\":[", PEAKS_VERSION, peaks->sample_rate, peaks->samples_per_pixel,
+            peaks->bits, peaks->length);
+
+    for (unsigned long i=0; i<peaks->length * 2; i++) {
+        g_string_append_printf(str, (i == 0) ? "%d" : ",%d", peaks->data[i]);
+    }
+
+    g_string_append(str, "]}\n");
+
+    gboolean ok = (fwrite(str->str, 1, str->len, fp) == str->len);
+    g_string_free(str, TRUE);
+
+    return ok;
+}
+
+gboolean
+peaks_write(const Peaks *peaks, enum PeaksFormat format, FILE *fp)
+{
+    switch (format) {
+        case PEAKS_FORMAT_DAT:
+            return peaks_write_dat(peaks, fp);
+        case PEAKS_FORMAT_JSON:
+            return peaks_write_json(peaks, fp);
+    }
+
+    return FALSE;
+}
+
+void
+peaks_free(Peaks *peaks)
+{
+    g_free(peaks->data);
+    g_free(peaks);
+}
@@ -0,0 +1,70 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "sample.h"
+#include "sample_info.h"
+
+#include <glib.h>
+#include <stdio.h>
+
+/**
+ * Peaks of the analysis (GraphData) for web waveform players, in the
+ * binary (.dat) and JSON formats of BBC audiowaveform (version 2, one
+ * channel), as read by peaks.js and waveform-data.js.
+ **/
+
+enum PeaksFormat {
+    PEAKS_FORMAT_DAT = 0,
+    PEAKS_FORMAT_JSON,
+};
+
+typedef struct Peaks_ Peaks;
+struct Peaks_ {
+    unsigned int sample_rate;
+    /* a multiple of the samples per block (1/75 s) of the analysis */
+    unsigned int samples_per_pixel;
+    /* 8 or 16 */
+    int bits;
+    /* number of pixels */
+    unsigned long length;
+    /* min and max of each pixel */
+    gint16 *data;
+};
+
+/**
+ * Combine the peaks of the analysis to pixels of about samples_per_pixel
+ * samples each, rounded to whole blocks (at least one block per pixel,
+ * which is also what 0 gives), and scale them to the given number of
+ * bits. Returns NULL if the graph data has an unsupported sample format.
+ **/
+Peaks *
+peaks_new(const GraphData *graph_data, const SampleInfo *sample_info, unsigned int samples_per_pixel, int bits);
+
+gboolean
+peaks_parse_format(const char *str, enum PeaksFormat *format);
+
+const char *
+peaks_format_extension(enum PeaksFormat format);
+
+gboolean
+peaks_write(const Peaks *peaks, enum PeaksFormat format, FILE *fp);
+
+void
+peaks_free(Peaks *peaks);
@@ -0,0 +1,120 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "ring_buffer.h"
+
+#include <string.h>
+
+/* keeps the free-running counters far away from overflowing into each other */
+#define RING_BUFFER_MAX_CAPACITY (1u << 30)
+
+struct RingBuffer_ {
+    unsigned char *data;
+    guint capacity;
+    guint mask;
+
+    /*
+     * Total number of bytes written and read, wrapping around. Each is
+     * only modified by one side; the atomic accesses order the copies
+     * of the data against the updates of the counters.
+     */
+    gint write_count;
+    gint read_count;
+};
+
+RingBuffer *
+ring_buffer_new(size_t min_capacity)
+{
+    RingBuffer *ring = g_new0(RingBuffer, 1);
+
+    guint capacity = 1;
+    while (capacity < min_capacity && capacity < RING_BUFFER_MAX_CAPACITY) {
+        capacity <<= 1;
+    }
+
+    ring->data = g_malloc(capacity);
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+
+    return ring;
+}
+
+size_t
+ring_buffer_get_capacity(RingBuffer *ring)
+{
+    return ring->capacity;
+}
+
+size_t
+ring_buffer_get_fill(RingBuffer *ring)
+{
+    return (guint)g_atomic_int_get(&ring->write_count) - (guint)g_atomic_int_get(&ring->read_count);
+}
+
+size_t
+ring_buffer_write(RingBuffer *ring, const unsigned char *buf, size_t size)
+{
+    guint write_count = (guint)g_atomic_int_get(&ring->write_count);
+    guint read_count = (guint)g_atomic_int_get(&ring->read_count);
+
+    size = MIN(size, ring->capacity - (write_count - read_count));
+
+    guint offset = write_count & ring->mask;
+    size_t first = MIN(size, ring->capacity - offset);
+
+    memcpy(ring->data + offset, buf, first);
+    memcpy(ring->data, buf + first, size - first);
+
+    g_atomic_int_set(&ring->write_count, (gint)(write_count + (guint)size));
+
+    return size;
+}
+
+size_t
+ring_buffer_read(RingBuffer *ring, unsigned char *buf, size_t size)
+{
+    guint read_count = (guint)g_atomic_int_get(&ring->read_count);
+    guint write_count = (guint)g_atomic_int_get(&ring->write_count);
+
+    size = MIN(size, write_count - read_count);
+
+    guint offset = read_count & ring->mask;
+    size_t first = MIN(size, ring->capacity - offset);
+
+    memcpy(buf, ring->data + offset, first);
+    memcpy(buf + first, ring->data, size - first);
+
+    g_atomic_int_set(&ring->read_count, (gint)(read_count + (guint)size));
+
+    return size;
+}
+
+void
+ring_buffer_clear(RingBuffer *ring)
+{
+    g_atomic_int_set(&ring->read_count, g_atomic_int_get(&ring->write_count));
+}
+
+void
+ring_buffer_free(RingBuffer *ring)
+{
+    g_free(ring->data);
+    g_free(ring);
+}
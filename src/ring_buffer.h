@@ -0,0 +1,67 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include <stddef.h>
+
+/**
+ * Lock-free byte ring buffer for exactly one producer thread and one
+ * consumer thread. Reads and writes never block; they transfer as many
+ * bytes as are currently available (or free) and return that count.
+ **/
+
+typedef struct RingBuffer_ RingBuffer;
+
+/**
+ * The capacity is rounded up to the next power of two.
+ **/
+RingBuffer *
+ring_buffer_new(size_t min_capacity);
+
+size_t
+ring_buffer_get_capacity(RingBuffer *ring);
+
+/**
+ * Number of bytes that can currently be read.
+ **/
+size_t
+ring_buffer_get_fill(RingBuffer *ring);
+
+/**
+ * Producer side: copy up to size bytes into the buffer.
+ **/
+size_t
+ring_buffer_write(RingBuffer *ring, const unsigned char *buf, size_t size);
+
+/**
+ * Consumer side: copy up to size bytes out of the buffer.
+ **/
+size_t
+ring_buffer_read(RingBuffer *ring, unsigned char *buf, size_t size);
+
+/**
+ * Consumer side: drop all data currently in the buffer.
+ **/
+void
+ring_buffer_clear(RingBuffer *ring);
+
+void
+ring_buffer_free(RingBuffer *ring);
@@ -0,0 +1,369 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* syncfs() and sync_file_range() are Linux extensions, declared only with _GNU_SOURCE */
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif /* __linux__ */
+
+#include <config.h>
+
+#include "safe_output.h"
+
+#include <glib/gstdio.h>
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(G_OS_WIN32)
+#include <windows.h>
+#include <io.h>
+#define fsync _commit
+#endif /* G_OS_WIN32 */
+
+struct SafeOutputFile_ {
+    char *filename;
+    char *temp_filename;
+    /* set by safe_output_sync_files() if the data might not be on disk */
+    gboolean sync_failed;
+};
+
+struct SafeOutput_ {
+    enum SafeOutputDurability durability;
+
+    /* list of SafeOutputFile *, in the order they were added */
+    GList *files;
+};
+
+static const struct {
+    const char *name;
+    enum SafeOutputDurability durability;
+} DURABILITY_NAMES[] = {
+    { "none", SAFE_OUTPUT_DURABILITY_NONE },
+    { "batch", SAFE_OUTPUT_DURABILITY_BATCH },
+    { "syncfs", SAFE_OUTPUT_DURABILITY_SYNCFS },
+};
+
+gboolean
+safe_output_parse_durability(const char *str, enum SafeOutputDurability *durability)
+{
+    for (size_t i=0; str != NULL && i<G_N_ELEMENTS(DURABILITY_NAMES); ++i) {
+        if (strcmp(str, DURABILITY_NAMES[i].name) == 0) {
+            *durability = DURABILITY_NAMES[i].durability;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+SafeOutput *
+safe_output_new(enum SafeOutputDurability durability)
+{
+    SafeOutput *output = g_new0(SafeOutput, 1);
+
+    output->durability = durability;
+
+    return output;
+}
+
+SafeOutputFile *
+safe_output_add(SafeOutput *output, const char *filename)
+{
+    SafeOutputFile *file = g_new0(SafeOutputFile, 1);
+
+    gchar *dirname = g_path_get_dirname(filename);
+    gchar *basename = g_path_get_basename(filename);
+
+    /* hidden file in the same directory, so that rename() is atomic */
+    file->filename = g_strdup(filename);
+    file->temp_filename = g_strdup_printf("%s%c.%s.%08x.part", dirname, G_DIR_SEPARATOR, basename, g_random_int());
+
+    g_free(basename);
+    g_free(dirname);
+
+    output->files = g_list_append(output->files, file);
+
+    return file;
+}
+
+const char *
+safe_output_file_get_temp_filename(SafeOutputFile *file)
+{
+    return file->temp_filename;
+}
+
+static void
+safe_output_file_free(SafeOutputFile *file)
+{
+    g_free(file->filename);
+    g_free(file->temp_filename);
+    g_free(file);
+}
+
+void
+safe_output_discard(SafeOutput *output, SafeOutputFile *file)
+{
+    g_unlink(file->temp_filename);
+
+    output->files = g_list_remove(output->files, file);
+    safe_output_file_free(file);
+}
+
+static gboolean
+sync_path(const char *path)
+{
+    int fd = g_open(path, O_RDONLY, 0);
+
+    if (fd == -1) {
+        return FALSE;
+    }
+
+    gboolean result = (fsync(fd) == 0);
+
+    /* for the caller's error message */
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+
+    return result;
+}
+
+static GList *
+safe_output_get_dirnames(SafeOutput *output)
+{
+    GList *dirnames = NULL;
+
+    for (GList *cur = output->files; cur != NULL; cur = g_list_next(cur)) {
+        SafeOutputFile *file = cur->data;
+        gchar *dirname = g_path_get_dirname(file->filename);
+
+        if (g_list_find_custom(dirnames, dirname, (GCompareFunc)strcmp) == NULL) {
+            dirnames = g_list_append(dirnames, dirname);
+        } else {
+            g_free(dirname);
+        }
+    }
+
+    return dirnames;
+}
+
+#if defined(__linux__)
+static void
+safe_output_syncfs(SafeOutput *output)
+{
+    /* one syncfs() per filesystem, told apart by the device of each directory */
+    GArray *devices = g_array_new(FALSE, FALSE, sizeof(dev_t));
+    GArray *results = g_array_new(FALSE, FALSE, sizeof(gboolean));
+
+    for (GList *cur = output->files; cur != NULL; cur = g_list_next(cur)) {
+        SafeOutputFile *file = cur->data;
+        gchar *dirname = g_path_get_dirname(file->filename);
+        GStatBuf st;
+
+        if (g_stat(dirname, &st) != 0) {
+            g_warning("Could not sync filesystem of %s: %s", dirname, g_strerror(errno));
+            file->sync_failed = TRUE;
+            g_free(dirname);
+            continue;
+        }
+
+        guint i = 0;
+        while (i < devices->len && g_array_index(devices, dev_t, i) != st.st_dev) {
+            ++i;
+        }
+
+        if (i == devices->len) {
+            int fd = g_open(dirname, O_RDONLY, 0);
+            gboolean ok = (fd != -1 && syncfs(fd) == 0);
+
+            if (!ok) {
+                g_warning("Could not sync filesystem of %s: %s", dirname, g_strerror(errno));
+            }
+
+            if (fd != -1) {
+                close(fd);
+            }
+
+            g_array_append_val(devices, st.st_dev);
+            g_array_append_val(results, ok);
+        }
+
+        file->sync_failed = !g_array_index(results, gboolean, i);
+        g_free(dirname);
+    }
+
+    g_array_free(results, TRUE);
+    g_array_free(devices, TRUE);
+}
+#endif /* __linux__ */
+
+static void
+safe_output_sync_files(SafeOutput *output)
+{
+#if defined(__linux__)
+    if (output->durability == SAFE_OUTPUT_DURABILITY_SYNCFS) {
+        safe_output_syncfs(output);
+        return;
+    }
+#endif /* __linux__ */
+
+    /* elsewhere, SYNCFS is the same as BATCH */
+    guint num_files = g_list_length(output->files);
+    int *fds = g_new(int, num_files);
+    guint i = 0;
+
+    /* start writeback of all files first, so the disk can work on all of them at once */
+    for (GList *cur = output->files; cur != NULL; cur = g_list_next(cur), ++i) {
+        SafeOutputFile *file = cur->data;
+
+        fds[i] = g_open(file->temp_filename, O_RDWR, 0);
+
+#if defined(__linux__)
+        if (fds[i] != -1) {
+            sync_file_range(fds[i], 0, 0, SYNC_FILE_RANGE_WRITE);
+        }
+#endif /* __linux__ */
+    }
+
+    /* then wait for each of them */
+    i = 0;
+    for (GList *cur = output->files; cur != NULL; cur = g_list_next(cur), ++i) {
+        SafeOutputFile *file = cur->data;
+
+        if (fds[i] == -1 || fsync(fds[i]) != 0) {
+            g_warning("Could not sync %s: %s", file->temp_filename, g_strerror(errno));
+            file->sync_failed = TRUE;
+        }
+
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+
+    g_free(fds);
+}
+
+/* move a file to its final name, returns an error message (g_free() it) on failure */
+static gchar *
+safe_output_rename(const char *from, const char *to)
+{
+#if defined(G_OS_WIN32)
+    /* rename() does not replace existing files on Windows, and removing them first could lose them */
+    gunichar2 *wfrom = g_utf8_to_utf16(from, -1, NULL, NULL, NULL);
+    gunichar2 *wto = g_utf8_to_utf16(to, -1, NULL, NULL, NULL);
+    gchar *error_message = NULL;
+
+    if (wfrom == NULL || wto == NULL) {
+        error_message = g_strdup("Invalid filename");
+    } else if (!MoveFileExW((wchar_t *)wfrom, (wchar_t *)wto, MOVEFILE_REPLACE_EXISTING)) {
+        error_message = g_win32_error_message(GetLastError());
+    }
+
+    g_free(wto);
+    g_free(wfrom);
+
+    return error_message;
+#else
+    return (g_rename(from, to) != 0) ? g_strdup(g_strerror(errno)) : NULL;
+#endif /* G_OS_WIN32 */
+}
+
+gboolean
+safe_output_commit(SafeOutput *output, safe_output_error_func on_error, void *user_data)
+{
+    gboolean result = TRUE;
+
+    if (output->files == NULL) {
+        return TRUE;
+    }
+
+    if (output->durability != SAFE_OUTPUT_DURABILITY_NONE) {
+        safe_output_sync_files(output);
+    }
+
+    GList *dirnames = safe_output_get_dirnames(output);
+
+    GList *cur = output->files;
+    while (cur != NULL) {
+        SafeOutputFile *file = cur->data;
+        GList *next = g_list_next(cur);
+
+        if (file->sync_failed) {
+            /**
+             * Never move data into place that might not be on disk, but
+             * keep it: some filesystems can't sync at all, and the data
+             * is usually intact.
+             **/
+            g_warning("%s might not be on disk, kept it as %s", file->filename, file->temp_filename);
+            on_error(file->filename, user_data);
+            result = FALSE;
+
+            /* not removed by safe_output_free() */
+            output->files = g_list_delete_link(output->files, cur);
+            safe_output_file_free(file);
+        } else {
+            gchar *error_message = safe_output_rename(file->temp_filename, file->filename);
+
+            if (error_message != NULL) {
+                g_warning("Could not rename %s to %s: %s", file->temp_filename, file->filename, error_message);
+                g_free(error_message);
+                on_error(file->filename, user_data);
+                result = FALSE;
+            } else {
+                /* committed, so it won't be removed by safe_output_free() */
+                output->files = g_list_delete_link(output->files, cur);
+                safe_output_file_free(file);
+            }
+        }
+
+        cur = next;
+    }
+
+#if !defined(G_OS_WIN32)
+    if (output->durability != SAFE_OUTPUT_DURABILITY_NONE) {
+        /* make the renames durable */
+        for (cur = dirnames; cur != NULL; cur = g_list_next(cur)) {
+            if (!sync_path(cur->data)) {
+                g_warning("Could not sync directory %s: %s", (const char *)cur->data, g_strerror(errno));
+                result = FALSE;
+            }
+        }
+    }
+#endif /* G_OS_WIN32 */
+
+    g_list_free_full(dirnames, g_free);
+
+    return result;
+}
+
+void
+safe_output_free(SafeOutput *output)
+{
+    for (GList *cur = output->files; cur != NULL; cur = g_list_next(cur)) {
+        SafeOutputFile *file = cur->data;
+
+        g_unlink(file->temp_filename);
+        safe_output_file_free(file);
+    }
+
+    g_list_free(output->files);
+    g_free(output);
+}
@@ -0,0 +1,82 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/**
+ * Output files of a split job are written to temporary names in the
+ * target directory, and only renamed to their final names once the
+ * whole job is done. Depending on the durability level, the data is
+ * flushed to disk before renaming, so that a crash or power loss never
+ * leaves a truncated file under its final name.
+ **/
+
+enum SafeOutputDurability {
+    /* rename only, leave flushing to the operating system */
+    SAFE_OUTPUT_DURABILITY_NONE = 0,
+    /* fsync all files in one batch, then rename and fsync the directory */
+    SAFE_OUTPUT_DURABILITY_BATCH,
+    /* like BATCH, but with a single syncfs() per filesystem (Linux only) */
+    SAFE_OUTPUT_DURABILITY_SYNCFS,
+};
+
+typedef struct SafeOutput_ SafeOutput;
+typedef struct SafeOutputFile_ SafeOutputFile;
+
+typedef void (*safe_output_error_func)(const char *filename, void *user_data);
+
+gboolean
+safe_output_parse_durability(const char *str, enum SafeOutputDurability *durability);
+
+SafeOutput *
+safe_output_new(enum SafeOutputDurability durability);
+
+/**
+ * Register a new output file, returns a handle whose temporary
+ * filename should be used for writing the data.
+ **/
+SafeOutputFile *
+safe_output_add(SafeOutput *output, const char *filename);
+
+const char *
+safe_output_file_get_temp_filename(SafeOutputFile *file);
+
+/**
+ * Remove the temporary file of an output that could not be written
+ * completely. The handle is invalid after this call.
+ **/
+void
+safe_output_discard(SafeOutput *output, SafeOutputFile *file);
+
+/**
+ * Flush all registered files (depending on the durability level) and
+ * move them to their final names. Calls on_error for each file that
+ * could not be committed. A file that could not be flushed is not moved,
+ * its temporary file is kept and named in a warning. Returns FALSE if
+ * any file failed.
+ **/
+gboolean
+safe_output_commit(SafeOutput *output, safe_output_error_func on_error, void *user_data);
+
+/**
+ * Free the output job, removing temporary files that were not committed.
+ **/
+void
+safe_output_free(SafeOutput *output);
@@ -28,14 +28,105 @@
 #include <limits.h>
 #include <stdint.h>
 
-#include "aoaudio.h"
+#include "audio_sink.h"
 
 #include "sample_info.h"
 #include "track_break.h"
 
 #include "format.h"
+#include "appconfig.h"
+#include "safe_output.h"
+#include "tar_writer.h"
+#include "xxh64.h"
+#include "ring_buffer.h"
+#include "moodbar_analysis.h"
 #include "gettext.h"
 
+/* Number of blocks read per call when analyzing the file (4 seconds) */
+#define ANALYSIS_BLOCKS_PER_READ (4 * CD_BLOCKS_PER_SEC)
+
+/* Size of the reads when verifying split files */
+#define VERIFY_BUFFER_SIZE (1024 * 1024)
+
+/* Size of the reads done ahead of playback */
+#define PLAYBACK_READ_SIZE (64 * 1024)
+
+/* Used when no valid playback buffer size is configured */
+#define PLAYBACK_DEFAULT_BUFFER_MS 2000
+
+/* The audio device is kept open this long after playback stopped */
+#define PLAYBACK_IDLE_CLOSE_USEC (10 * G_USEC_PER_SEC)
+
+/* Silence between two audition windows */
+#define AUDITION_GAP_MS 500
+
+/* Number of audition windows decoded ahead of the one being played */
+#define AUDITION_DECODE_AHEAD 8
+
+typedef struct AuditionWindow_ AuditionWindow;
+struct AuditionWindow_ {
+    /* byte offset of the window in the decoded audio */
+    unsigned long start;
+    unsigned long size;
+
+    /* filled by the decode thread, which then sets ready */
+    unsigned char *data;
+    gint ready;
+};
+
+typedef struct Audition_ Audition;
+struct Audition_ {
+    Sample *sample;
+
+    AuditionWindow *windows;
+    int num_windows;
+
+    GThread *decode_thread;
+    gint cancelled;
+
+    /* windows played so far, limits how far ahead the decode thread gets */
+    gint num_played;
+};
+
+enum PlaybackCommandType {
+    PLAYBACK_COMMAND_PLAY = 0,
+    PLAYBACK_COMMAND_SEEK,
+    PLAYBACK_COMMAND_AUDITION,
+    PLAYBACK_COMMAND_STOP,
+    PLAYBACK_COMMAND_QUIT,
+};
+
+typedef struct PlaybackCommand_ PlaybackCommand;
+struct PlaybackCommand_ {
+    enum PlaybackCommandType type;
+
+    /* PLAY and SEEK: position in blocks, or in bytes for the reader thread */
+    unsigned long pos;
+
+    /* AUDITION: owned by the output thread once the command is sent */
+    Audition *audition;
+
+    /* value of play_generation when the command was sent */
+    gint generation;
+};
+
+typedef struct PlaybackData_ PlaybackData;
+struct PlaybackData_ {
+    Sample *sample;
+
+    /* filled by the reader thread, drained by the output thread */
+    RingBuffer *ring;
+
+    /* PLAY (from a byte offset) and QUIT commands for the reader thread */
+    GAsyncQueue *reader_commands;
+
+    /* set by the output thread to make the reader stop before the end */
+    gint stop_reading;
+
+    /* set by the reader thread when it doesn't add any more data */
+    gint reader_done;
+};
+
 typedef struct WriteThreadData_ WriteThreadData;
 struct WriteThreadData_ {
     Sample *sample;
@@ -43,6 +134,23 @@ struct WriteThreadData_ {
     TrackBreakList *list;
     WriteStatusCallbacks *callbacks;
     const char *outputdir;
+
+    /* if set, all tracks are written into a tar archive instead of outputdir */
+    FILE *archive_fp;
+    const char *archive_name;
+};
+
+/* blocks per chunk and chunks in the cache of sample_get_peaks() */
+#define PCM_CACHE_CHUNK_BLOCKS 32
+#define PCM_CACHE_CHUNKS 16
+
+typedef struct PcmCacheChunk_ PcmCacheChunk;
+struct PcmCacheChunk_ {
+    unsigned long index;
+    unsigned char *data;
+    long size;
+    /* 0 if the chunk is unused */
+    guint64 last_used;
 };
 
 struct Sample_ {
@@ -56,13 +164,51 @@ struct Sample_ {
     gboolean loaded;
     GraphData graph_data;
     double load_percentage;
+    /* computed along with the graph data if wanted, NULL without moodbar support */
+    gboolean want_moodbar;
+    MoodbarData *moodbar;
+    /* set once moodbar is final, see sample_compute_moodbar() */
+    gboolean moodbar_computed;
+
+    /* serializes reads, the format modules share one file handle */
+    GMutex read_mutex;
 
+    /* recently read audio data for sample_get_peaks() */
+    GMutex pcm_cache_mutex;
+    PcmCacheChunk pcm_cache[PCM_CACHE_CHUNKS];
+    guint64 pcm_cache_counter;
+
+    /* started on first playback, and kept running until the sample is closed */
     GThread *play_thread;
+    GAsyncQueue *play_commands;
     GMutex play_mutex;
+    GCond play_cond;
     gboolean playing;
-    gboolean kill_play_thread;
-    gulong play_position;
-    unsigned long play_start_position;
+
+    /* accessed atomically, so the playback threads never take play_mutex */
+    gint pending_play_commands;
+
+    /**
+     * The playback threads (output, reader and audition decoding) wait on
+     * this for each other, see playback_wake(). New commands wake them too.
+     **/
+    GMutex play_wake_mutex;
+    GCond play_wake_cond;
+    /* incremented for each PLAY and AUDITION, also accessed atomically */
+    gint play_generation;
+
+    /**
+     * Playback clock, published by the output thread under a sequence
+     * lock (odd while being updated), see sample_get_play_marker().
+     **/
+    gint play_clock_seq;
+    unsigned long play_clock_start;
+    /* bytes passed to the audio sink, and when */
+    guint64 play_clock_written;
+    gint64 play_clock_time;
+    /* audio still buffered in the sink at that time, in microseconds */
+    gint64 play_clock_latency;
+    gboolean play_clock_running;
 
     GMutex write_mutex;
     gboolean writing;
@@ -75,13 +221,17 @@ static void
 sample_max_min(Sample *sample);
 
 static long
-read_sample(OpenedAudioFile *oaf, unsigned char *buf, int buf_size, unsigned long start_pos)
+read_sample(Sample *sample, unsigned char *buf, int buf_size, unsigned long start_pos)
 {
-    if (oaf != NULL) {
-        return format_read_samples(oaf, buf, buf_size, start_pos);
+    long result = -1;
+
+    if (sample->opened_audio_file != NULL) {
+        g_mutex_lock(&sample->read_mutex);
+        result = format_read_samples(sample->opened_audio_file, buf, buf_size, start_pos);
+        g_mutex_unlock(&sample->read_mutex);
     }
 
-    return -1;
+    return result;
 }
 
 void sample_init()
@@ -89,78 +239,496 @@ void sample_init()
     format_init();
 }
 
+/**
+ * Wake the playback threads after changing something they may wait for.
+ * The waiting side checks its condition with play_wake_mutex held, so
+ * taking it here ensures that no wakeup is lost.
+ **/
+static void
+playback_wake(Sample *sample)
+{
+    g_mutex_lock(&sample->play_wake_mutex);
+    g_cond_broadcast(&sample->play_wake_cond);
+    g_mutex_unlock(&sample->play_wake_mutex);
+}
+
 static gpointer
-play_thread(gpointer thread_data)
+play_reader_thread(gpointer data)
 {
-    Sample *sample = thread_data;
+    PlaybackData *playback = data;
+    Sample *sample = playback->sample;
 
-    int read_ret = 0;
-    int i;
+    unsigned char *buf = g_malloc(PLAYBACK_READ_SIZE);
+    PlaybackCommand *cmd;
 
-    unsigned char *devbuf;
+    while ((cmd = g_async_queue_pop(playback->reader_commands))->type != PLAYBACK_COMMAND_QUIT) {
+        unsigned long pos = cmd->pos;
+        g_free(cmd);
 
-    /*
-    printf("play_thread: calling open_audio_device\n");
-    */
-    if (ao_audio_open_device(&sample->opened_audio_file->sample_info) != 0) {
-        g_mutex_lock(&sample->play_mutex);
-        sample->playing = FALSE;
-        ao_audio_close_device();
-        g_mutex_unlock(&sample->play_mutex);
-        //printf("play_thread: return from open_audio_device != 0\n");
-        return NULL;
+        while (!g_atomic_int_get(&playback->stop_reading)) {
+            long read_ret = read_sample(sample, buf, PLAYBACK_READ_SIZE, pos);
+            if (read_ret <= 0) {
+                break;
+            }
+
+            pos += read_ret;
+
+            size_t written = 0;
+            while (written < (size_t)read_ret && !g_atomic_int_get(&playback->stop_reading)) {
+                written += ring_buffer_write(playback->ring, buf + written, read_ret - written);
+                playback_wake(sample);
+
+                if (written < (size_t)read_ret) {
+                    /* the buffer is full, wait for the output thread to catch up */
+                    g_mutex_lock(&sample->play_wake_mutex);
+                    while (ring_buffer_get_fill(playback->ring) == ring_buffer_get_capacity(playback->ring) &&
+                            !g_atomic_int_get(&playback->stop_reading)) {
+                        g_cond_wait(&sample->play_wake_cond, &sample->play_wake_mutex);
+                    }
+                    g_mutex_unlock(&sample->play_wake_mutex);
+                }
+            }
+        }
+
+        g_atomic_int_set(&playback->reader_done, TRUE);
+        playback_wake(sample);
     }
-    //printf("play_thread: return from open_audio_device\n");
 
-    i = 0;
+    g_free(cmd);
+    g_free(buf);
 
-    devbuf = malloc(DEFAULT_BUF_SIZE);
-    if (devbuf == NULL) {
-        g_mutex_lock(&sample->play_mutex);
-        sample->playing = FALSE;
-        ao_audio_close_device();
-        g_mutex_unlock(&sample->play_mutex);
-        printf("play_thread: out of memory\n");
-        return NULL;
+    return NULL;
+}
+
+static void
+playback_start_reader(PlaybackData *playback, unsigned long pos)
+{
+    PlaybackCommand *cmd = g_new0(PlaybackCommand, 1);
+    cmd->type = PLAYBACK_COMMAND_PLAY;
+    cmd->pos = pos;
+
+    /* the reader is idle, so the buffer can be emptied from this side */
+    ring_buffer_clear(playback->ring);
+
+    g_atomic_int_set(&playback->stop_reading, FALSE);
+    g_atomic_int_set(&playback->reader_done, FALSE);
+    g_async_queue_push(playback->reader_commands, cmd);
+}
+
+static void
+playback_stop_reader(PlaybackData *playback)
+{
+    g_atomic_int_set(&playback->stop_reading, TRUE);
+    playback_wake(playback->sample);
+
+    /* at most one read is still in progress */
+    g_mutex_lock(&playback->sample->play_wake_mutex);
+    while (!g_atomic_int_get(&playback->reader_done)) {
+        g_cond_wait(&playback->sample->play_wake_cond, &playback->sample->play_wake_mutex);
+    }
+    g_mutex_unlock(&playback->sample->play_wake_mutex);
+}
+
+static size_t
+get_playback_buffer_size(SampleInfo *si)
+{
+    int buffer_ms = appconfig_get_playback_buffer_ms();
+
+    if (buffer_ms <= 0) {
+        buffer_ms = PLAYBACK_DEFAULT_BUFFER_MS;
+    }
+
+    return MAX((size_t)si->avgBytesPerSec * buffer_ms / 1000, 2 * PLAYBACK_READ_SIZE);
+}
+
+static void
+publish_play_clock(Sample *sample, unsigned long start, guint64 written, gint64 latency, gboolean running)
+{
+    /* only ever called from the output thread, so there is a single writer */
+    g_atomic_int_inc(&sample->play_clock_seq);
+
+    /* readers must see the odd sequence number before any of the new values */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    /* atomic, so that a reader never sees a torn 64-bit value on 32-bit systems */
+    __atomic_store_n(&sample->play_clock_start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->play_clock_written, written, __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->play_clock_time, g_get_monotonic_time(), __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->play_clock_latency, latency, __ATOMIC_RELAXED);
+    __atomic_store_n(&sample->play_clock_running, running, __ATOMIC_RELAXED);
+
+    g_atomic_int_inc(&sample->play_clock_seq);
+}
+
+static void
+set_playing(Sample *sample, gboolean playing)
+{
+    g_mutex_lock(&sample->play_mutex);
+    /* also read without the lock by sample_is_playing() */
+    g_atomic_int_set(&sample->playing, playing);
+    g_cond_broadcast(&sample->play_cond);
+    g_mutex_unlock(&sample->play_mutex);
+}
+
+static void
+queue_play_command(Sample *sample, PlaybackCommand *cmd)
+{
+    cmd->generation = g_atomic_int_get(&sample->play_generation);
+
+    /* counted first, so the output thread can check for commands without locking */
+    g_atomic_int_inc(&sample->pending_play_commands);
+    g_async_queue_push(sample->play_commands, cmd);
+
+    /* the output thread may be waiting for the reader */
+    playback_wake(sample);
+}
+
+static void
+send_play_command(Sample *sample, enum PlaybackCommandType type, unsigned long pos)
+{
+    PlaybackCommand *cmd = g_new0(PlaybackCommand, 1);
+    cmd->type = type;
+    cmd->pos = pos;
+
+    queue_play_command(sample, cmd);
+}
+
+static PlaybackCommand *
+receive_play_command(Sample *sample, gboolean playing, gboolean sink_open)
+{
+    PlaybackCommand *cmd;
+
+    if (playing) {
+        if (g_atomic_int_get(&sample->pending_play_commands) <= 0) {
+            return NULL;
+        }
+
+        cmd = g_async_queue_pop(sample->play_commands);
+    } else if (sink_open) {
+        cmd = g_async_queue_timeout_pop(sample->play_commands, PLAYBACK_IDLE_CLOSE_USEC);
+    } else {
+        cmd = g_async_queue_pop(sample->play_commands);
     }
 
-    read_ret = read_sample(sample->opened_audio_file, devbuf, DEFAULT_BUF_SIZE, sample->play_start_position + (DEFAULT_BUF_SIZE * i++));
+    if (cmd != NULL) {
+        g_atomic_int_add(&sample->pending_play_commands, -1);
+    }
+
+    return cmd;
+}
+
+static gpointer
+audition_decode_thread(gpointer data)
+{
+    Audition *audition = data;
+
+    for (int i=0; i<audition->num_windows; ++i) {
+        AuditionWindow *window = &audition->windows[i];
+
+        g_mutex_lock(&audition->sample->play_wake_mutex);
+        while (i >= g_atomic_int_get(&audition->num_played) + AUDITION_DECODE_AHEAD &&
+                !g_atomic_int_get(&audition->cancelled)) {
+            g_cond_wait(&audition->sample->play_wake_cond, &audition->sample->play_wake_mutex);
+        }
+        g_mutex_unlock(&audition->sample->play_wake_mutex);
 
-    while (read_ret > 0 && read_ret <= DEFAULT_BUF_SIZE) {
-        /*
-        if (read_ret < 0) {
-            printf("read_ret: %d\n", read_ret);
+        if (g_atomic_int_get(&audition->cancelled)) {
+            return NULL;
         }
-        */
 
-        ao_audio_write(devbuf, read_ret);
+        unsigned char *buf = g_malloc(MAX(window->size, 1));
+        unsigned long done = 0;
 
-        if (g_mutex_trylock(&sample->play_mutex)) {
-            if (sample->kill_play_thread) {
-                ao_audio_close_device();
-                sample->playing = FALSE;
-                sample->kill_play_thread = FALSE;
-                g_mutex_unlock(&sample->play_mutex);
-                return NULL;
+        while (done < window->size && !g_atomic_int_get(&audition->cancelled)) {
+            long read_ret = read_sample(audition->sample, buf + done, MIN(window->size - done, PLAYBACK_READ_SIZE), window->start + done);
+            if (read_ret <= 0) {
+                break;
             }
-            g_mutex_unlock(&sample->play_mutex);
+
+            done += read_ret;
+        }
+
+        if (g_atomic_int_get(&audition->cancelled)) {
+            g_free(buf);
+            return NULL;
         }
 
-        read_ret = read_sample(sample->opened_audio_file, devbuf, DEFAULT_BUF_SIZE, sample->play_start_position + (DEFAULT_BUF_SIZE * i++));
+        /* shorter at the end of the file */
+        window->data = buf;
+        window->size = done;
+        g_atomic_int_set(&window->ready, TRUE);
+        playback_wake(audition->sample);
+    }
 
-        g_mutex_lock(&sample->play_mutex);
+    return NULL;
+}
 
-        sample->play_position = ((DEFAULT_BUF_SIZE * i) + sample->play_start_position) / sample->opened_audio_file->sample_info.blockSize;
+static void
+audition_free(Audition *audition)
+{
+    g_atomic_int_set(&audition->cancelled, TRUE);
+    playback_wake(audition->sample);
+    g_thread_join(audition->decode_thread);
 
-        g_mutex_unlock(&sample->play_mutex);
+    for (int i=0; i<audition->num_windows; ++i) {
+        g_free(audition->windows[i].data);
     }
 
-    g_mutex_lock(&sample->play_mutex);
+    g_free(audition->windows);
+    g_free(audition);
+}
 
-    ao_audio_close_device();
-    sample->playing = FALSE;
+static gpointer
+play_thread(gpointer thread_data)
+{
+    Sample *sample = thread_data;
+    SampleInfo *si = &sample->opened_audio_file->sample_info;
+
+    PlaybackData playback;
+    playback.sample = sample;
+    playback.ring = ring_buffer_new(get_playback_buffer_size(si));
+    playback.reader_commands = g_async_queue_new();
+    playback.stop_reading = FALSE;
+    playback.reader_done = TRUE;
+
+    GThread *reader = g_thread_new("play_reader", play_reader_thread, &playback);
+
+    /* only whole frames are passed to the device */
+    size_t frame_size = MAX(si->blockAlign, 1);
+    size_t write_size = DEFAULT_BUF_SIZE - DEFAULT_BUF_SIZE % frame_size;
+    size_t prefill = ring_buffer_get_capacity(playback.ring) / 4;
+
+    unsigned char *devbuf = g_malloc(write_size);
+
+    AudioSink *sink = NULL;
+    gboolean playing = FALSE;
+    unsigned long start_position = 0;
+    unsigned long played = 0;
+
+    /* while set, audio comes from its windows instead of the reader thread */
+    Audition *audition = NULL;
+    int audition_window = 0;
+    size_t gap_size = (size_t)si->avgBytesPerSec * AUDITION_GAP_MS / 1000;
+    size_t gap_remaining = 0;
+
+    while (TRUE) {
+        /* only sinks holding a device are closed when idle */
+        gboolean close_when_idle = (sink != NULL && !audio_sink_keep_open(sink));
+        PlaybackCommand *cmd = receive_play_command(sample, playing, close_when_idle);
+
+        if (cmd == NULL && !playing) {
+            /* idle for a while, give the device to other applications */
+            audio_sink_close(g_steal_pointer(&sink));
+            continue;
+        }
 
-    g_mutex_unlock(&sample->play_mutex);
+        if (cmd != NULL) {
+            enum PlaybackCommandType type = cmd->type;
+            unsigned long pos = cmd->pos;
+            Audition *new_audition = cmd->audition;
+            gint generation = cmd->generation;
+            g_free(cmd);
+
+            if (type == PLAYBACK_COMMAND_QUIT) {
+                break;
+            }
+
+            /**
+             * A STOP or SEEK that was sent before a newer PLAY or AUDITION
+             * (e.g. a STOP that arrived after playback had already ended by
+             * itself) must not stop what that one started.
+             **/
+            if ((type == PLAYBACK_COMMAND_STOP || type == PLAYBACK_COMMAND_SEEK) &&
+                    generation != g_atomic_int_get(&sample->play_generation)) {
+                continue;
+            }
+
+            if (type == PLAYBACK_COMMAND_SEEK && !playing) {
+                /* playback ended before the seek arrived */
+                continue;
+            }
+
+            if (playing) {
+                if (audition != NULL) {
+                    audition_free(g_steal_pointer(&audition));
+                } else {
+                    playback_stop_reader(&playback);
+                }
+
+                playing = FALSE;
+            }
+
+            if (type == PLAYBACK_COMMAND_STOP) {
+                set_playing(sample, FALSE);
+                continue;
+            }
+
+            if (sink == NULL) {
+                char *error_message = NULL;
+
+                sink = audio_sink_open(si, &error_message);
+                if (sink == NULL) {
+                    g_warning("Could not open audio output: %s", error_message);
+                    g_free(error_message);
+
+                    if (new_audition != NULL) {
+                        audition_free(new_audition);
+                    }
+
+                    set_playing(sample, FALSE);
+                    continue;
+                }
+            }
+
+            if (type == PLAYBACK_COMMAND_AUDITION) {
+                audition = new_audition;
+                audition_window = 0;
+                played = 0;
+                gap_remaining = 0;
+                publish_play_clock(sample, audition->windows[0].start, 0, 0, FALSE);
+                playing = TRUE;
+                continue;
+            }
+
+            start_position = pos * si->blockSize;
+            played = 0;
+            publish_play_clock(sample, start_position, 0, 0, FALSE);
+
+            playback_start_reader(&playback, start_position);
+            playing = TRUE;
+
+            /* start with some data buffered, so that the first reads can't cause a dropout */
+            g_mutex_lock(&sample->play_wake_mutex);
+            while (ring_buffer_get_fill(playback.ring) < prefill &&
+                    !g_atomic_int_get(&playback.reader_done) &&
+                    g_atomic_int_get(&sample->pending_play_commands) <= 0) {
+                g_cond_wait(&sample->play_wake_cond, &sample->play_wake_mutex);
+            }
+            g_mutex_unlock(&sample->play_wake_mutex);
+
+            continue;
+        }
+
+        if (audition != NULL) {
+            AuditionWindow *window = &audition->windows[audition_window];
+            const unsigned char *data = devbuf;
+            size_t size;
+
+            if (gap_remaining > 0) {
+                size = MIN(gap_remaining, write_size);
+                size -= size % frame_size;
+                gap_remaining = (size > 0) ? gap_remaining - size : 0;
+
+                /* unsigned 8-bit samples are silent at the center */
+                memset(devbuf, (si->bitsPerSample == 8) ? 0x80 : 0, size);
+            } else if (!g_atomic_int_get(&window->ready)) {
+                /* the decode thread is behind */
+                g_mutex_lock(&sample->play_wake_mutex);
+                while (!g_atomic_int_get(&window->ready) &&
+                        g_atomic_int_get(&sample->pending_play_commands) <= 0) {
+                    g_cond_wait(&sample->play_wake_cond, &sample->play_wake_mutex);
+                }
+                g_mutex_unlock(&sample->play_wake_mutex);
+                continue;
+            } else if (played < window->size) {
+                size = MIN(window->size - played, write_size);
+                data = window->data + played;
+                played += size;
+            } else {
+                g_free(g_steal_pointer(&window->data));
+                g_atomic_int_inc(&audition->num_played);
+                playback_wake(sample);
+
+                if (++audition_window == audition->num_windows) {
+                    audition_free(g_steal_pointer(&audition));
+                    playing = FALSE;
+                    set_playing(sample, FALSE);
+                    continue;
+                }
+
+                played = 0;
+                gap_remaining = gap_size;
+                publish_play_clock(sample, audition->windows[audition_window].start, 0, 0, FALSE);
+                continue;
+            }
+
+            if (size > 0 && !audio_sink_write(sink, data, size)) {
+                audition_free(g_steal_pointer(&audition));
+                audio_sink_close(g_steal_pointer(&sink));
+                playing = FALSE;
+                set_playing(sample, FALSE);
+                continue;
+            }
+
+            if (gap_remaining == 0 && played > 0) {
+                publish_play_clock(sample, window->start, played, audio_sink_get_latency(sink), TRUE);
+            }
+
+            continue;
+        }
+
+        /* check before looking at the fill level, so no data is lost at the end */
+        gboolean reader_done = g_atomic_int_get(&playback.reader_done);
+
+        size_t size = MIN(ring_buffer_get_fill(playback.ring), write_size);
+        size -= size % frame_size;
+
+        if (size == 0) {
+            if (reader_done) {
+                playing = FALSE;
+                set_playing(sample, FALSE);
+            } else {
+                /* underrun, the reader could not keep up */
+                g_mutex_lock(&sample->play_wake_mutex);
+                while (ring_buffer_get_fill(playback.ring) < frame_size &&
+                        !g_atomic_int_get(&playback.reader_done) &&
+                        g_atomic_int_get(&sample->pending_play_commands) <= 0) {
+                    g_cond_wait(&sample->play_wake_cond, &sample->play_wake_mutex);
+                }
+                g_mutex_unlock(&sample->play_wake_mutex);
+            }
+
+            continue;
+        }
+
+        ring_buffer_read(playback.ring, devbuf, size);
+
+        /* the reader might wait for free space */
+        playback_wake(sample);
+
+        if (!audio_sink_write(sink, devbuf, size)) {
+            /* reopened on the next playback */
+            playback_stop_reader(&playback);
+            audio_sink_close(g_steal_pointer(&sink));
+            playing = FALSE;
+            set_playing(sample, FALSE);
+            continue;
+        }
+
+        played += size;
+        publish_play_clock(sample, start_position, played, audio_sink_get_latency(sink), TRUE);
+    }
+
+    if (audition != NULL) {
+        audition_free(audition);
+    } else if (playing) {
+        playback_stop_reader(&playback);
+    }
+
+    PlaybackCommand *quit = g_new0(PlaybackCommand, 1);
+    quit->type = PLAYBACK_COMMAND_QUIT;
+    g_async_queue_push(playback.reader_commands, quit);
+    g_thread_join(reader);
+
+    g_async_queue_unref(playback.reader_commands);
+    ring_buffer_free(playback.ring);
+    g_free(devbuf);
+
+    if (sink != NULL) {
+        audio_sink_close(sink);
+    }
+
+    set_playing(sample, FALSE);
 
     return NULL;
 }
@@ -168,25 +736,44 @@ play_thread(gpointer thread_data)
 gboolean
 sample_is_playing(Sample *sample)
 {
-    gboolean result;
-
-    g_mutex_lock(&sample->play_mutex);
-    result = sample->playing;
-    g_mutex_unlock(&sample->play_mutex);
-
-    return result;
+    return g_atomic_int_get(&sample->playing);
 }
 
 gulong
 sample_get_play_marker(Sample *sample)
 {
-    gulong result;
+    unsigned long start;
+    guint64 written;
+    gint64 time;
+    gint64 latency;
+    gboolean running;
+    gint seq;
+
+    do {
+        while ((seq = g_atomic_int_get(&sample->play_clock_seq)) % 2 != 0) {
+            /* the output thread is in the middle of an update */
+            g_thread_yield();
+        }
 
-    g_mutex_lock(&sample->play_mutex);
-    result = sample->play_position;
-    g_mutex_unlock(&sample->play_mutex);
+        start = __atomic_load_n(&sample->play_clock_start, __ATOMIC_RELAXED);
+        written = __atomic_load_n(&sample->play_clock_written, __ATOMIC_RELAXED);
+        time = __atomic_load_n(&sample->play_clock_time, __ATOMIC_RELAXED);
+        latency = __atomic_load_n(&sample->play_clock_latency, __ATOMIC_RELAXED);
+        running = __atomic_load_n(&sample->play_clock_running, __ATOMIC_RELAXED);
 
-    return result;
+        /* the reads above must not move past the check of the sequence number */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (g_atomic_int_get(&sample->play_clock_seq) != seq);
+
+    SampleInfo *si = &sample->opened_audio_file->sample_info;
+
+    /* what is audible lags behind what was written by the sink's latency */
+    gint64 elapsed = running ? (g_get_monotonic_time() - time) : 0;
+    gint64 audible = (gint64)written + (elapsed - latency) * (gint64)si->avgBytesPerSec / G_USEC_PER_SEC;
+
+    audible = CLAMP(audible, 0, (gint64)written);
+
+    return (start + audible) / si->blockSize;
 }
 
 gboolean
@@ -215,34 +802,104 @@ sample_play(Sample *sample, gulong startpos)
         return 3;
     }
 
-    sample->playing = TRUE;
-    sample->play_start_position = startpos * sample->opened_audio_file->sample_info.blockSize;
+    if (sample->play_thread == NULL) {
+        sample->play_thread = g_thread_new("play_sample", play_thread, sample);
+    }
+
+    g_atomic_int_set(&sample->playing, TRUE);
+    g_atomic_int_inc(&sample->play_generation);
+    send_play_command(sample, PLAYBACK_COMMAND_PLAY, startpos);
+
+    g_mutex_unlock(&sample->play_mutex);
+    return 0;
+}
+
+int
+sample_audition(Sample *sample, const gulong *positions, int num_positions, gulong before, gulong after)
+{
+    if (num_positions <= 0) {
+        return 1;
+    }
+
+    g_mutex_lock(&sample->play_mutex);
+    if (sample->playing) {
+        g_mutex_unlock(&sample->play_mutex);
+        return 2;
+    }
+
+    if (sample->opened_audio_file == NULL) {
+        g_mutex_unlock(&sample->play_mutex);
+        return 3;
+    }
+
+    SampleInfo *si = &sample->opened_audio_file->sample_info;
+    unsigned long frame_size = MAX(si->blockAlign, 1);
+
+    Audition *audition = g_new0(Audition, 1);
+    audition->sample = sample;
+    audition->windows = g_new0(AuditionWindow, num_positions);
+    audition->num_windows = num_positions;
+
+    for (int i=0; i<num_positions; ++i) {
+        AuditionWindow *window = &audition->windows[i];
+        gulong first = (positions[i] > before) ? (positions[i] - before) : 0;
+
+        window->start = first * si->blockSize;
+        window->start -= window->start % frame_size;
+        window->size = (positions[i] - first + after) * si->blockSize;
+        window->size -= window->size % frame_size;
+    }
+
+    /* starts decoding right away, while the command is on its way */
+    audition->decode_thread = g_thread_new("audition_decode", audition_decode_thread, audition);
 
-    /* setup thread */
+    if (sample->play_thread == NULL) {
+        sample->play_thread = g_thread_new("play_sample", play_thread, sample);
+    }
 
-    sample->play_position = startpos;
+    g_atomic_int_set(&sample->playing, TRUE);
+    g_atomic_int_inc(&sample->play_generation);
 
-    sample->play_thread = g_thread_new("play_sample", play_thread, sample);
+    PlaybackCommand *cmd = g_new0(PlaybackCommand, 1);
+    cmd->type = PLAYBACK_COMMAND_AUDITION;
+    cmd->audition = audition;
+    queue_play_command(sample, cmd);
 
     g_mutex_unlock(&sample->play_mutex);
     return 0;
 }
 
-void
-sample_stop(Sample *sample)
+gboolean
+sample_seek(Sample *sample, gulong pos)
 {
     g_mutex_lock(&sample->play_mutex);
 
     if (!sample->playing) {
         g_mutex_unlock(&sample->play_mutex);
-        return;
+        return FALSE;
     }
 
-    sample->kill_play_thread = TRUE;
+    send_play_command(sample, PLAYBACK_COMMAND_SEEK, pos);
+
     g_mutex_unlock(&sample->play_mutex);
+    return TRUE;
+}
+
+void
+sample_stop(Sample *sample)
+{
+    g_mutex_lock(&sample->play_mutex);
+
+    if (sample->playing) {
+        send_play_command(sample, PLAYBACK_COMMAND_STOP, 0);
 
-    // Wait for play thread to actually quit
-    g_thread_join(g_steal_pointer(&sample->play_thread));
+        // Wait for playback to actually stop
+        while (sample->playing) {
+            g_cond_wait(&sample->play_cond, &sample->play_mutex);
+        }
+    }
+
+    g_mutex_unlock(&sample->play_mutex);
 }
 
 static gpointer
@@ -256,10 +913,12 @@ open_thread(gpointer data)
 }
 
 Sample *
-sample_open(const char *filename, char **error_message)
+sample_open(const char *filename, gboolean with_moodbar, char **error_message)
 {
     Sample *sample = g_new0(Sample, 1);
 
+    sample->want_moodbar = with_moodbar;
+
     sample->opened_audio_file = format_open_file(filename, error_message);
     if (sample->opened_audio_file == NULL) {
         g_free(sample);
@@ -282,227 +941,1026 @@ sample_open(const char *filename, char **error_message)
     sample->basename_without_extension = tmp;
 
     g_mutex_init(&sample->load_mutex);
+    g_mutex_init(&sample->read_mutex);
+    g_mutex_init(&sample->pcm_cache_mutex);
     g_mutex_init(&sample->play_mutex);
+    g_cond_init(&sample->play_cond);
+    g_mutex_init(&sample->play_wake_mutex);
+    g_cond_init(&sample->play_wake_cond);
+    sample->play_commands = g_async_queue_new();
     g_mutex_init(&sample->write_mutex);
 
     // TODO: Capture thread and properly tear it down - if needed - in sample_close()
     g_thread_unref(g_thread_new("open file", open_thread, sample));
 
-    return sample;
+    return sample;
+}
+
+Sample *
+sample_open_stream(FILE *fp, const char *format_name, const char *basename, char **error_message)
+{
+    Sample *sample = g_new0(Sample, 1);
+
+    sample->opened_audio_file = format_open_stream(fp, format_name, error_message);
+    if (sample->opened_audio_file == NULL) {
+        g_free(sample);
+        return NULL;
+    }
+
+    sample->filename_dirname = g_strdup(".");
+    sample->filename_basename = g_strdup(sample->opened_audio_file->filename);
+    sample->basename_without_extension = g_strdup(basename);
+
+    g_mutex_init(&sample->load_mutex);
+    g_mutex_init(&sample->read_mutex);
+    g_mutex_init(&sample->pcm_cache_mutex);
+    g_mutex_init(&sample->play_mutex);
+    g_cond_init(&sample->play_cond);
+    g_mutex_init(&sample->play_wake_mutex);
+    g_cond_init(&sample->play_wake_cond);
+    sample->play_commands = g_async_queue_new();
+    g_mutex_init(&sample->write_mutex);
+
+    /* a stream can only be read once, so there is no analysis */
+    sample->load_percentage = 1.0;
+    sample->loaded = TRUE;
+
+    return sample;
+}
+
+void
+sample_print_file_info(Sample *sample)
+{
+    format_print_file_info(sample->opened_audio_file);
+}
+
+GraphData *
+sample_get_graph_data(Sample *sample)
+{
+    GraphData *result = NULL;
+
+    g_mutex_lock(&sample->load_mutex);
+    if (sample->loaded) {
+        result = &sample->graph_data;
+    }
+    g_mutex_unlock(&sample->load_mutex);
+
+    return result;
+}
+
+MoodbarData *
+sample_get_moodbar(Sample *sample)
+{
+    MoodbarData *result = NULL;
+
+    g_mutex_lock(&sample->load_mutex);
+    if (sample->loaded) {
+        result = sample->moodbar;
+    }
+    g_mutex_unlock(&sample->load_mutex);
+
+    return result;
+}
+
+MoodbarData *
+sample_compute_moodbar(Sample *sample)
+{
+#if defined(WANT_MOODBAR)
+    g_mutex_lock(&sample->load_mutex);
+    gboolean needed = sample->loaded && !sample->moodbar_computed;
+    g_mutex_unlock(&sample->load_mutex);
+
+    if (needed) {
+        SampleInfo *sample_info = &sample->opened_audio_file->sample_info;
+        unsigned long num_blocks = sample->graph_data.numSamples;
+        MoodbarAnalysis *analysis = moodbar_analysis_new(sample_info, num_blocks);
+        MoodbarData *moodbar = NULL;
+
+        if (analysis != NULL) {
+            /* the same reads as in sample_max_min(), but only for the moodbar */
+            long batch_size = (long)sample_info->blockSize * ANALYSIS_BLOCKS_PER_READ;
+            unsigned char *buf = g_malloc(batch_size);
+            unsigned long i = 0;
+
+            while (i < num_blocks) {
+                long ret = read_sample(sample, buf, batch_size, sample_info->blockSize * i);
+                if (ret <= 0) {
+                    break;
+                }
+
+                for (long k = 0; k < ret && i < num_blocks; k += sample_info->blockSize, i++) {
+                    moodbar_analysis_add_block(analysis, i, buf + k, MIN(sample_info->blockSize, ret - k));
+                }
+
+                if (ret < batch_size) {
+                    break;
+                }
+            }
+
+            g_free(buf);
+            moodbar = moodbar_analysis_finish(analysis);
+        }
+
+        g_mutex_lock(&sample->load_mutex);
+        sample->moodbar = moodbar;
+        sample->moodbar_computed = TRUE;
+        g_mutex_unlock(&sample->load_mutex);
+    }
+#endif
+
+    return sample_get_moodbar(sample);
+}
+
+unsigned long
+sample_get_num_sample_blocks(Sample *sample)
+{
+    return sample->graph_data.numSamples;
+}
+
+const SampleInfo *
+sample_get_sample_info(Sample *sample)
+{
+    return &sample->opened_audio_file->sample_info;
+}
+
+void
+sample_close(Sample *sample)
+{
+    if (sample->play_thread != NULL) {
+        send_play_command(sample, PLAYBACK_COMMAND_QUIT, 0);
+        g_thread_join(g_steal_pointer(&sample->play_thread));
+    }
+
+    g_async_queue_unref(sample->play_commands);
+    g_cond_clear(&sample->play_cond);
+    g_mutex_clear(&sample->play_wake_mutex);
+    g_cond_clear(&sample->play_wake_cond);
+
+    for (int i=0; i<PCM_CACHE_CHUNKS; ++i) {
+        g_free(sample->pcm_cache[i].data);
+    }
+
+    g_free(sample->basename_without_extension);
+    g_free(sample->filename_basename);
+    g_free(sample->filename_dirname);
+
+    if (sample->opened_audio_file != NULL) {
+        format_close_file(g_steal_pointer(&sample->opened_audio_file));
+    }
+
+    if (sample->moodbar != NULL) {
+        moodbar_free(sample->moodbar);
+    }
+
+    g_free(sample);
+}
+
+gboolean
+sample_is_loaded(Sample *sample)
+{
+    gboolean result;
+
+    g_mutex_lock(&sample->load_mutex);
+    result = sample->loaded;
+    g_mutex_unlock(&sample->load_mutex);
+
+    return result;
+}
+
+double
+sample_get_load_percentage(Sample *sample)
+{
+    double result;
+
+    g_mutex_lock(&sample->load_mutex);
+    result = sample->load_percentage;
+    g_mutex_unlock(&sample->load_mutex);
+
+    return result;
+}
+
+uint64_t
+sample_get_file_size(Sample *sample)
+{
+    return sample->opened_audio_file->file_size;
+}
+
+const char *
+sample_get_filename(Sample *sample)
+{
+    return sample->opened_audio_file->filename;
+}
+
+const char *
+sample_get_dirname(Sample *sample)
+{
+    return sample->filename_dirname;
+}
+
+const char *
+sample_get_basename(Sample *sample)
+{
+    return sample->filename_basename;
+}
+
+const char *
+sample_get_basename_without_extension(Sample *sample)
+{
+    return sample->basename_without_extension;
+}
+
+static void
+sample_block_peaks(const unsigned char *buf, long size, const SampleInfo *sample_info, int *min_out, int *max_out)
+{
+    /* only the first channel is analyzed, skip over any extra channels */
+    long stride = MAX(sample_info->blockAlign, 1);
+    int min = 0, max = 0;
+    long k;
+
+    switch (sample_info->bitsPerSample) {
+        case 8:
+            for (k = 0; k < size; k += stride) {
+                int tmp = (int)buf[k] - 128;
+                min = MIN(min, tmp);
+                max = MAX(max, tmp);
+            }
+            break;
+        case 16:
+            for (k = 0; k + 1 < size; k += stride) {
+                int tmp = (int16_t)(buf[k] | (buf[k+1] << 8));
+                min = MIN(min, tmp);
+                max = MAX(max, tmp);
+            }
+            break;
+        case 24:
+            for (k = 0; k + 2 < size; k += stride) {
+                int tmp = (int32_t)((uint32_t)buf[k] << 8 | (uint32_t)buf[k+1] << 16 | (uint32_t)buf[k+2] << 24) >> 8;
+                min = MIN(min, tmp);
+                max = MAX(max, tmp);
+            }
+            break;
+        default:
+            break;
+    }
+
+    *min_out = min;
+    *max_out = max;
+}
+
+static void
+sample_max_min(Sample *sample)
+{
+    GraphData *graphData = &sample->graph_data;
+
+    SampleInfo *sample_info = &sample->opened_audio_file->sample_info;
+    long int ret = 0;
+    int min, max;
+    int min_sample, max_sample;
+    long int i, k;
+    long int numSampleBlocks;
+    long int tmp_sample_calc;
+
+    /* read many blocks at once, so the I/O layer can keep a deep queue */
+    long int batch_size = (long int)sample_info->blockSize * ANALYSIS_BLOCKS_PER_READ;
+    unsigned char *devbuf;
+    Points *graph_data;
+
+    tmp_sample_calc = sample_info->numBytes;
+    tmp_sample_calc = tmp_sample_calc / sample_info->blockSize;
+    numSampleBlocks = (tmp_sample_calc + 1);
+
+    graph_data = (Points *)calloc(numSampleBlocks, sizeof(Points));
+    devbuf = malloc(batch_size);
+
+    if (graph_data == NULL || devbuf == NULL) {
+        printf("NULL returned from malloc of graph_data\n");
+        free(graph_data);
+        free(devbuf);
+        return;
+    }
+
+#if defined(WANT_MOODBAR)
+    /* the spectrum of the same blocks gives the moodbar, without decoding again */
+    MoodbarAnalysis *moodbar_analysis = sample->want_moodbar ? moodbar_analysis_new(sample_info, numSampleBlocks) : NULL;
+#endif
+
+    min_sample = SHRT_MAX; /* highest value for 16-bit samples */
+    max_sample = 0;
+
+    i = 0;
+    while (i < numSampleBlocks) {
+        ret = read_sample(sample, devbuf, batch_size, sample_info->blockSize * i);
+        if (ret <= 0) {
+            break;
+        }
+
+        /* the last block of the file may be partial */
+        for (k = 0; k < ret && i < numSampleBlocks; k += sample_info->blockSize, i++) {
+            sample_block_peaks(devbuf + k, MIN(sample_info->blockSize, ret - k), sample_info, &min, &max);
+
+#if defined(WANT_MOODBAR)
+            if (moodbar_analysis != NULL) {
+                moodbar_analysis_add_block(moodbar_analysis, i, devbuf + k, MIN(sample_info->blockSize, ret - k));
+            }
+#endif
+
+            graph_data[i].min = min;
+            graph_data[i].max = max;
+
+            if( min_sample > (max-min)) {
+                min_sample = (max-min);
+            }
+            if( max_sample < (max-min)) {
+                max_sample = (max-min);
+            }
+        }
+
+        g_mutex_lock(&sample->load_mutex);
+        sample->load_percentage = (double) i / numSampleBlocks;
+        g_mutex_unlock(&sample->load_mutex);
+
+        if (ret < batch_size) {
+            break;
+        }
+    }
+
+    free(devbuf);
+
+    graphData->numSamples = numSampleBlocks;
+
+    if (graphData->data != NULL) {
+        free(graphData->data);
+    }
+    graphData->data = graph_data;
+
+    graphData->minSampleAmp = min_sample;
+    graphData->maxSampleAmp = max_sample;
+
+    if (sample_info->bitsPerSample == 8) {
+        graphData->maxSampleValue = UCHAR_MAX;
+    } else if (sample_info->bitsPerSample == 16) {
+        graphData->maxSampleValue = SHRT_MAX;
+    } else if (sample_info->bitsPerSample == 24) {
+	graphData->maxSampleValue = 0x7fffff;
+    }
+
+    MoodbarData *moodbar = NULL;
+#if defined(WANT_MOODBAR)
+    if (moodbar_analysis != NULL) {
+        moodbar = moodbar_analysis_finish(moodbar_analysis);
+    }
+#endif
+
+    g_mutex_lock(&sample->load_mutex);
+    sample->moodbar = moodbar;
+    sample->moodbar_computed = sample->want_moodbar;
+    sample->load_percentage = 1.0;
+    sample->loaded = TRUE;
+    g_mutex_unlock(&sample->load_mutex);
+}
+
+/* must be called with pcm_cache_mutex held */
+static const unsigned char *
+pcm_cache_get_chunk(Sample *sample, unsigned long index, long *size)
+{
+    long chunk_size = PCM_CACHE_CHUNK_BLOCKS * sample->opened_audio_file->sample_info.blockSize;
+    PcmCacheChunk *chunk = NULL;
+
+    for (int i=0; i<PCM_CACHE_CHUNKS; ++i) {
+        PcmCacheChunk *cur = &sample->pcm_cache[i];
+
+        if (cur->last_used != 0 && cur->index == index) {
+            cur->last_used = ++sample->pcm_cache_counter;
+            *size = cur->size;
+            return cur->data;
+        }
+
+        if (chunk == NULL || cur->last_used < chunk->last_used) {
+            chunk = cur;
+        }
+    }
+
+    if (chunk->data == NULL) {
+        chunk->data = g_malloc(chunk_size);
+    }
+
+    chunk->size = 0;
+    while (chunk->size < chunk_size) {
+        long ret = read_sample(sample, chunk->data + chunk->size, chunk_size - chunk->size, index * chunk_size + chunk->size);
+        if (ret <= 0) {
+            break;
+        }
+
+        chunk->size += ret;
+    }
+
+    chunk->index = index;
+    chunk->last_used = ++sample->pcm_cache_counter;
+
+    *size = chunk->size;
+    return chunk->data;
+}
+
+int
+sample_get_peaks(Sample *sample, unsigned long first_column, int columns_per_block, Points *points, int n)
+{
+    SampleInfo *si = &sample->opened_audio_file->sample_info;
+    long frame_size = MAX(si->blockAlign, 1);
+    long frames_per_block = si->blockSize / frame_size;
+    int i;
+
+    g_mutex_lock(&sample->pcm_cache_mutex);
+
+    for (i=0; i<n; ++i) {
+        unsigned long block = (first_column + i) / columns_per_block;
+        long column = (first_column + i) % columns_per_block;
+
+        /* columns narrower than one frame show the frame they are in */
+        long first_frame = column * frames_per_block / columns_per_block;
+        long end_frame = MAX((column + 1) * frames_per_block / columns_per_block, first_frame + 1);
+
+        long size;
+        const unsigned char *data = pcm_cache_get_chunk(sample, block / PCM_CACHE_CHUNK_BLOCKS, &size);
+        long offset = (block % PCM_CACHE_CHUNK_BLOCKS) * si->blockSize + first_frame * frame_size;
+
+        if (offset >= size) {
+            break;
+        }
+
+        sample_block_peaks(data + offset, MIN((end_frame - first_frame) * frame_size, size - offset), si,
+                &points[i].min, &points[i].max);
+    }
+
+    g_mutex_unlock(&sample->pcm_cache_mutex);
+
+    return i;
+}
+
+/**
+ * Replace the track breaks in list with the markers embedded in the audio
+ * file (e.g. WAV cue points), using marker labels as filenames. There is
+ * always a track break at the start of the file. Returns FALSE (and leaves
+ * the list alone) if the file doesn't have any markers.
+ **/
+gboolean
+sample_read_embedded_track_breaks(Sample *sample, TrackBreakList *list)
+{
+    OpenedAudioFile *oaf = sample->opened_audio_file;
+
+    if (oaf == NULL || oaf->markers == NULL) {
+        return FALSE;
+    }
+
+    track_break_list_clear(list);
+    track_break_list_add_offset(list, TRUE, 0, NULL);
+
+    GList *cur = g_list_first(oaf->markers);
+    while (cur != NULL) {
+        FormatMarker *marker = cur->data;
+
+        gulong offset = marker->position / oaf->sample_info.blockSize;
+        TrackBreak *track_break = track_break_list_add_offset(list, TRUE, offset, NULL);
+
+        if (track_break != NULL && marker->label != NULL) {
+            /* labels are used as filenames, so they can't contain path separators */
+            gchar *filename = g_strdup(marker->label);
+            g_strdelimit(filename, G_DIR_SEPARATOR_S "/", '-');
+            track_break_rename(track_break, filename);
+            g_free(filename);
+        }
+
+        cur = g_list_next(cur);
+    }
+
+    return TRUE;
+}
+
+static void
+trampoline_file_progress_changed(double progress, void *user_data)
+{
+    WriteStatusCallbacks *callbacks = user_data;
+    callbacks->on_file_progress_changed(progress, callbacks->user_data);
+}
+
+static void
+build_output_filename(Sample *sample, TrackBreakList *list, TrackBreak *tb, const char *outputdir, char *filename)
+{
+    /* add output directory to filename (none for archive members) */
+    filename[0] = '\0';
+    if (outputdir != NULL) {
+        strcpy(filename, outputdir);
+        strcat(filename, "/");
+    }
+
+    gchar *tmp = track_break_get_filename(tb, list);
+    strcat(filename, tmp);
+    g_free(tmp);
+
+    // TODO: CDDA needs .cdda.raw file extension, not .raw
+    const char *source_file_extension = sample->opened_audio_file->filename ? strrchr(sample->opened_audio_file->filename, '.') : NULL;
+    if (source_file_extension == NULL) {
+        /* Fallback extensions if not in source filename */
+        if (sample->opened_audio_file != NULL) {
+            source_file_extension = sample->opened_audio_file->mod->default_file_extension;
+        }
+    }
+
+    /* add file extension to filename */
+    if (source_file_extension != NULL && strstr(filename, source_file_extension) == NULL) {
+        strcat(filename, source_file_extension);
+    }
+}
+
+static gboolean
+wants_track_digests(WriteStatusCallbacks *callbacks, enum TrackDigestSidecar sidecar)
+{
+    return sidecar != TRACK_DIGEST_SIDECAR_NONE || callbacks->on_file_digests != NULL;
+}
+
+static TrackDigest *
+new_track_digest(Sample *sample, TrackBreakList *list, GList *tbl_cur)
+{
+    SampleInfo *si = &sample->opened_audio_file->sample_info;
+
+    /* AccurateRip CRCs only exist for CD audio */
+    gboolean cd_audio = (si->samplesPerSec == 44100 && si->bitsPerSample == 16 && si->channels == 2);
+
+    return track_digest_new(cd_audio, tbl_cur == list->breaks, g_list_next(tbl_cur) == NULL);
+}
+
+/**
+ * Report the checksums of all files that were written completely, the
+ * digests of all other files are freed and set to NULL.
+ **/
+static void
+report_track_digests(WriteStatusCallbacks *callbacks, FormatRegion *regions, char **filenames, TrackDigest **digests, int n_regions)
+{
+    for (int i=0; i<n_regions; ++i) {
+        if (digests[i] == NULL) {
+            continue;
+        }
+
+        if (!regions[i].written) {
+            track_digest_free(g_steal_pointer(&digests[i]));
+            continue;
+        }
+
+        const TrackDigests *result = track_digest_finish(digests[i]);
+
+        if (callbacks->on_file_digests != NULL) {
+            callbacks->on_file_digests(filenames[i], result, callbacks->user_data);
+        }
+    }
+}
+
+static void
+free_track_digests(TrackDigest **digests, int n_regions)
+{
+    for (int i=0; i<n_regions; ++i) {
+        if (digests[i] != NULL) {
+            track_digest_free(digests[i]);
+        }
+    }
+
+    g_free(digests);
+}
+
+static gchar *
+build_sidecar_filename(Sample *sample, enum TrackDigestSidecar sidecar)
+{
+    return g_strdup_printf("%s%s", sample_get_basename_without_extension(sample), track_digest_sidecar_extension(sidecar));
+}
+
+typedef struct SequentialWrite_ SequentialWrite;
+struct SequentialWrite_ {
+    WriteStatusCallbacks *callbacks;
+    SafeOutput *safe_output;
+
+    gulong num_files;
+    /* per region: output filename, its temporary file and its number in the list of files to write */
+    char **filenames;
+    SafeOutputFile **output_files;
+    guint *file_numbers;
+    /* per region: checksums of the output, NULL if not needed */
+    TrackDigest **digests;
+};
+
+static void
+sequential_on_region_started(int index, void *user_data)
+{
+    SequentialWrite *sw = user_data;
+
+    sw->callbacks->on_file_changed(sw->file_numbers[index], sw->num_files, sw->filenames[index], sw->callbacks->user_data);
+    sw->callbacks->on_file_progress_changed(0.0, sw->callbacks->user_data);
+}
+
+static void
+sequential_on_region_data(int index, enum FormatRegionDataType type, const unsigned char *buf, size_t size, void *user_data)
+{
+    SequentialWrite *sw = user_data;
+
+    track_digest_update(sw->digests[index], type, buf, size);
+}
+
+/**
+ * Write a checksum file for all files that were written to the output
+ * directory, it lists them by their names relative to the directory.
+ * An existing checksum file is only replaced like the track files are,
+ * overwrite_decision is what is left of the answers for the tracks.
+ **/
+static void
+write_sidecar_file(Sample *sample, WriteStatusCallbacks *callbacks, SafeOutput *safe_output, const char *outputdir, enum TrackDigestSidecar sidecar, SequentialWrite *sw, int n_regions, enum OverwriteDecision overwrite_decision)
+{
+    gchar *name = build_sidecar_filename(sample, sidecar);
+    gchar *filename = g_strdup_printf("%s/%s", outputdir, name);
+
+    if (g_file_test(filename, G_FILE_TEST_EXISTS)) {
+        if (overwrite_decision == OVERWRITE_DECISION_ASK) {
+            overwrite_decision = callbacks->ask_overwrite(filename, callbacks->user_data);
+        }
+
+        if (overwrite_decision != OVERWRITE_DECISION_OVERWRITE && overwrite_decision != OVERWRITE_DECISION_OVERWRITE_ALL) {
+            g_free(filename);
+            g_free(name);
+            return;
+        }
+    }
+
+    char **basenames = g_new0(char *, n_regions + 1);
+    for (int i=0; i<n_regions; ++i) {
+        basenames[i] = g_path_get_basename(sw->filenames[i]);
+    }
+
+    gchar *contents = track_digest_format_sidecar(sidecar, basenames, sw->digests, n_regions);
+
+    SafeOutputFile *output_file = safe_output_add(safe_output, filename);
+
+    if (!g_file_set_contents(safe_output_file_get_temp_filename(output_file), contents, -1, NULL)) {
+        g_warning("Could not write checksum file %s", filename);
+        callbacks->on_error(filename, callbacks->user_data);
+        safe_output_discard(safe_output, output_file);
+    }
+
+    g_free(filename);
+    g_free(name);
+    g_free(contents);
+    g_strfreev(basenames);
+}
+
+static void
+sequential_on_region_progress(double progress, void *user_data)
+{
+    SequentialWrite *sw = user_data;
+
+    sw->callbacks->on_file_progress_changed(progress, sw->callbacks->user_data);
 }
 
-void
-sample_print_file_info(Sample *sample)
+static gboolean
+sequential_is_cancelled(void *user_data)
 {
-    format_print_file_info(sample->opened_audio_file);
+    SequentialWrite *sw = user_data;
+
+    return sw->callbacks->is_cancelled(sw->callbacks->user_data);
 }
 
-GraphData *
-sample_get_graph_data(Sample *sample)
+/**
+ * Write all selected tracks while reading the source file only once,
+ * from front to back. Overwrite questions are asked up front, so that
+ * reading does not have to pause in the middle of the file.
+ **/
+static void
+write_files_sequential(Sample *sample, OpenedAudioFile *source, TrackBreakList *list, WriteStatusCallbacks *callbacks, SafeOutput *safe_output, const char *outputdir, gulong num_files, enum TrackDigestSidecar sidecar)
 {
-    GraphData *result = NULL;
+    gboolean want_digests = wants_track_digests(callbacks, sidecar);
+    unsigned long block_size = sample->opened_audio_file->sample_info.blockSize;
+    enum OverwriteDecision overwrite_decision = OVERWRITE_DECISION_ASK;
+    FormatRegion *regions = g_new0(FormatRegion, num_files);
+    int n_regions = 0;
+    guint file_number = 1;
+    char filename[1024];
 
-    g_mutex_lock(&sample->load_mutex);
-    if (sample->loaded) {
-        result = &sample->graph_data;
+    SequentialWrite sw = {
+        .callbacks = callbacks,
+        .safe_output = safe_output,
+        .num_files = num_files,
+        .filenames = g_new0(char *, num_files),
+        .output_files = g_new0(SafeOutputFile *, num_files),
+        .file_numbers = g_new0(guint, num_files),
+        .digests = g_new0(TrackDigest *, num_files),
+    };
+
+    FormatRegionCallbacks region_callbacks = {
+        .on_region_started = sequential_on_region_started,
+        .on_region_data = want_digests ? sequential_on_region_data : NULL,
+        .on_region_progress = sequential_on_region_progress,
+        .is_cancelled = sequential_is_cancelled,
+        .user_data = &sw,
+    };
+
+    GList *tbl_cur = list->breaks;
+    while (tbl_cur != NULL && !callbacks->is_cancelled(callbacks->user_data)) {
+        TrackBreak *tb_cur = tbl_cur->data;
+        GList *tbl_next = g_list_next(tbl_cur);
+
+        if (tb_cur->write) {
+            build_output_filename(sample, list, tb_cur, outputdir, filename);
+
+            gboolean file_exists = g_file_test(filename, G_FILE_TEST_EXISTS);
+
+            if (file_exists && overwrite_decision == OVERWRITE_DECISION_ASK) {
+                overwrite_decision = callbacks->ask_overwrite(filename, callbacks->user_data);
+            }
+
+            if (!file_exists || overwrite_decision == OVERWRITE_DECISION_OVERWRITE || overwrite_decision == OVERWRITE_DECISION_OVERWRITE_ALL) {
+                sw.filenames[n_regions] = g_strdup(filename);
+                sw.output_files[n_regions] = safe_output_add(safe_output, filename);
+                sw.file_numbers[n_regions] = file_number;
+                sw.digests[n_regions] = want_digests ? new_track_digest(sample, list, tbl_cur) : NULL;
+
+                regions[n_regions] = (FormatRegion) {
+                    .start_pos = tb_cur->offset * block_size,
+                    .end_pos = (tbl_next != NULL) ? ((TrackBreak *)tbl_next->data)->offset * block_size : 0,
+                    .output_filename = safe_output_file_get_temp_filename(sw.output_files[n_regions]),
+                    .written = FALSE,
+                };
+
+                ++n_regions;
+            }
+
+            if (overwrite_decision != OVERWRITE_DECISION_SKIP_ALL && overwrite_decision != OVERWRITE_DECISION_OVERWRITE_ALL) {
+                overwrite_decision = OVERWRITE_DECISION_ASK;
+            }
+
+            ++file_number;
+        }
+
+        tbl_cur = tbl_next;
     }
-    g_mutex_unlock(&sample->load_mutex);
 
-    return result;
-}
+    if (n_regions > 0 && !callbacks->is_cancelled(callbacks->user_data)) {
+        format_write_regions(source, regions, n_regions, &region_callbacks);
 
-unsigned long
-sample_get_num_sample_blocks(Sample *sample)
-{
-    return sample->graph_data.numSamples;
-}
+        for (int i=0; i<n_regions; ++i) {
+            if (!regions[i].written) {
+                /* incomplete, never let it reach its final name */
+                safe_output_discard(safe_output, sw.output_files[i]);
 
-void
-sample_close(Sample *sample)
-{
-    g_free(sample->basename_without_extension);
-    g_free(sample->filename_basename);
-    g_free(sample->filename_dirname);
+                if (!callbacks->is_cancelled(callbacks->user_data)) {
+                    g_warning("Could not write file %s", sw.filenames[i]);
+                    callbacks->on_error(sw.filenames[i], callbacks->user_data);
+                }
+            }
+        }
 
-    if (sample->opened_audio_file != NULL) {
-        format_close_file(g_steal_pointer(&sample->opened_audio_file));
+        if (want_digests) {
+            report_track_digests(callbacks, regions, sw.filenames, sw.digests, n_regions);
+
+            if (sidecar != TRACK_DIGEST_SIDECAR_NONE) {
+                write_sidecar_file(sample, callbacks, safe_output, outputdir, sidecar, &sw, n_regions, overwrite_decision);
+            }
+        }
+
+        callbacks->on_file_progress_changed(1.0, callbacks->user_data);
     }
 
-    g_free(sample);
+    for (int i=0; i<n_regions; ++i) {
+        g_free(sw.filenames[i]);
+    }
+    g_free(sw.filenames);
+    g_free(sw.output_files);
+    g_free(sw.file_numbers);
+    free_track_digests(sw.digests, n_regions);
+    g_free(regions);
 }
 
-gboolean
-sample_is_loaded(Sample *sample)
-{
-    gboolean result;
+typedef struct ArchiveWrite_ ArchiveWrite;
+struct ArchiveWrite_ {
+    WriteStatusCallbacks *callbacks;
+    TarWriter *tar;
 
-    g_mutex_lock(&sample->load_mutex);
-    result = sample->loaded;
-    g_mutex_unlock(&sample->load_mutex);
+    gulong num_files;
+    FormatRegion *regions;
+    /* per region: member name, size announced in the tar header, number in the list of files to write and checksums */
+    char **filenames;
+    uint64_t *sizes;
+    guint *file_numbers;
+    TrackDigest **digests;
 
-    return result;
-}
+    gboolean failed;
+};
 
-double
-sample_get_load_percentage(Sample *sample)
+static void
+archive_on_region_started(int index, void *user_data)
 {
-    double result;
+    ArchiveWrite *aw = user_data;
 
-    g_mutex_lock(&sample->load_mutex);
-    result = sample->load_percentage;
-    g_mutex_unlock(&sample->load_mutex);
+    aw->callbacks->on_file_changed(aw->file_numbers[index], aw->num_files, aw->regions[index].output_filename, aw->callbacks->user_data);
+    aw->callbacks->on_file_progress_changed(0.0, aw->callbacks->user_data);
 
-    return result;
+    if (!aw->failed && !tar_writer_begin_member(aw->tar, aw->regions[index].output_filename, aw->sizes[index])) {
+        aw->failed = TRUE;
+    }
 }
 
-uint64_t
-sample_get_file_size(Sample *sample)
+static void
+archive_on_region_finished(int index, void *user_data)
 {
-    return sample->opened_audio_file->file_size;
+    ArchiveWrite *aw = user_data;
+
+    /* members can't be left out or shortened once their header is written */
+    if (!aw->failed && (!aw->regions[index].written || !tar_writer_end_member(aw->tar))) {
+        /* a member cut short by cancelling is not an error, but ends the archive all the same */
+        if (!aw->callbacks->is_cancelled(aw->callbacks->user_data)) {
+            g_warning("Could not write archive member %s", aw->regions[index].output_filename);
+            aw->callbacks->on_error(aw->regions[index].output_filename, aw->callbacks->user_data);
+        }
+        aw->failed = TRUE;
+    }
 }
 
-const char *
-sample_get_filename(Sample *sample)
+static void
+archive_on_region_data(int index, enum FormatRegionDataType type, const unsigned char *buf, size_t size, void *user_data)
 {
-    return sample->opened_audio_file->filename;
-}
+    ArchiveWrite *aw = user_data;
 
-const char *
-sample_get_dirname(Sample *sample)
-{
-    return sample->filename_dirname;
+    track_digest_update(aw->digests[index], type, buf, size);
 }
 
-const char *
-sample_get_basename(Sample *sample)
+static void
+archive_on_region_progress(double progress, void *user_data)
 {
-    return sample->filename_basename;
+    ArchiveWrite *aw = user_data;
+
+    aw->callbacks->on_file_progress_changed(progress, aw->callbacks->user_data);
 }
 
-const char *
-sample_get_basename_without_extension(Sample *sample)
+static gboolean
+archive_is_cancelled(void *user_data)
 {
-    return sample->basename_without_extension;
+    ArchiveWrite *aw = user_data;
+
+    return aw->failed || aw->callbacks->is_cancelled(aw->callbacks->user_data);
 }
 
+/**
+ * Write all selected tracks as members of a single tar archive, in one
+ * pass over the source file. The headers need the size of each member
+ * up front, so this only works for formats where the size of the output
+ * can be calculated from the track length.
+ **/
 static void
-sample_max_min(Sample *sample)
+write_archive(Sample *sample, OpenedAudioFile *oaf, TrackBreakList *list, WriteStatusCallbacks *callbacks, FILE *archive_fp, const char *archive_name, gulong num_files, enum TrackDigestSidecar sidecar)
 {
-    GraphData *graphData = &sample->graph_data;
-
-    SampleInfo *sample_info = &sample->opened_audio_file->sample_info;
-    int tmp = 0;
-    long int ret = 0;
-    int min, max, xtmp;
-    int min_sample, max_sample;
-    long int i, k;
-    long int numSampleBlocks;
-    long int tmp_sample_calc;
-    unsigned char devbuf[sample->opened_audio_file->sample_info.blockSize];
-    Points *graph_data;
-
-    tmp_sample_calc = sample_info->numBytes;
-    tmp_sample_calc = tmp_sample_calc / sample_info->blockSize;
-    numSampleBlocks = (tmp_sample_calc + 1);
+    gboolean want_digests = wants_track_digests(callbacks, sidecar);
+    unsigned long block_size = oaf->sample_info.blockSize;
+    int n_regions = 0;
+    guint file_number = 1;
+    char filename[1024];
 
-    /* DEBUG CODE START */
-    /*
-    printf("\nsample_info->numBytes: %lu\n", sample_info->numBytes);
-    printf("sample_info->bitsPerSample: %d\n", sample_info->bitsPerSample);
-    printf("sample_info->blockSize: %d\n", sample_info->blockSize);
-    printf("sample_info->channels: %d\n", sample_info->channels);
-    printf("numSampleBlocks: %d\n\n", numSampleBlocks);
-    */
-    /* DEBUG CODE END */
+    ArchiveWrite aw = {
+        .callbacks = callbacks,
+        .tar = tar_writer_new(archive_fp),
+        .num_files = num_files,
+        .regions = g_new0(FormatRegion, num_files),
+        .filenames = g_new0(char *, num_files),
+        .sizes = g_new0(uint64_t, num_files),
+        .file_numbers = g_new0(guint, num_files),
+        .digests = g_new0(TrackDigest *, num_files),
+        .failed = FALSE,
+    };
 
-    graph_data = (Points *)malloc(numSampleBlocks * sizeof(Points));
+    FormatRegionCallbacks region_callbacks = {
+        .on_region_started = archive_on_region_started,
+        .on_region_finished = archive_on_region_finished,
+        .on_region_data = want_digests ? archive_on_region_data : NULL,
+        .on_region_progress = archive_on_region_progress,
+        .is_cancelled = archive_is_cancelled,
+        .user_data = &aw,
+    };
 
-    if (graph_data == NULL) {
-        printf("NULL returned from malloc of graph_data\n");
-        return;
+    if (!format_can_write_regions(oaf)) {
+        g_warning("Cannot write archives from this format");
+        aw.failed = TRUE;
     }
 
-    i = 0;
+    GList *tbl_cur = list->breaks;
+    while (tbl_cur != NULL && !aw.failed) {
+        TrackBreak *tb_cur = tbl_cur->data;
+        GList *tbl_next = g_list_next(tbl_cur);
 
-    ret = read_sample(sample->opened_audio_file, devbuf, sample_info->blockSize, sample_info->blockSize * i);
+        if (tb_cur->write) {
+            FormatRegion *region = &aw.regions[n_regions];
 
-    min_sample = SHRT_MAX; /* highest value for 16-bit samples */
-    max_sample = 0;
+            build_output_filename(sample, list, tb_cur, NULL, filename);
+            aw.filenames[n_regions] = g_strdup(filename);
 
-    while (ret == sample_info->blockSize && i < numSampleBlocks) {
-        min = max = 0;
-        for (k = 0; k < ret; k++) {
-            if (sample_info->bitsPerSample == 8) {
-                tmp = devbuf[k];
-                tmp -= 128;
-            } else if (sample_info->bitsPerSample == 16) {
-                tmp = (char)devbuf[k+1] << 8 | (char)devbuf[k];
-                k++;
-	    } else if (sample_info->bitsPerSample == 24) {
-		tmp   = ((char)devbuf[k]) | ((char)devbuf[k+1] << 8);
-		tmp  &= 0x0000ffff;
-		xtmp  =  (char)devbuf[k+2] << 16;
-		tmp  |= xtmp;
-		k += 2;
-            }
+            *region = (FormatRegion) {
+                .start_pos = tb_cur->offset * block_size,
+                .end_pos = (tbl_next != NULL) ? ((TrackBreak *)tbl_next->data)->offset * block_size : 0,
+                .output_filename = aw.filenames[n_regions],
+                .output_fp = archive_fp,
+                .written = FALSE,
+            };
+
+            aw.file_numbers[n_regions] = file_number;
+            aw.digests[n_regions] = want_digests ? new_track_digest(sample, list, tbl_cur) : NULL;
 
-            if (tmp > max) {
-                max = tmp;
-            } else if (tmp < min) {
-                min = tmp;
+            if (!format_get_output_size(oaf, region->start_pos, region->end_pos, &aw.sizes[n_regions])) {
+                g_warning("Size of %s is not known in advance, cannot add it to an archive", filename);
+                aw.failed = TRUE;
             }
 
-            // skip over any extra channels
-            k += (sample_info->channels - 1) * (sample_info->bitsPerSample / 8);
+            ++n_regions;
+            ++file_number;
         }
 
-        graph_data[i].min = min;
-        graph_data[i].max = max;
+        tbl_cur = tbl_next;
+    }
+
+    if (!aw.failed && n_regions > 0) {
+        format_write_regions(oaf, aw.regions, n_regions, &region_callbacks);
 
-        if( min_sample > (max-min)) {
-            min_sample = (max-min);
+        if (want_digests) {
+            report_track_digests(callbacks, aw.regions, aw.filenames, aw.digests, n_regions);
         }
-        if( max_sample < (max-min)) {
-            max_sample = (max-min);
+    }
+
+    /* the checksum file is the last member, its size is known once all tracks are written */
+    if (!aw.failed && sidecar != TRACK_DIGEST_SIDECAR_NONE && !callbacks->is_cancelled(callbacks->user_data)) {
+        gchar *contents = track_digest_format_sidecar(sidecar, aw.filenames, aw.digests, n_regions);
+        gchar *name = build_sidecar_filename(sample, sidecar);
+        size_t len = strlen(contents);
+
+        if (!tar_writer_begin_member(aw.tar, name, len) ||
+                fwrite(contents, 1, len, archive_fp) != len ||
+                !tar_writer_end_member(aw.tar)) {
+            aw.failed = TRUE;
         }
 
-        ret = read_sample(sample->opened_audio_file, devbuf, sample_info->blockSize, sample_info->blockSize * i);
+        g_free(name);
+        g_free(contents);
+    }
+
+    /* when cancelled, the archive is left unfinished and the caller has to discard it */
+    gboolean cancelled = callbacks->is_cancelled(callbacks->user_data);
 
-        g_mutex_lock(&sample->load_mutex);
-        sample->load_percentage = (double) i / numSampleBlocks;
-        g_mutex_unlock(&sample->load_mutex);
-        i++;
+    if (!aw.failed && !cancelled && !tar_writer_finish(aw.tar)) {
+        aw.failed = TRUE;
     }
 
-    graphData->numSamples = numSampleBlocks;
+    if (aw.failed && !cancelled) {
+        callbacks->on_error(archive_name, callbacks->user_data);
+    }
 
-    if (graphData->data != NULL) {
-        free(graphData->data);
+    callbacks->on_file_progress_changed(1.0, callbacks->user_data);
+
+    for (int i=0; i<n_regions; ++i) {
+        g_free(aw.filenames[i]);
     }
-    graphData->data = graph_data;
+    g_free(aw.filenames);
+    g_free(aw.regions);
+    g_free(aw.sizes);
+    g_free(aw.file_numbers);
+    free_track_digests(aw.digests, n_regions);
+    tar_writer_free(aw.tar);
+}
 
-    graphData->minSampleAmp = min_sample;
-    graphData->maxSampleAmp = max_sample;
+/**
+ * Playback and the waveform tiles read the source at the same time as a
+ * split, so the split gets its own handle with its own file position.
+ * Streams can't be opened twice, their handle is locked for the whole
+ * split instead.
+ **/
+static OpenedAudioFile *
+open_write_source(Sample *sample)
+{
+    OpenedAudioFile *oaf = sample->opened_audio_file;
 
-    if (sample_info->bitsPerSample == 8) {
-        graphData->maxSampleValue = UCHAR_MAX;
-    } else if (sample_info->bitsPerSample == 16) {
-        graphData->maxSampleValue = SHRT_MAX;
-    } else if (sample_info->bitsPerSample == 24) {
-	graphData->maxSampleValue = 0x7fffff;
+    if (!oaf->streaming) {
+        char *error_message = NULL;
+        OpenedAudioFile *file = format_open_file(oaf->filename, &error_message);
+
+        if (file != NULL) {
+            return file;
+        }
+
+        g_warning("Cannot open %s again for writing: %s", oaf->filename, error_message);
+        g_free(error_message);
     }
 
-    g_mutex_lock(&sample->load_mutex);
-    sample->load_percentage = 1.0;
-    sample->loaded = TRUE;
-    g_mutex_unlock(&sample->load_mutex);
+    g_mutex_lock(&sample->read_mutex);
+
+    return oaf;
 }
 
 static void
-trampoline_file_progress_changed(double progress, void *user_data)
+close_write_source(Sample *sample, OpenedAudioFile *source)
 {
-    WriteStatusCallbacks *callbacks = user_data;
-    callbacks->on_file_progress_changed(progress, callbacks->user_data);
+    if (source == sample->opened_audio_file) {
+        g_mutex_unlock(&sample->read_mutex);
+    } else {
+        format_close_file(source);
+    }
 }
 
 static gpointer
@@ -520,6 +1978,7 @@ write_thread(gpointer data)
     WriteStatusCallbacks *callbacks = thread_data->callbacks;
 
     Sample *sample = thread_data->sample;
+    OpenedAudioFile *source = open_write_source(sample);
 
     unsigned long start_pos, end_pos;
     char filename[1024];
@@ -527,6 +1986,27 @@ write_thread(gpointer data)
     gulong num_files = 0;
     enum OverwriteDecision overwrite_decision = OVERWRITE_DECISION_ASK;
 
+    enum SafeOutputDurability durability;
+    if (!safe_output_parse_durability(appconfig_get_output_durability(), &durability)) {
+        g_warning("Invalid output durability '%s', using 'batch'", appconfig_get_output_durability());
+        durability = SAFE_OUTPUT_DURABILITY_BATCH;
+    }
+
+    /* files are moved to their final names only after they have been written completely */
+    SafeOutput *safe_output = safe_output_new(durability);
+
+    enum TrackDigestSidecar sidecar;
+    if (!track_digest_parse_sidecar(appconfig_get_checksum_file(), &sidecar)) {
+        g_warning("Invalid checksum file type '%s', not writing one", appconfig_get_checksum_file());
+        sidecar = TRACK_DIGEST_SIDECAR_NONE;
+    }
+
+    /* checksums are calculated while writing, which needs the single-pass writer */
+    gboolean want_digests = wants_track_digests(callbacks, sidecar);
+    if (want_digests && !format_can_write_regions(sample->opened_audio_file)) {
+        g_message("Checksums are not supported for %s files", sample->opened_audio_file->mod->name);
+    }
+
     tbl_cur = tbl_head;
     while (tbl_cur != NULL) {
         tb_cur = tbl_cur->data;
@@ -538,6 +2018,24 @@ write_thread(gpointer data)
         tbl_cur = g_list_next(tbl_cur);
     }
 
+    if (thread_data->archive_fp != NULL) {
+        write_archive(sample, source, list, callbacks, thread_data->archive_fp, thread_data->archive_name, num_files, sidecar);
+        goto finished;
+    }
+
+    if (sample->opened_audio_file->streaming && !format_can_write_regions(sample->opened_audio_file)) {
+        g_warning("Cannot split streams of this format");
+        callbacks->on_error(sample->opened_audio_file->filename, callbacks->user_data);
+        goto finished;
+    }
+
+    /* streams can only be written in a single pass, checksums are calculated in it */
+    if ((appconfig_get_sequential_split() || sample->opened_audio_file->streaming || want_digests) &&
+            format_can_write_regions(sample->opened_audio_file)) {
+        write_files_sequential(sample, source, list, callbacks, safe_output, outputdir, num_files, sidecar);
+        goto finished;
+    }
+
     int i = 1;
     tbl_cur = tbl_head;
     tbl_next = g_list_next(tbl_cur);
@@ -556,27 +2054,7 @@ write_thread(gpointer data)
                 end_pos = tb_next->offset * sample->opened_audio_file->sample_info.blockSize;
             }
 
-            /* add output directory to filename */
-            strcpy(filename, outputdir);
-            strcat(filename, "/");
-
-            gchar *tmp = track_break_get_filename(tb_cur, list);
-            strcat(filename, tmp);
-            g_free(tmp);
-
-            // TODO: CDDA needs .cdda.raw file extension, not .raw
-            const char *source_file_extension = sample->opened_audio_file->filename ? strrchr(sample->opened_audio_file->filename, '.') : NULL;
-            if (source_file_extension == NULL) {
-                /* Fallback extensions if not in source filename */
-                if (sample->opened_audio_file != NULL) {
-                    source_file_extension = sample->opened_audio_file->mod->default_file_extension;
-                }
-            }
-
-            /* add file extension to filename */
-            if (source_file_extension != NULL && strstr(filename, source_file_extension) == NULL) {
-                strcat(filename, source_file_extension);
-            }
+            build_output_filename(sample, list, tb_cur, outputdir, filename);
 
             callbacks->on_file_changed(i, num_files, filename, callbacks->user_data);
             callbacks->on_file_progress_changed(0.0, callbacks->user_data);
@@ -588,9 +2066,12 @@ write_thread(gpointer data)
             }
 
             if (!file_exists || overwrite_decision == OVERWRITE_DECISION_OVERWRITE || overwrite_decision == OVERWRITE_DECISION_OVERWRITE_ALL) {
-                if (format_write_file(sample->opened_audio_file, filename, start_pos, end_pos, trampoline_file_progress_changed, callbacks) == -1) {
+                SafeOutputFile *output_file = safe_output_add(safe_output, filename);
+
+                if (format_write_file(source, safe_output_file_get_temp_filename(output_file), start_pos, end_pos, trampoline_file_progress_changed, callbacks) == -1) {
                     g_warning("Could not write file %s", filename);
                     callbacks->on_error(filename, callbacks->user_data);
+                    safe_output_discard(safe_output, output_file);
                 }
             }
 
@@ -607,6 +2088,13 @@ write_thread(gpointer data)
         tbl_next = g_list_next(tbl_next);
     }
 
+finished:
+    close_write_source(sample, source);
+
+    /* also after cancelling: tracks that were written completely are kept */
+    safe_output_commit(safe_output, callbacks->on_error, callbacks->user_data);
+    safe_output_free(safe_output);
+
     g_mutex_lock(&sample->write_mutex);
     sample->writing = FALSE;
     g_mutex_unlock(&sample->write_mutex);
@@ -633,3 +2121,166 @@ sample_write_files(Sample *sample, TrackBreakList *list, WriteStatusCallbacks *c
     // TODO: Capture thread and properly tear it down - if needed - in sample_close()
     g_thread_unref(g_thread_new("write data", write_thread, &sample->write_thread_data));
 }
+
+void
+sample_write_archive(Sample *sample, TrackBreakList *list, WriteStatusCallbacks *callbacks, FILE *archive_fp, const char *archive_name)
+{
+    sample->write_thread_data = (WriteThreadData) {
+        .sample = sample,
+        .list = list,
+        .callbacks = callbacks,
+        .archive_fp = archive_fp,
+        .archive_name = archive_name,
+    };
+
+    g_mutex_lock(&sample->write_mutex);
+    sample->writing = TRUE;
+    g_mutex_unlock(&sample->write_mutex);
+
+    g_thread_unref(g_thread_new("write archive", write_thread, &sample->write_thread_data));
+}
+
+typedef struct VerifyRange_ VerifyRange;
+struct VerifyRange_ {
+    gchar *filename;
+    /* range of sample data to hash, end_pos == 0 means until the end */
+    unsigned long start_pos;
+    unsigned long end_pos;
+
+    /* set by verify_hash_range() */
+    gboolean ok;
+    uint64_t size;
+    uint64_t hash;
+};
+
+static void
+verify_hash_range(gpointer data, gpointer user_data)
+{
+    VerifyRange *range = data;
+    char *error_message = NULL;
+
+    /* each worker opens its own handle, so reads don't share a file position */
+    OpenedAudioFile *file = format_open_file(range->filename, &error_message);
+    if (file == NULL) {
+        g_debug("Cannot open %s for verification: %s", range->filename, error_message);
+        g_free(error_message);
+        return;
+    }
+
+    unsigned char *buf = g_malloc(VERIFY_BUFFER_SIZE);
+    unsigned long pos = range->start_pos;
+    Xxh64State state;
+
+    xxh64_init(&state);
+    range->ok = TRUE;
+
+    while (range->end_pos == 0 || pos < range->end_pos) {
+        size_t size = (range->end_pos == 0) ? VERIFY_BUFFER_SIZE : MIN(VERIFY_BUFFER_SIZE, range->end_pos - pos);
+
+        long ret = format_read_samples(file, buf, size, pos);
+        if (ret < 0) {
+            range->ok = FALSE;
+            break;
+        }
+
+        if (ret == 0) {
+            break;
+        }
+
+        xxh64_update(&state, buf, ret);
+        range->size += ret;
+        pos += ret;
+    }
+
+    range->hash = xxh64_digest(&state);
+
+    g_free(buf);
+    format_close_file(file);
+}
+
+int
+sample_verify_files(Sample *sample, TrackBreakList *list, const char *output_dir, sample_verify_func on_file_verified, void *user_data)
+{
+    OpenedAudioFile *oaf = sample->opened_audio_file;
+    unsigned long block_size = oaf->sample_info.blockSize;
+    uint64_t size;
+    char filename[1024];
+    int failed = 0;
+
+    if (oaf->streaming) {
+        g_warning("Cannot verify files split from a stream");
+        return -1;
+    }
+
+    /* only formats that copy sample data verbatim know their output size */
+    if (!format_get_output_size(oaf, 0, 0, &size)) {
+        g_warning("Cannot verify files split from %s files", oaf->mod->name);
+        return -1;
+    }
+
+    /* for each track: the source range, followed by the whole output file */
+    GPtrArray *ranges = g_ptr_array_new();
+
+    for (GList *tbl_cur = list->breaks; tbl_cur != NULL; tbl_cur = g_list_next(tbl_cur)) {
+        TrackBreak *tb_cur = tbl_cur->data;
+        GList *tbl_next = g_list_next(tbl_cur);
+
+        if (!tb_cur->write) {
+            continue;
+        }
+
+        VerifyRange *source = g_new0(VerifyRange, 1);
+        source->filename = g_strdup(oaf->filename);
+        source->start_pos = tb_cur->offset * block_size;
+        source->end_pos = (tbl_next != NULL) ? ((TrackBreak *)tbl_next->data)->offset * block_size : 0;
+        g_ptr_array_add(ranges, source);
+
+        build_output_filename(sample, list, tb_cur, output_dir, filename);
+
+        VerifyRange *output = g_new0(VerifyRange, 1);
+        output->filename = g_strdup(filename);
+        g_ptr_array_add(ranges, output);
+    }
+
+    /* source ranges and outputs are independent, hash them all in parallel */
+    GThreadPool *pool = g_thread_pool_new(verify_hash_range, NULL, g_get_num_processors(), FALSE, NULL);
+    for (guint i=0; i<ranges->len; ++i) {
+        g_thread_pool_push(pool, g_ptr_array_index(ranges, i), NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    for (guint i=0; i+1<ranges->len; i+=2) {
+        VerifyRange *source = g_ptr_array_index(ranges, i);
+        VerifyRange *output = g_ptr_array_index(ranges, i + 1);
+        gchar *message = NULL;
+
+        if (!source->ok) {
+            message = g_strdup_printf("Could not read source data from %s", source->filename);
+        } else if (!output->ok) {
+            message = g_strdup_printf("Could not read %s", output->filename);
+        } else if (source->size != output->size) {
+            message = g_strdup_printf("Size mismatch: %" G_GUINT64_FORMAT " bytes in source, %" G_GUINT64_FORMAT " bytes in output",
+                    (guint64)source->size, (guint64)output->size);
+        } else if (source->hash != output->hash) {
+            message = g_strdup_printf("Content mismatch: xxh64 %016" G_GINT64_MODIFIER "x in source, %016" G_GINT64_MODIFIER "x in output",
+                    (guint64)source->hash, (guint64)output->hash);
+        }
+
+        if (message != NULL) {
+            ++failed;
+        }
+
+        on_file_verified(output->filename, message == NULL, message, user_data);
+
+        g_free(message);
+    }
+
+    for (guint i=0; i<ranges->len; ++i) {
+        VerifyRange *range = g_ptr_array_index(ranges, i);
+        g_free(range->filename);
+        g_free(range);
+    }
+    g_ptr_array_free(ranges, TRUE);
+
+    return failed;
+}
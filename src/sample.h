@@ -21,6 +21,8 @@
 
 #include "sample_info.h"
 #include "track_break.h"
+#include "track_digest.h"
+#include "moodbar.h"
 
 #include <glib.h>
 #include <stdio.h>
@@ -56,6 +58,8 @@ struct WriteStatusCallbacks_ {
     void (*on_file_progress_changed)(double percentage, void *user_data);
     void (*on_error)(const char *message, void *user_data);
     void (*on_finished)(void *user_data);
+    // Optional, checksums of each file that was written completely
+    void (*on_file_digests)(const char *filename, const TrackDigests *digests, void *user_data);
 
     // Write thread querying the UI
     gboolean (*is_cancelled)(void *user_data);
@@ -86,8 +90,20 @@ void sample_init();
 
 typedef struct Sample_ Sample;
 
+/**
+ * Open a file and analyze it in the background. with_moodbar also
+ * computes the moodbar in the analysis (if supported), otherwise it is
+ * only computed by sample_compute_moodbar().
+ **/
 Sample *
-sample_open(const char *filename, char **error_message);
+sample_open(const char *filename, gboolean with_moodbar, char **error_message);
+
+/**
+ * Open a non-seekable input stream (e.g. stdin) for splitting only,
+ * there is no analysis or playback. The caller owns fp.
+ **/
+Sample *
+sample_open_stream(FILE *fp, const char *format_name, const char *basename, char **error_message);
 
 void
 sample_print_file_info(Sample *sample);
@@ -119,6 +135,22 @@ sample_get_basename_without_extension(Sample *sample);
 int
 sample_play(Sample *sample, gulong startpos);
 
+/**
+ * Play the audio around each position (from before blocks ahead of it
+ * to after blocks past it), one window after another with a short pause
+ * in between. The windows are decoded into memory in the background
+ * while playback runs. Returns the same values as sample_play().
+ **/
+int
+sample_audition(Sample *sample, const gulong *positions, int num_positions, gulong before, gulong after);
+
+/**
+ * Continue playback from pos without reopening the audio device.
+ * Returns FALSE if playback is not running.
+ **/
+gboolean
+sample_seek(Sample *sample, gulong pos);
+
 gulong
 sample_get_play_marker(Sample *sample);
 
@@ -128,12 +160,64 @@ sample_stop(Sample *sample);
 void
 sample_write_files(Sample *sample, TrackBreakList *list, WriteStatusCallbacks *callbacks, const char *output_dir);
 
+/**
+ * Like sample_write_files(), but write all tracks as members of a single
+ * uncompressed tar archive to archive_fp (which can be a pipe). The caller
+ * owns archive_fp, archive_name is only used for error messages. If the
+ * write is cancelled, on_error is not called, but the archive is incomplete.
+ **/
+void
+sample_write_archive(Sample *sample, TrackBreakList *list, WriteStatusCallbacks *callbacks, FILE *archive_fp, const char *archive_name);
+
+typedef void (*sample_verify_func)(const char *filename, gboolean ok, const char *message, void *user_data);
+
+/**
+ * Check that the sample data of each file written for the selected
+ * tracks in output_dir matches its range of the source file. Calls
+ * on_file_verified for each track in break order (message is NULL if
+ * the file is OK). Returns the number of files that did not match, or
+ * -1 if files split from this source can't be verified.
+ **/
+int
+sample_verify_files(Sample *sample, TrackBreakList *list, const char *output_dir, sample_verify_func on_file_verified, void *user_data);
+
+gboolean
+sample_read_embedded_track_breaks(Sample *sample, TrackBreakList *list);
+
 GraphData *
 sample_get_graph_data(Sample *sample);
 
+/**
+ * Moodbar computed during the analysis (owned by the sample), NULL while
+ * loading, if it was not wanted, without moodbar support or for
+ * unsupported sample formats.
+ **/
+MoodbarData *
+sample_get_moodbar(Sample *sample);
+
+/**
+ * Like sample_get_moodbar(), but if the sample was opened without the
+ * moodbar, decode the file again to compute it. Blocks until done.
+ **/
+MoodbarData *
+sample_compute_moodbar(Sample *sample);
+
 unsigned long
 sample_get_num_sample_blocks(Sample *sample);
 
+const SampleInfo *
+sample_get_sample_info(Sample *sample);
+
+/**
+ * Peaks of the first channel at a finer resolution than the graph data:
+ * each block is divided into columns_per_block columns, and n columns
+ * starting at first_column are filled in. The audio data is read on
+ * demand (with a small cache), this can be called from any thread.
+ * Returns the number of columns filled in (fewer at the end of the file).
+ **/
+int
+sample_get_peaks(Sample *sample, unsigned long first_column, int columns_per_block, Points *points, int n);
+
 gboolean
 sample_is_playing(Sample *sample);
 
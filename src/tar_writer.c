@@ -0,0 +1,176 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "tar_writer.h"
+
+#include <string.h>
+#include <time.h>
+
+#define TAR_BLOCK_SIZE 512
+
+/* ustar header fields (offset, size) and single-byte offsets */
+#define TAR_MODE 100, 8
+#define TAR_UID 108, 8
+#define TAR_GID 116, 8
+#define TAR_SIZE 124, 12
+#define TAR_MTIME 136, 12
+#define TAR_CHECKSUM 148
+#define TAR_TYPEFLAG 156
+#define TAR_MAGIC 257
+#define TAR_VERSION 263
+
+/* largest size that fits into the 11 octal digits of the size field */
+#define TAR_USTAR_MAX_SIZE G_GUINT64_CONSTANT(077777777777)
+
+struct TarWriter_ {
+    FILE *fp;
+    time_t mtime;
+
+    /* size of the data of the member being written */
+    uint64_t member_size;
+};
+
+TarWriter *
+tar_writer_new(FILE *fp)
+{
+    TarWriter *tar = g_new0(TarWriter, 1);
+
+    tar->fp = fp;
+    tar->mtime = time(NULL);
+
+    return tar;
+}
+
+static void
+tar_set_octal(unsigned char *header, size_t offset, size_t size, uint64_t value)
+{
+    /* zero-padded, terminated by a NUL byte */
+    g_snprintf((char *)header + offset, size, "%0*" G_GINT64_MODIFIER "o", (int)(size - 1), (guint64)value);
+}
+
+static gboolean
+tar_write_padding(TarWriter *tar, uint64_t size)
+{
+    static const unsigned char ZEROS[TAR_BLOCK_SIZE];
+
+    size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+
+    return padding == 0 || fwrite(ZEROS, padding, 1, tar->fp) == 1;
+}
+
+static gboolean
+tar_write_header(TarWriter *tar, const char *name, char typeflag, uint64_t size)
+{
+    unsigned char header[TAR_BLOCK_SIZE];
+    unsigned int checksum = 0;
+
+    memset(header, 0, sizeof(header));
+
+    /* may be truncated, the full name is then stored in a pax header */
+    strncpy((char *)header, name, 100);
+
+    tar_set_octal(header, TAR_MODE, 0644);
+    tar_set_octal(header, TAR_UID, 0);
+    tar_set_octal(header, TAR_GID, 0);
+    tar_set_octal(header, TAR_SIZE, MIN(size, TAR_USTAR_MAX_SIZE));
+    tar_set_octal(header, TAR_MTIME, tar->mtime);
+    header[TAR_TYPEFLAG] = typeflag;
+    memcpy(header + TAR_MAGIC, "ustar", 6);
+    memcpy(header + TAR_VERSION, "00", 2);
+
+    /* the checksum is calculated with the checksum field filled with spaces */
+    memset(header + TAR_CHECKSUM, ' ', 8);
+    for (size_t i=0; i<sizeof(header); ++i) {
+        checksum += header[i];
+    }
+    g_snprintf((char *)header + TAR_CHECKSUM, 7, "%06o", checksum);
+
+    return fwrite(header, sizeof(header), 1, tar->fp) == 1;
+}
+
+static void
+tar_append_pax_record(GString *records, const char *key, const char *value)
+{
+    /* "<length> <key>=<value>\n", where length includes its own digits */
+    size_t payload = 1 + strlen(key) + 1 + strlen(value) + 1;
+    size_t length = payload + 1;
+
+    while (payload + snprintf(NULL, 0, "%zu", length) != length) {
+        length = payload + snprintf(NULL, 0, "%zu", length);
+    }
+
+    g_string_append_printf(records, "%zu %s=%s\n", length, key, value);
+}
+
+gboolean
+tar_writer_begin_member(TarWriter *tar, const char *name, uint64_t size)
+{
+    gboolean long_name = (strlen(name) > 100);
+    gboolean large = (size > TAR_USTAR_MAX_SIZE);
+
+    if (long_name || large) {
+        GString *records = g_string_new(NULL);
+
+        if (long_name) {
+            tar_append_pax_record(records, "path", name);
+        }
+
+        if (large) {
+            gchar *value = g_strdup_printf("%" G_GUINT64_FORMAT, (guint64)size);
+            tar_append_pax_record(records, "size", value);
+            g_free(value);
+        }
+
+        gboolean ok = tar_write_header(tar, "././@PaxHeader", 'x', records->len) &&
+            fwrite(records->str, 1, records->len, tar->fp) == records->len &&
+            tar_write_padding(tar, records->len);
+
+        g_string_free(records, TRUE);
+
+        if (!ok) {
+            return FALSE;
+        }
+    }
+
+    tar->member_size = size;
+
+    return tar_write_header(tar, name, '0', size);
+}
+
+gboolean
+tar_writer_end_member(TarWriter *tar)
+{
+    return tar_write_padding(tar, tar->member_size);
+}
+
+gboolean
+tar_writer_finish(TarWriter *tar)
+{
+    static const unsigned char ZEROS[2 * TAR_BLOCK_SIZE];
+
+    /* two empty blocks mark the end of the archive */
+    return fwrite(ZEROS, sizeof(ZEROS), 1, tar->fp) == 1 && fflush(tar->fp) == 0;
+}
+
+void
+tar_writer_free(TarWriter *tar)
+{
+    g_free(tar);
+}
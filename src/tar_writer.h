@@ -0,0 +1,59 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * Minimal writer for uncompressed POSIX (ustar) tar archives. The size
+ * of each member must be known before its data is written, as it is
+ * part of the header; the data itself is written by the caller to the
+ * same FILE * between begin and end. The output is never seeked, so it
+ * can also be a pipe.
+ **/
+
+typedef struct TarWriter_ TarWriter;
+
+TarWriter *
+tar_writer_new(FILE *fp);
+
+/**
+ * Write the header of a regular file member. Names that don't fit into
+ * a ustar header and sizes of 8 GiB and more use a pax extended header.
+ **/
+gboolean
+tar_writer_begin_member(TarWriter *tar, const char *name, uint64_t size);
+
+/**
+ * Pad the data of the current member to the tar block size.
+ **/
+gboolean
+tar_writer_end_member(TarWriter *tar);
+
+/**
+ * Write the end-of-archive marker and flush the output.
+ **/
+gboolean
+tar_writer_finish(TarWriter *tar);
+
+void
+tar_writer_free(TarWriter *tar);
@@ -0,0 +1,285 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "track_digest.h"
+#include "xxh64.h"
+
+#include <string.h>
+
+/* 5 CD sectors of 588 stereo samples each */
+#define ACCURATERIP_SKIP_SAMPLES (5 * 588)
+
+struct TrackDigest_ {
+    GChecksum *md5;
+    Xxh64State xxh64;
+    gboolean file_digests_valid;
+
+    gboolean accuraterip;
+    gboolean first_track;
+    gboolean last_track;
+    gboolean have_samples;
+    /* 1-based position of the next stereo sample */
+    uint32_t multiplier;
+    /* bytes of a sample that was split between two buffers */
+    unsigned char partial[4];
+    size_t partial_size;
+    /* the last track excludes its last samples, so they are added with a delay */
+    uint32_t *delayed;
+    size_t delayed_pos;
+
+    uint32_t accuraterip_v1;
+    uint32_t accuraterip_v2;
+
+    gchar xxh64_hex[17];
+    TrackDigests result;
+};
+
+TrackDigest *
+track_digest_new(gboolean accuraterip, gboolean first_track, gboolean last_track)
+{
+    TrackDigest *digest = g_new0(TrackDigest, 1);
+
+    digest->md5 = g_checksum_new(G_CHECKSUM_MD5);
+    xxh64_init(&digest->xxh64);
+    digest->file_digests_valid = TRUE;
+
+    digest->accuraterip = accuraterip;
+    digest->first_track = first_track;
+    digest->last_track = last_track;
+    digest->multiplier = 1;
+
+    if (accuraterip && last_track) {
+        digest->delayed = g_new0(uint32_t, ACCURATERIP_SKIP_SAMPLES);
+    }
+
+    return digest;
+}
+
+static void
+accuraterip_add(TrackDigest *digest, uint32_t sample, uint32_t multiplier)
+{
+    if (digest->first_track && multiplier < ACCURATERIP_SKIP_SAMPLES) {
+        return;
+    }
+
+    uint64_t product = (uint64_t)sample * multiplier;
+
+    digest->accuraterip_v1 += (uint32_t)product;
+    digest->accuraterip_v2 += (uint32_t)product + (uint32_t)(product >> 32);
+}
+
+static void
+accuraterip_push(TrackDigest *digest, const unsigned char *p, gboolean big_endian)
+{
+    /* left channel in the lower, right channel in the upper 16 bits */
+    uint32_t sample = big_endian ?
+        ((uint32_t)p[1] | ((uint32_t)p[0] << 8) | ((uint32_t)p[3] << 16) | ((uint32_t)p[2] << 24)) :
+        ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+
+    uint32_t multiplier = digest->multiplier++;
+
+    if (!digest->last_track) {
+        accuraterip_add(digest, sample, multiplier);
+        return;
+    }
+
+    /* the sample from 5 sectors ago is not within the end of the disc */
+    if (multiplier > ACCURATERIP_SKIP_SAMPLES) {
+        accuraterip_add(digest, digest->delayed[digest->delayed_pos], multiplier - ACCURATERIP_SKIP_SAMPLES);
+    }
+
+    digest->delayed[digest->delayed_pos] = sample;
+    digest->delayed_pos = (digest->delayed_pos + 1) % ACCURATERIP_SKIP_SAMPLES;
+}
+
+static void
+accuraterip_update(TrackDigest *digest, const unsigned char *buf, size_t size, gboolean big_endian)
+{
+    digest->have_samples = TRUE;
+
+    if (digest->partial_size > 0) {
+        size_t n = MIN(size, 4 - digest->partial_size);
+        memcpy(digest->partial + digest->partial_size, buf, n);
+        digest->partial_size += n;
+        buf += n;
+        size -= n;
+
+        if (digest->partial_size < 4) {
+            return;
+        }
+
+        accuraterip_push(digest, digest->partial, big_endian);
+        digest->partial_size = 0;
+    }
+
+    for (; size >= 4; buf += 4, size -= 4) {
+        accuraterip_push(digest, buf, big_endian);
+    }
+
+    memcpy(digest->partial, buf, size);
+    digest->partial_size = size;
+}
+
+void
+track_digest_update(TrackDigest *digest, enum FormatRegionDataType type, const unsigned char *buf, size_t size)
+{
+    if (type == FORMAT_REGION_DATA_HEADER_REWRITTEN) {
+        /* data at the start of the file changed, only the audio CRCs are still valid */
+        digest->file_digests_valid = FALSE;
+        return;
+    }
+
+    g_checksum_update(digest->md5, buf, size);
+    xxh64_update(&digest->xxh64, buf, size);
+    digest->result.size += size;
+
+    if (digest->accuraterip && (type == FORMAT_REGION_DATA_SAMPLES_LE || type == FORMAT_REGION_DATA_SAMPLES_BE)) {
+        accuraterip_update(digest, buf, size, type == FORMAT_REGION_DATA_SAMPLES_BE);
+    }
+}
+
+const TrackDigests *
+track_digest_finish(TrackDigest *digest)
+{
+    if (digest->file_digests_valid) {
+        g_snprintf(digest->xxh64_hex, sizeof(digest->xxh64_hex), "%016" G_GINT64_MODIFIER "x", (guint64)xxh64_digest(&digest->xxh64));
+
+        digest->result.md5 = g_checksum_get_string(digest->md5);
+        digest->result.xxh64 = digest->xxh64_hex;
+    }
+
+    /* samples still delayed at this point are within the last 5 sectors */
+    digest->result.have_accuraterip = digest->accuraterip && digest->have_samples;
+    digest->result.accuraterip_v1 = digest->accuraterip_v1;
+    digest->result.accuraterip_v2 = digest->accuraterip_v2;
+
+    return &digest->result;
+}
+
+void
+track_digest_free(TrackDigest *digest)
+{
+    g_checksum_free(digest->md5);
+    g_free(digest->delayed);
+    g_free(digest);
+}
+
+static const struct {
+    const char *name;
+    const char *extension;
+    enum TrackDigestSidecar sidecar;
+} SIDECAR_NAMES[] = {
+    { "none", NULL, TRACK_DIGEST_SIDECAR_NONE },
+    { "md5", ".md5", TRACK_DIGEST_SIDECAR_MD5 },
+    { "json", ".json", TRACK_DIGEST_SIDECAR_JSON },
+};
+
+gboolean
+track_digest_parse_sidecar(const char *str, enum TrackDigestSidecar *sidecar)
+{
+    for (size_t i=0; str != NULL && i<G_N_ELEMENTS(SIDECAR_NAMES); ++i) {
+        if (strcmp(str, SIDECAR_NAMES[i].name) == 0) {
+            *sidecar = SIDECAR_NAMES[i].sidecar;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+const char *
+track_digest_sidecar_extension(enum TrackDigestSidecar sidecar)
+{
+    for (size_t i=0; i<G_N_ELEMENTS(SIDECAR_NAMES); ++i) {
+        if (SIDECAR_NAMES[i].sidecar == sidecar) {
+            return SIDECAR_NAMES[i].extension;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+json_append_string(GString *str, const char *value)
+{
+    g_string_append_c(str, '"');
+
+    for (const char *p = value; *p != '\0'; ++p) {
+        if (*p == '"' || *p == '\\') {
+            g_string_append_c(str, '\\');
+            g_string_append_c(str, *p);
+        } else if ((unsigned char)*p < 0x20) {
+            g_string_append_printf(str, "\\u%04x", (unsigned char)*p);
+        } else {
+            g_string_append_c(str, *p);
+        }
+    }
+
+    g_string_append_c(str, '"');
+}
+
+gchar *
+track_digest_format_sidecar(enum TrackDigestSidecar sidecar, char **filenames, TrackDigest **digests, int n)
+{
+    GString *str = g_string_new(NULL);
+    gboolean first = TRUE;
+
+    if (sidecar == TRACK_DIGEST_SIDECAR_JSON) {
+        g_string_append(str, "{\n  \"files\": [");
+    }
+
+    for (int i=0; i<n; ++i) {
+        if (digests[i] == NULL) {
+            continue;
+        }
+
+        const TrackDigests *result = track_digest_finish(digests[i]);
+
+        if (sidecar == TRACK_DIGEST_SIDECAR_MD5) {
+            if (result->md5 != NULL) {
+                g_string_append_printf(str, "%s  %s\n", result->md5, filenames[i]);
+            }
+        } else if (sidecar == TRACK_DIGEST_SIDECAR_JSON) {
+            g_string_append(str, first ? "\n    {\n      \"filename\": " : ",\n    {\n      \"filename\": ");
+            json_append_string(str, filenames[i]);
+            g_string_append_printf(str, ",\n      \"size\": %" G_GUINT64_FORMAT, (guint64)result->size);
+
+            if (result->md5 != NULL) {
+                g_string_append_printf(str, ",\n      \"md5\": \"%s\"", result->md5);
+                g_string_append_printf(str, ",\n      \"xxh64\": \"%s\"", result->xxh64);
+            }
+
+            if (result->have_accuraterip) {
+                g_string_append_printf(str, ",\n      \"accuraterip_v1\": \"%08x\"", result->accuraterip_v1);
+                g_string_append_printf(str, ",\n      \"accuraterip_v2\": \"%08x\"", result->accuraterip_v2);
+            }
+
+            g_string_append(str, "\n    }");
+        }
+
+        first = FALSE;
+    }
+
+    if (sidecar == TRACK_DIGEST_SIDECAR_JSON) {
+        g_string_append(str, first ? "]\n}\n" : "\n  ]\n}\n");
+    }
+
+    return g_string_free(str, FALSE);
+}
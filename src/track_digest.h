@@ -0,0 +1,88 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "format.h"
+
+#include <glib.h>
+#include <stdint.h>
+
+/**
+ * Checksums of an output file, calculated from the data while it is
+ * being written: MD5 and XXH64 of the whole file, and the AccurateRip
+ * v1/v2 CRCs of the audio data for tracks split from CD audio
+ * (16-bit stereo at 44.1 kHz).
+ **/
+
+typedef struct TrackDigests_ TrackDigests;
+struct TrackDigests_ {
+    /* size of the output file in bytes */
+    uint64_t size;
+
+    /* lowercase hex digests of the file, NULL if not available */
+    const char *md5;
+    const char *xxh64;
+
+    gboolean have_accuraterip;
+    uint32_t accuraterip_v1;
+    uint32_t accuraterip_v2;
+};
+
+enum TrackDigestSidecar {
+    TRACK_DIGEST_SIDECAR_NONE = 0,
+    /* md5sum(1) compatible list */
+    TRACK_DIGEST_SIDECAR_MD5,
+    /* all digests of all tracks */
+    TRACK_DIGEST_SIDECAR_JSON,
+};
+
+typedef struct TrackDigest_ TrackDigest;
+
+/**
+ * AccurateRip skips the first 5 sectors (minus one sample) of the first
+ * track and the last 5 sectors of the last track of a disc.
+ **/
+TrackDigest *
+track_digest_new(gboolean accuraterip, gboolean first_track, gboolean last_track);
+
+void
+track_digest_update(TrackDigest *digest, enum FormatRegionDataType type, const unsigned char *buf, size_t size);
+
+/**
+ * Finish the calculation, the result is valid until the digest is freed.
+ **/
+const TrackDigests *
+track_digest_finish(TrackDigest *digest);
+
+void
+track_digest_free(TrackDigest *digest);
+
+gboolean
+track_digest_parse_sidecar(const char *str, enum TrackDigestSidecar *sidecar);
+
+const char *
+track_digest_sidecar_extension(enum TrackDigestSidecar sidecar);
+
+/**
+ * Format the contents of a sidecar file for n files, filenames are
+ * written as given (relative to the sidecar). Entries with a NULL
+ * digest are left out.
+ **/
+gchar *
+track_digest_format_sidecar(enum TrackDigestSidecar sidecar, char **filenames, TrackDigest **digests, int n);
@@ -66,8 +66,24 @@ enum {
  **/
 #define PLAY_MARKER_SCROLL 8
 
+/**
+ * Largest zoom level of the sample view (2^x columns per block), which
+ * shows individual samples of CD audio (588 per block).
+ **/
+#define ZOOM_IN_MAX 10
+
 #define SILENCE_MIN_LENGTH 4
 
+/* Audio played before and after each track break when auditioning */
+#define AUDITION_SECONDS 3
+
+/* Font of the track break labels in the sample view */
+#define LABEL_FONT_FACE "sans-serif"
+#define LABEL_FONT_SIZE 10
+
+/* Measured labels are forgotten when the cache grows beyond this */
+#define LABEL_CACHE_MAX 4096
+
 static struct WaveformSurface *sample_surface;
 static struct WaveformSurface *summary_surface;
 
@@ -105,15 +121,23 @@ static Sample *g_sample = NULL;
 static MoodbarData *moodbarData;
 
 static gulong cursor_marker;
-static int pixmap_offset;
+/* in columns of the sample view at the current zoom level */
+static long pixmap_offset;
+/* see waveform_zoom_block_to_column() */
+static int sample_zoom;
 
 // one-shot idle_add-style event sources
+/* label text -> LabelExtents in the label font, see get_label_extents() */
+static GHashTable *label_cache;
+
 static guint open_file_source_id;
 static guint redraw_source_id;
 
 // timeout-based (periodic) progress UI update event sources
 static guint file_open_progress_source_id;
-static guint play_progress_source_id;
+static guint play_progress_tick_id;
+/* x coordinate of the play marker drawn last, -1 if none */
+static long play_marker_x = -1;
 
 static struct FileWriteProgressUI *
 current_file_write_progress_ui = NULL;
@@ -158,10 +182,16 @@ static void set_title(const char *title);
 
 /* Sample and Summary Display Functions */
 static void force_redraw();
+static void invalidate_blocks(gulong first, gulong last);
+static void invalidate_track(GList *tbl);
 static void redraw();
 static gboolean redraw_later( gpointer data);
 
 static void reset_sample_display(guint);
+static void set_sample_display_offset(long start);
+static long block_to_column(long block);
+static long block_to_x(long block);
+static MoodbarData *get_moodbar(void);
 
 static gboolean
 configure_event(GtkWidget *widget,
@@ -235,6 +265,9 @@ menu_play(GtkWidget *widget, gpointer user_data);
 static void
 menu_stop(GtkWidget *widget, gpointer user_data);
 
+static void
+menu_audition(GSimpleAction *action, GVariant *parameter, gpointer user_data);
+
 static void
 menu_next_silence( GtkWidget* widget, gpointer user_data);
 
@@ -282,18 +315,17 @@ void set_status_message(const char *val)
 void parts_check_cb(GtkWidget *widget, gpointer data) {
 
     TrackBreak *track_break;
-    guint list_pos;
-    gpointer list_data;
+    GList *tbl = track_breaks->breaks;
+    gboolean write;
     gint i;
     GtkTreeIter iter;
 
     i = 0;
 
-    while (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, NULL, i++)) {
+    while (tbl != NULL && gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, NULL, i++)) {
 
-        list_pos = i - 1;
-        list_data = g_list_nth_data(track_breaks->breaks, list_pos);
-        track_break = (TrackBreak *)list_data;
+        track_break = tbl->data;
+        write = track_break->write;
 
         switch ((glong)data) {
 
@@ -310,9 +342,16 @@ void parts_check_cb(GtkWidget *widget, gpointer data) {
 
         gtk_list_store_set(GTK_LIST_STORE(store), &iter, COLUMN_WRITE,
                            track_break->write, -1);
+
+        /* only repaint the tracks that actually changed */
+        if (track_break->write != write) {
+            invalidate_track(tbl);
+        }
+
+        tbl = g_list_next(tbl);
     }
 
-    force_redraw();
+    redraw();
 }
 
 void jump_to_cursor_marker(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
@@ -343,7 +382,7 @@ void wavbreaker_autosplit(long x) {
     }
 
     cursor_marker = orig_cursor_marker;
-    force_redraw();
+    redraw();
 }
 
 /*
@@ -526,6 +565,7 @@ track_break_button_press(GtkWidget *widget, GdkEventButton *event, gpointer user
     GMenu *break_model = g_menu_new();
     g_menu_append(break_model, _("Remove track break"), "win.remove_break");
     g_menu_append(break_model, _("Jump to track break"), "win.jump_break");
+    g_menu_append(break_model, _("Audition track breaks from here"), "win.audition");
     g_menu_append_section(menu_model, NULL, G_MENU_MODEL(break_model));
 
     GtkMenu *menu = GTK_MENU(gtk_menu_new_from_model(G_MENU_MODEL(menu_model)));
@@ -546,6 +586,8 @@ void track_break_delete_selected(gpointer data, gpointer user_data)
         return;
     }
 
+    /* the following tracks are drawn with the colors of the next index */
+    invalidate_blocks(((TrackBreak *)g_list_nth_data(track_breaks->breaks, list_pos))->offset, G_MAXULONG);
     track_break_list_remove_nth_element(track_breaks, list_pos);
 
     GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(treeview));
@@ -574,7 +616,7 @@ track_break_delete_entry()
 
     track_break_update_gui_model();
 
-    force_redraw();
+    redraw();
 }
 
 guint track_break_find_offset()
@@ -639,7 +681,9 @@ void track_break_add_entry()
 
     select_and_show_track_break(g_list_index(track_breaks->breaks, track_break));
 
-    force_redraw();
+    /* the following tracks are drawn with the colors of the next index */
+    invalidate_blocks(marker, G_MAXULONG);
+    redraw();
 }
 
 static void
@@ -687,11 +731,11 @@ void track_break_write_toggled(GtkWidget *widget,
     GtkTreePath *path = gtk_tree_path_new_from_string(path_str);
     TrackBreak *track_break;
     guint list_pos;
-    gpointer list_data;
+    GList *tbl;
 
     list_pos = atoi(path_str);
-    list_data = g_list_nth_data(track_breaks->breaks, list_pos);
-    track_break = (TrackBreak *)list_data;
+    tbl = g_list_nth(track_breaks->breaks, list_pos);
+    track_break = (TrackBreak *)tbl->data;
     track_break->write = !track_break->write;
 
 /* DEBUG CODE START */
@@ -708,7 +752,8 @@ void track_break_write_toggled(GtkWidget *widget,
                        track_break->write, -1);
 
     gtk_tree_path_free(path);
-    force_redraw();
+    invalidate_track(tbl);
+    redraw();
 }
 
 void track_break_filename_edited(GtkCellRendererText *cell,
@@ -739,7 +784,8 @@ void track_break_filename_edited(GtkCellRendererText *cell,
 
     gtk_tree_path_free(path);
 
-    force_redraw();
+    /* the waveform colors stay the same, only the label changes */
+    redraw();
 }
 
 /*
@@ -1034,38 +1080,69 @@ file_write_progress_idle_func(gpointer data)
     return TRUE;
 }
 
-gboolean
-file_play_progress_idle_func(gpointer data) {
+/* repaint the column of the play marker at x (and its neighbours) */
+static void queue_draw_play_marker(long x)
+{
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(draw, &allocation);
+
+    if (x >= -1 && x <= allocation.width) {
+        gtk_widget_queue_draw_area(draw, x - 1, 0, 3, allocation.height);
+    }
+}
+
+/**
+ * Called for each frame while playing. The waveform is only redrawn when
+ * the view scrolls, otherwise just the old and new play marker columns
+ * are repainted (the waveform tiles are composited from the cache).
+ **/
+static gboolean
+file_play_progress_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data)
+{
     GtkAllocation allocation;
     gtk_widget_get_allocation(draw, &allocation);
     gint half_width = allocation.width / 2;
     gint offset = allocation.width * (1.0/PLAY_MARKER_SCROLL);
 
+    if (!sample_is_playing(g_sample)) {
+        queue_draw_play_marker(play_marker_x);
+        play_marker_x = -1;
+
+        update_status(FALSE);
+        set_play_icon();
+        play_progress_tick_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
     gulong play_marker = sample_get_play_marker(g_sample);
+    long play_column = block_to_column(play_marker);
+    long old_offset = pixmap_offset;
 
-    gint x = play_marker - half_width;
-    gint y = play_marker - pixmap_offset;
+    long x = play_column - half_width;
+    long y = play_column - pixmap_offset;
     gint z = allocation.width * (1.0 - 1.0/PLAY_MARKER_SCROLL);
 
     if (y > z && x > 0) {
-        reset_sample_display(play_marker - offset + half_width);
-    } else if (pixmap_offset > play_marker) {
+        set_sample_display_offset(play_column - offset);
+    } else if (pixmap_offset > play_column) {
         reset_sample_display(play_marker);
     }
 
-    gtk_adjustment_set_value(GTK_ADJUSTMENT(adj), pixmap_offset);
-    gtk_widget_queue_draw(scrollbar);
+    if (pixmap_offset != old_offset) {
+        gtk_adjustment_set_value(GTK_ADJUSTMENT(adj), pixmap_offset);
+        gtk_widget_queue_draw(scrollbar);
+
+        redraw();
+    } else if (block_to_x(play_marker) != play_marker_x) {
+        queue_draw_play_marker(play_marker_x);
+        queue_draw_play_marker(block_to_x(play_marker));
+    }
+
+    play_marker_x = block_to_x(play_marker);
 
-    redraw();
     update_status(FALSE);
 
-    if (sample_is_playing(g_sample)) {
-        return TRUE;
-    } else {
-        set_play_icon();
-        play_progress_source_id = 0;
-        return FALSE;
-    }
+    return G_SOURCE_CONTINUE;
 }
 
 /*
@@ -1158,12 +1235,7 @@ file_open_progress_idle_func(gpointer data)
         configure_event(draw, NULL, NULL);
 
 #if defined(WANT_MOODBAR)
-        if (moodbarData) {
-            moodbar_free(moodbarData);
-        }
-        moodbarData = moodbar_open(sample_get_filename(sample));
-        set_action_enabled("display_moodbar", moodbarData != NULL);
-        set_action_enabled("generate_moodbar", moodbarData == NULL);
+        wavbreaker_update_moodbar_state();
 #endif
 
         if (!track_breaks) {
@@ -1171,9 +1243,15 @@ file_open_progress_idle_func(gpointer data)
         }
         track_break_list_set_total_duration(track_breaks, sample_get_num_sample_blocks(sample));
 
+        // Use markers stored in the file (e.g. WAV cue points) as initial track breaks
+        if (sample_read_embedded_track_breaks(sample, track_breaks)) {
+            g_message("Loaded %d track breaks from markers in %s", g_list_length(track_breaks->breaks), sample_get_basename(sample));
+        }
+
         // Now that the file is fully loaded, update the duration
         track_break_update_gui_model();
-        redraw();
+        // Tiles drawn while the file was analyzed are incomplete
+        force_redraw();
 
         /* --------------------------------------------------- */
 
@@ -1195,11 +1273,17 @@ file_open_progress_idle_func(gpointer data)
 
 static void open_file(const char *filename) {
     if (g_sample != NULL) {
+        /* tiles of zoomed in views are rendered from the audio data */
+        waveform_surface_cancel(sample_surface);
         sample_close(g_steal_pointer(&g_sample));
     }
 
+    sample_zoom = 0;
+    pixmap_offset = 0;
+
     char *error_message = NULL;
-    if ((g_sample = sample_open(filename, &error_message)) == NULL) {
+    /* without the moodbar shown, it is only computed when it is needed */
+    if ((g_sample = sample_open(filename, appconfig_get_show_moodbar(), &error_message)) == NULL) {
         popupmessage_show(main_window, _("Error opening file"), error_message);
         g_free(error_message);
         return;
@@ -1215,13 +1299,18 @@ static void open_file(const char *filename) {
     set_action_enabled("auto_rename", TRUE);
     set_action_enabled("remove_break", TRUE);
     set_action_enabled("jump_break", TRUE);
+    set_action_enabled("audition", TRUE);
+
+    set_action_enabled("zoom_in", TRUE);
+    set_action_enabled("zoom_out", TRUE);
+    set_action_enabled("zoom_reset", TRUE);
 
     set_action_enabled("export", TRUE);
     set_action_enabled("import", TRUE);
 
 #if defined(WANT_MOODBAR)
-    set_action_enabled("display_moodbar", moodbarData != NULL);
-    set_action_enabled("generate_moodbar", moodbarData == NULL);
+    set_action_enabled("display_moodbar", get_moodbar() != NULL);
+    set_action_enabled("generate_moodbar", moodbarData == NULL && get_moodbar() != NULL);
 #endif
     gtk_widget_set_sensitive( play_button, TRUE);
     gtk_widget_set_sensitive( header_bar_save_button, TRUE);
@@ -1297,6 +1386,9 @@ static void open_select_file() {
     filter_supported = gtk_file_filter_new();
     gtk_file_filter_set_name( filter_supported, _("Supported files"));
     gtk_file_filter_add_pattern( filter_supported, "*.wav");
+    gtk_file_filter_add_pattern( filter_supported, "*.aif");
+    gtk_file_filter_add_pattern( filter_supported, "*.aiff");
+    gtk_file_filter_add_pattern( filter_supported, "*.aifc");
 #if defined(HAVE_MPG123)
     gtk_file_filter_add_pattern( filter_supported, "*.mp2");
     gtk_file_filter_add_pattern( filter_supported, "*.mp3");
@@ -1343,15 +1435,131 @@ static void open_select_file() {
  *-------------------------------------------------------------------------
  */
 
-static inline void blit_cairo_surface(cairo_t *cr, cairo_surface_t *surface, int width, int height)
+static long block_to_column(long block)
 {
-    if (!surface) {
-        return;
+    return waveform_zoom_block_to_column(sample_zoom, block);
+}
+
+static long column_to_block(long column)
+{
+    return waveform_zoom_column_to_block(sample_zoom, column);
+}
+
+/* x coordinate of the start of a block in the sample view */
+static long block_to_x(long block)
+{
+    return block_to_column(block) - pixmap_offset;
+}
+
+/* block at an x coordinate of the sample view */
+static long x_to_block(long x)
+{
+    return column_to_block(pixmap_offset + x);
+}
+
+/* number of columns of the whole file at the current zoom level */
+static long get_num_columns()
+{
+    long blocks = sample_get_num_sample_blocks(g_sample);
+
+    if (sample_zoom < 0) {
+        /* the last column may be partial */
+        blocks += (1L << -sample_zoom) - 1;
+    }
+
+    return block_to_column(blocks);
+}
+
+/* the .mood file of the sample if there is one, otherwise the moodbar computed by the analysis */
+static MoodbarData *get_moodbar(void)
+{
+    if (moodbarData != NULL || g_sample == NULL) {
+        return moodbarData;
+    }
+
+    return sample_get_moodbar(g_sample);
+}
+
+static struct WaveformSurfaceDrawContext get_draw_context(GtkWidget *widget)
+{
+    return (struct WaveformSurfaceDrawContext) {
+        .widget = widget,
+        .pixmap_offset = pixmap_offset,
+        .list = track_breaks,
+        .graphData = sample_get_graph_data(g_sample),
+        .moodbarData = appconfig_get_show_moodbar() ? get_moodbar() : NULL,
+        .sample = g_sample,
+        .zoom = sample_zoom,
+    };
+}
+
+typedef struct {
+    double width;
+    double height;
+} LabelExtents;
+
+/**
+ * Text extents of a label in the label font (which must be selected
+ * in cr), cached so that labels are measured only once and not in
+ * every redraw.
+ **/
+static const LabelExtents *
+get_label_extents(cairo_t *cr, const char *text)
+{
+    if (label_cache == NULL) {
+        label_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    }
+
+    LabelExtents *extents = g_hash_table_lookup(label_cache, text);
+    if (extents == NULL) {
+        if (g_hash_table_size(label_cache) >= LABEL_CACHE_MAX) {
+            g_hash_table_remove_all(label_cache);
+        }
+
+        cairo_text_extents_t te;
+        cairo_text_extents(cr, text, &te);
+
+        extents = g_new(LabelExtents, 1);
+        extents->width = te.width;
+        extents->height = te.height;
+        g_hash_table_insert(label_cache, g_strdup(text), extents);
     }
 
-    cairo_set_source_surface(cr, surface, 0.f, 0.f);
-    cairo_rectangle(cr, 0.f, 0.f, (float)width, (float)height);
-    cairo_fill(cr);
+    return extents;
+}
+
+/**
+ * Shorten a label to the longest prefix (at least one character) that
+ * is no wider than max_width, and append an ellipsis. The prefix
+ * length is found with a binary search over the UTF-8 characters.
+ **/
+static gchar *
+ellipsize_label(cairo_t *cr, const char *text, double max_width)
+{
+    glong lo = 1;
+    glong hi = g_utf8_strlen(text, -1) - 1;
+
+    while (lo < hi) {
+        glong mid = lo + (hi - lo + 1) / 2;
+
+        cairo_text_extents_t te;
+        gchar *prefix = g_utf8_substring(text, 0, mid);
+        cairo_text_extents(cr, prefix, &te);
+        g_free(prefix);
+
+        if (te.width <= max_width) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    const gchar *end = g_utf8_offset_to_pointer(text, lo);
+    gchar *prefix = g_strndup(text, end - text);
+    gchar *result = g_strconcat(prefix, "...", NULL);
+    g_free(prefix);
+
+    return result;
 }
 
 static void force_redraw()
@@ -1362,6 +1570,21 @@ static void force_redraw()
     redraw();
 }
 
+/* repaint the columns starting at blocks first..last, e.g. after track breaks changed */
+static void invalidate_blocks(gulong first, gulong last)
+{
+    waveform_surface_invalidate_range(sample_surface, first, last);
+    waveform_surface_invalidate_range(summary_surface, first, last);
+}
+
+/* repaint the track starting at a track break (element of track_breaks->breaks) */
+static void invalidate_track(GList *tbl)
+{
+    TrackBreak *next = tbl->next ? tbl->next->data : NULL;
+
+    invalidate_blocks(((TrackBreak *)tbl->data)->offset, next ? next->offset : G_MAXULONG);
+}
+
 static void redraw()
 {
     static int redraw_done = 1;
@@ -1384,13 +1607,7 @@ static gboolean redraw_later( gpointer data)
 
     int *redraw_done = (int*)data;
 
-    struct WaveformSurfaceDrawContext ctx = {
-        .widget = draw,
-        .pixmap_offset = pixmap_offset,
-        .list = track_breaks,
-        .graphData = sample_get_graph_data(g_sample),
-        .moodbarData = appconfig_get_show_moodbar() ? moodbarData : NULL,
-    };
+    struct WaveformSurfaceDrawContext ctx = get_draw_context(draw);
     waveform_surface_draw(sample_surface, &ctx);
     gtk_widget_queue_draw(draw);
 
@@ -1404,67 +1621,113 @@ static gboolean redraw_later( gpointer data)
     return FALSE;
 }
 
-static gboolean configure_event(GtkWidget *widget,
-    GdkEventConfigure *event, gpointer data)
+/* set up the scrollbar for the size and zoom level of the sample view */
+static void update_view_range(int width)
 {
-    if (g_sample == NULL) {
-        return FALSE;
-    }
-
-    GtkAllocation allocation;
-    gtk_widget_get_allocation(widget, &allocation);
-    int width = allocation.width;
+    long columns = get_num_columns();
 
     if (sample_get_num_sample_blocks(g_sample) == 0) {
         pixmap_offset = 0;
         gtk_adjustment_set_page_size(adj, 1);
         gtk_adjustment_set_upper(adj, 1);
         gtk_adjustment_set_page_increment(adj, 1);
-    } else if (width > sample_get_num_sample_blocks(g_sample)) {
+    } else if (width > columns) {
         pixmap_offset = 0;
-        gtk_adjustment_set_page_size(adj, sample_get_num_sample_blocks(g_sample));
-        gtk_adjustment_set_upper(adj, sample_get_num_sample_blocks(g_sample));
+        gtk_adjustment_set_page_size(adj, columns);
+        gtk_adjustment_set_upper(adj, columns);
         gtk_adjustment_set_page_increment(adj, width / 2);
     } else {
-        if (pixmap_offset + width > sample_get_num_sample_blocks(g_sample)) {
-            pixmap_offset = sample_get_num_sample_blocks(g_sample) - width;
+        if (pixmap_offset + width > columns) {
+            pixmap_offset = columns - width;
+        }
+        if (pixmap_offset < 0) {
+            pixmap_offset = 0;
         }
         gtk_adjustment_set_page_size(adj, width);
-        gtk_adjustment_set_upper(adj, sample_get_num_sample_blocks(g_sample));
+        gtk_adjustment_set_upper(adj, columns);
         gtk_adjustment_set_page_increment(adj, width / 2);
     }
 
     gtk_adjustment_set_step_increment(adj, 10);
     gtk_adjustment_set_value(adj, pixmap_offset);
+}
+
+static gboolean configure_event(GtkWidget *widget,
+    GdkEventConfigure *event, gpointer data)
+{
+    if (g_sample == NULL) {
+        return FALSE;
+    }
+
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(widget, &allocation);
+
+    update_view_range(allocation.width);
     gtk_adjustment_set_upper(cursor_marker_spinner_adj, sample_get_num_sample_blocks(g_sample) - 1);
 
-    struct WaveformSurfaceDrawContext ctx = {
-        .widget = widget,
-        .pixmap_offset = pixmap_offset,
-        .list = track_breaks,
-        .graphData = sample_get_graph_data(g_sample),
-        .moodbarData = appconfig_get_show_moodbar() ? moodbarData : NULL,
-    };
+    struct WaveformSurfaceDrawContext ctx = get_draw_context(widget);
     waveform_surface_draw(sample_surface, &ctx);
 
     return TRUE;
 }
 
+/* change the zoom level, keeping the block at x in place */
+static void set_zoom(int zoom, long x)
+{
+    int width = gtk_widget_get_allocated_width(draw);
+
+    if (g_sample == NULL || sample_get_graph_data(g_sample) == NULL) {
+        return;
+    }
+
+    /* zooming out stops once the whole file fits */
+    zoom = MIN(zoom, ZOOM_IN_MAX);
+    while (zoom < 0 && waveform_zoom_block_to_column(zoom + 1, sample_get_num_sample_blocks(g_sample)) <= width) {
+        zoom++;
+    }
+
+    if (zoom == sample_zoom) {
+        return;
+    }
+
+    long block = x_to_block(x);
+    sample_zoom = zoom;
+    pixmap_offset = block_to_column(block) - x;
+
+    update_view_range(width);
+    gtk_widget_queue_draw(scrollbar);
+
+    redraw();
+}
+
+static void menu_zoom_in(GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    set_zoom(sample_zoom + 1, gtk_widget_get_allocated_width(draw) / 2);
+}
+
+static void menu_zoom_out(GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    set_zoom(sample_zoom - 1, gtk_widget_get_allocated_width(draw) / 2);
+}
+
+static void menu_zoom_reset(GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    long x = block_to_x(cursor_marker);
+
+    if (x < 0 || x >= gtk_widget_get_allocated_width(draw)) {
+        x = gtk_widget_get_allocated_width(draw) / 2;
+    }
+
+    set_zoom(0, x);
+}
+
 static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
 {
     if (g_sample == NULL) {
         return FALSE;
     }
 
-    GList *tbl;
-    TrackBreak *tb_cur = NULL, *tb_first = NULL;
-    TrackBreak **tbs;
     const int border = 3;
-    int tbc = 0, i, border_left, border_right, text_height = 0, ellipsis_width = 0;
-    gboolean label_truncated = FALSE;
-    char tmp[1024];
-
-    cairo_text_extents_t te;
 
     GtkAllocation allocation;
     gtk_widget_get_allocation(widget, &allocation);
@@ -1472,14 +1735,15 @@ static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
     guint width = allocation.width,
           height = allocation.height;
 
-    blit_cairo_surface(cr, sample_surface->surface, width, height);
+    struct WaveformSurfaceDrawContext ctx = get_draw_context(widget);
+    waveform_surface_paint(sample_surface, cr, &ctx);
 
     cairo_set_line_width( cr, 1);
-    if( cursor_marker >= pixmap_offset && cursor_marker <= pixmap_offset + width) {
+    if (block_to_x(cursor_marker) >= 0 && block_to_x(cursor_marker) <= width) {
         /**
          * Draw RED cursor marker
          **/
-        float x = cursor_marker - pixmap_offset + 0.5f;
+        float x = block_to_x(cursor_marker) + 0.5f;
 
         cairo_set_source_rgba(cr, 1.f, 0.f, 0.f, 0.9f);
         cairo_move_to(cr, x, 0.f);
@@ -1503,7 +1767,7 @@ static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
         /**
          * Draw GREEN play marker
          **/
-        float x = sample_get_play_marker(g_sample) - pixmap_offset + 0.5f;
+        float x = block_to_x(sample_get_play_marker(g_sample)) + 0.5f;
 
         cairo_set_source_rgba(cr, 0.f, 0.7f, 0.f, 0.9f);
         cairo_move_to(cr, x, 0.f);
@@ -1515,48 +1779,30 @@ static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
      * Prepare text output (filename labels)
      **/
 
-    cairo_select_font_face( cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
-    cairo_set_font_size( cr, 10);
+    cairo_select_font_face(cr, LABEL_FONT_FACE, CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size(cr, LABEL_FONT_SIZE);
 
-    cairo_text_extents( cr, "...", &te);
-    ellipsis_width = te.width;
+    double ellipsis_width = get_label_extents(cr, "...")->width;
 
     /**
-     * Find track breaks for which we need to draw labels
+     * Find track breaks for which we need to draw labels: the track
+     * at the left edge of the view, all tracks starting in the view,
+     * and the first track after it (only for the right border)
      **/
 
-    tb_cur = NULL;
-    tbs = NULL;;
-    for( tbl = track_breaks->breaks; tbl != NULL; tbl = g_list_next( tbl)) {
-        tb_cur = tbl->data;
-        if (tb_cur != NULL) {
-            gchar *filename = track_break_get_filename(tb_cur, track_breaks);
-            cairo_text_extents(cr, filename, &te);
-            g_free(filename);
-
-            if( pixmap_offset <= tb_cur->offset) {
-                if( tbs == NULL && tb_first != NULL) {
-                    tbs = (TrackBreak**)malloc( sizeof( TrackBreak*));
-                    tbs[tbc] = tb_first;
-                    tbc++;
-                }
-                tbs = (TrackBreak**)realloc( tbs, (tbc+1)*sizeof( TrackBreak*));
-                tbs[tbc] = tb_cur;
-                tbc++;
-                if( te.height > text_height) {
-                    text_height = te.height;
-                }
-            }
+    GPtrArray *tbs = g_ptr_array_new();
+    for (GList *tbl = track_breaks->breaks; tbl != NULL; tbl = g_list_next(tbl)) {
+        TrackBreak *tb_cur = tbl->data;
+        long x = block_to_x(tb_cur->offset);
 
-            tb_first = tb_cur;
+        if (x <= 0 && tbs->len > 0) {
+            g_ptr_array_set_size(tbs, 0);
         }
-    }
+        g_ptr_array_add(tbs, tb_cur);
 
-    if( tbs == NULL && tb_first != NULL) {
-        tbs = (TrackBreak**)malloc( sizeof( TrackBreak*));
-        tbs[tbc] = tb_first;
-        tbc++;
-        text_height = te.height;
+        if (x > (long)width) {
+            break;
+        }
     }
 
     /**
@@ -1564,45 +1810,56 @@ static gboolean draw_draw_event(GtkWidget *widget, cairo_t *cr, gpointer data)
      * finally draw the label with the right size and position
      **/
 
-    for( i=0; i<tbc; i++) {
-        if( !(tbs[i]->write)) {
+    gchar **labels = g_new0(gchar *, tbs->len);
+    double text_height = 0;
+    for (guint i=0; i<tbs->len; i++) {
+        TrackBreak *tb = g_ptr_array_index(tbs, i);
+        if (tb->write && block_to_x(tb->offset) <= (long)width) {
+            labels[i] = track_break_get_filename(tb, track_breaks);
+            text_height = MAX(text_height, get_label_extents(cr, labels[i])->height);
+        }
+    }
+
+    for (guint i=0; i<tbs->len; i++) {
+        if (labels[i] == NULL) {
             continue;
         }
-        border_left = (tbs[i]->offset > pixmap_offset)?(tbs[i]->offset - pixmap_offset):(0);
-        border_right = (i+1 == tbc)?(width+100):(tbs[i+1]->offset - pixmap_offset);
 
-        gchar *filename = track_break_get_filename(tbs[i], track_breaks);
-        strcpy(tmp, filename);
-        g_free(filename);
+        TrackBreak *tb = g_ptr_array_index(tbs, i);
+        double border_left = CLAMP(block_to_x(tb->offset), 0, width+100);
+        double border_right = (i+1 == tbs->len) ? (width+100) :
+            CLAMP(block_to_x(((TrackBreak *)g_ptr_array_index(tbs, i+1))->offset), 0, width+100);
 
-        cairo_text_extents( cr, tmp, &te);
-        label_truncated = FALSE;
-        while( border_left + te.width + ellipsis_width + border*2 > border_right - border*2 && strlen( tmp) > 1) {
-            tmp[strlen( tmp)-1] = '\0';
-            cairo_text_extents( cr, tmp, &te);
-            label_truncated = TRUE;
-        }
-        if( label_truncated) {
-            strcat( tmp, "...");
-            cairo_text_extents( cr, tmp, &te);
-            if( border_left + te.width + border*2 > border_right - border*2) {
-                border_left -= (border_left + te.width + border*2) - (border_right - border*2);
+        double max_width = (border_right - border*2) - (border_left + border*2);
+        double label_width = get_label_extents(cr, labels[i])->width;
+
+        if (label_width > max_width && g_utf8_strlen(labels[i], -1) > 1) {
+            gchar *truncated = ellipsize_label(cr, labels[i], max_width - ellipsis_width);
+            g_free(labels[i]);
+            labels[i] = truncated;
+
+            cairo_text_extents_t te;
+            cairo_text_extents(cr, labels[i], &te);
+            label_width = te.width;
+            if (border_left + label_width + border*2 > border_right - border*2) {
+                border_left -= (border_left + label_width + border*2) - (border_right - border*2);
             }
         }
 
         cairo_set_source_rgba(cr, 1.f, 1.f, 1.f, 0.8f);
-        cairo_rectangle(cr, border_left, height - text_height - border*2, te.width + border*2, text_height + border*2);
+        cairo_rectangle(cr, border_left, height - text_height - border*2, label_width + border*2, text_height + border*2);
         cairo_fill(cr);
 
         cairo_set_source_rgb(cr, 0.f, 0.f, 0.f);
         cairo_move_to(cr, border_left + border, height - (text_height+1)/2);
-        cairo_show_text(cr, tmp);
-    }
+        cairo_show_text(cr, labels[i]);
 
-    if( tbs != NULL) {
-        free( tbs);
+        g_free(labels[i]);
     }
 
+    g_free(labels);
+    g_ptr_array_free(tbs, TRUE);
+
     return FALSE;
 }
 
@@ -1615,13 +1872,7 @@ draw_summary_configure_event(GtkWidget *widget,
         return FALSE;
     }
 
-    struct WaveformSurfaceDrawContext ctx = {
-        .widget = widget,
-        .pixmap_offset = pixmap_offset,
-        .list = track_breaks,
-        .graphData = sample_get_graph_data(g_sample),
-        .moodbarData = appconfig_get_show_moodbar() ? moodbarData : NULL,
-    };
+    struct WaveformSurfaceDrawContext ctx = get_draw_context(widget);
     waveform_surface_draw(summary_surface, &ctx);
 
     return TRUE;
@@ -1643,24 +1894,29 @@ draw_summary_draw_event(GtkWidget *widget, cairo_t *cr, gpointer user_data)
 
     summary_scale = (float)(sample_get_num_sample_blocks(g_sample)) / (float)(width);
 
+    /* blocks shown in the sample view */
+    long view_start = column_to_block(pixmap_offset);
+    long view_end = column_to_block(pixmap_offset + gtk_widget_get_allocated_width(draw));
+
     /**
      * Draw shadow in summary pixmap to show current view
      **/
 
-    blit_cairo_surface(cr, summary_surface->surface, width, height);
+    struct WaveformSurfaceDrawContext ctx = get_draw_context(widget);
+    waveform_surface_paint(summary_surface, cr, &ctx);
 
     cairo_set_source_rgba( cr, 0, 0, 0, 0.3);
-    cairo_rectangle( cr, 0, 0, pixmap_offset / summary_scale, height);
+    cairo_rectangle( cr, 0, 0, view_start / summary_scale, height);
     cairo_fill( cr);
-    cairo_rectangle( cr, (pixmap_offset+width) / summary_scale, 0, width - (pixmap_offset+width) / summary_scale, height);
+    cairo_rectangle( cr, view_end / summary_scale, 0, width - view_end / summary_scale, height);
     cairo_fill( cr);
 
     cairo_set_source_rgba( cr, 1, 1, 1, 0.6);
     cairo_set_line_width( cr, 1);
-    cairo_move_to( cr, (int)(pixmap_offset / summary_scale) + 0.5, 0);
-    cairo_line_to( cr, (int)(pixmap_offset / summary_scale) + 0.5, height);
-    cairo_move_to( cr, (int)((pixmap_offset+width) / summary_scale) + 0.5, 0);
-    cairo_line_to( cr, (int)((pixmap_offset+width) / summary_scale) + 0.5, height);
+    cairo_move_to( cr, (int)(view_start / summary_scale) + 0.5, 0);
+    cairo_line_to( cr, (int)(view_start / summary_scale) + 0.5, height);
+    cairo_move_to( cr, (int)(view_end / summary_scale) + 0.5, 0);
+    cairo_line_to( cr, (int)(view_end / summary_scale) + 0.5, height);
     cairo_stroke( cr);
 
     return FALSE;
@@ -1710,11 +1966,20 @@ static gboolean draw_summary_button_release(GtkWidget *widget,
 }
 
 void reset_sample_display(guint midpoint)
+{
+    if (!g_sample) {
+        return;
+    }
+
+    set_sample_display_offset(block_to_column(midpoint) - gtk_widget_get_allocated_width(draw) / 2);
+}
+
+/* scroll the sample view to start at the given column */
+static void set_sample_display_offset(long start)
 {
     GtkAllocation allocation;
     gtk_widget_get_allocation(draw, &allocation);
     int width = allocation.width;
-    int start = midpoint - width / 2;
 
     if (!g_sample) {
         return;
@@ -1722,10 +1987,10 @@ void reset_sample_display(guint midpoint)
 
     if (sample_get_num_sample_blocks(g_sample) == 0) {
         pixmap_offset = 0;
-    } else if (width > sample_get_num_sample_blocks(g_sample)) {
+    } else if (width > get_num_columns()) {
         pixmap_offset = 0;
-    } else if (start + width > sample_get_num_sample_blocks(g_sample)) {
-        pixmap_offset = sample_get_num_sample_blocks(g_sample) - width;
+    } else if (start + width > get_num_columns()) {
+        pixmap_offset = get_num_columns() - width;
     } else {
         pixmap_offset = start;
     }
@@ -1800,6 +2065,17 @@ static gboolean scroll_event( GtkWidget *widget, GdkEventScroll *event, gpointer
 {
     long step, upper, size;
 
+    if (widget == draw && (event->state & GDK_CONTROL_MASK)) {
+        /* Zoom around the mouse pointer */
+        if (event->direction == GDK_SCROLL_UP) {
+            set_zoom(sample_zoom + 1, event->x);
+        } else if (event->direction == GDK_SCROLL_DOWN) {
+            set_zoom(sample_zoom - 1, event->x);
+        }
+
+        return TRUE;
+    }
+
     step = gtk_adjustment_get_page_increment(adj);
     upper = gtk_adjustment_get_upper(adj);
     size = gtk_adjustment_get_page_size(adj);
@@ -1842,18 +2118,23 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
         return TRUE;
     }
 
-    if (event->x + pixmap_offset > sample_get_num_sample_blocks(g_sample)) {
+    if (x_to_block(event->x) > sample_get_num_sample_blocks(g_sample)) {
         return TRUE;
     }
 
+    int w = gtk_widget_get_allocated_width(widget);
+
     if (sample_is_playing(g_sample)) {
+        /* clicking while playing continues playback from there */
+        if (event->type == GDK_BUTTON_RELEASE && event->button == 1 && event->x >= 0 && event->x < w) {
+            cursor_marker = x_to_block(event->x);
+            sample_seek(g_sample, cursor_marker);
+            update_status(FALSE);
+        }
+
         return TRUE;
     }
 
-    int w = gtk_widget_get_allocated_width(widget);
-
-    int center = pixmap_offset + w/2;
-
     static const int MINIMUM_SCROLL_STEP = 10;
     static const int MAXIMUM_SCROLL_STEP = 50;
 
@@ -1866,9 +2147,9 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
             offset = -MAXIMUM_SCROLL_STEP;
         }
 
-        reset_sample_display(center + offset);
+        set_sample_display_offset(pixmap_offset + offset);
 
-        cursor_marker = pixmap_offset;
+        cursor_marker = x_to_block(0);
     } else if (event->x > w-1) {
         // scroll right
         int offset = event->x - (w-1);
@@ -1878,11 +2159,11 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
             offset = MAXIMUM_SCROLL_STEP;
         }
 
-        reset_sample_display(center + offset);
+        set_sample_display_offset(pixmap_offset + offset);
 
-        cursor_marker = pixmap_offset + w-1;
+        cursor_marker = x_to_block(w-1);
     } else {
-        cursor_marker = pixmap_offset + event->x;
+        cursor_marker = x_to_block(event->x);
     }
 
     if (event->type == GDK_BUTTON_RELEASE && event->button == 3) {
@@ -1892,6 +2173,12 @@ static gboolean button_release(GtkWidget *widget, GdkEventButton *event,
         g_menu_append(menu_model, _("Remove track break"), "win.remove_break");
         g_menu_append(menu_model, _("Jump to cursor marker"), "win.jump_cursor");
 
+        GMenu *zoom_model = g_menu_new();
+        g_menu_append(zoom_model, _("Zoom in"), "win.zoom_in");
+        g_menu_append(zoom_model, _("Zoom out"), "win.zoom_out");
+        g_menu_append(zoom_model, _("Reset zoom"), "win.zoom_reset");
+        g_menu_append_section(menu_model, NULL, G_MENU_MODEL(zoom_model));
+
         GtkMenu *menu = GTK_MENU(gtk_menu_new_from_model(G_MENU_MODEL(menu_model)));
         gtk_menu_attach_to_widget(menu, main_window, NULL);
         gtk_menu_popup_at_pointer(GTK_MENU(menu), NULL);
@@ -1994,7 +2281,19 @@ static void update_status(gboolean update_time_offset) {
         strcat(str, strbuf);
     }
 
-    gtk_header_bar_set_subtitle(GTK_HEADER_BAR(header_bar), str);
+    /* called for every frame while playing, but the text changes less often */
+    const gchar *subtitle = gtk_header_bar_get_subtitle(GTK_HEADER_BAR(header_bar));
+    if (subtitle == NULL || strcmp(subtitle, str) != 0) {
+        gtk_header_bar_set_subtitle(GTK_HEADER_BAR(header_bar), str);
+    }
+}
+
+static void play_started()
+{
+    if (play_progress_tick_id == 0) {
+        play_progress_tick_id = gtk_widget_add_tick_callback(draw, file_play_progress_tick, NULL, NULL);
+    }
+    set_stop_icon();
 }
 
 static void menu_play(GtkWidget *widget, gpointer user_data)
@@ -2008,11 +2307,7 @@ static void menu_play(GtkWidget *widget, gpointer user_data)
 
     switch (sample_play(g_sample, cursor_marker)) {
         case 0:
-            if (play_progress_source_id) {
-                g_source_remove(play_progress_source_id);
-            }
-            play_progress_source_id = g_timeout_add(10, file_play_progress_idle_func, NULL);
-            set_stop_icon();
+            play_started();
             break;
         case 1:
             printf("error in play_sample\n");
@@ -2042,6 +2337,35 @@ static void menu_stop(GtkWidget *widget, gpointer user_data)
     }
 }
 
+static void
+menu_audition(GSimpleAction *action, GVariant *parameter, gpointer user_data)
+{
+    if (g_sample == NULL) {
+        return;
+    }
+
+    menu_stop(NULL, NULL);
+
+    /* the selected track break and all after it, except the start of the file */
+    guint from = track_break_find_offset();
+    GArray *positions = g_array_new(FALSE, FALSE, sizeof(gulong));
+
+    for (GList *cur = track_breaks->breaks; cur != NULL; cur = g_list_next(cur)) {
+        TrackBreak *tb = cur->data;
+
+        if (tb->offset > 0 && tb->offset >= from) {
+            g_array_append_val(positions, tb->offset);
+        }
+    }
+
+    if (sample_audition(g_sample, (const gulong *)positions->data, positions->len,
+                AUDITION_SECONDS * CD_BLOCKS_PER_SEC, AUDITION_SECONDS * CD_BLOCKS_PER_SEC) == 0) {
+        play_started();
+    }
+
+    g_array_free(positions, TRUE);
+}
+
 static void
 menu_jump_to(GtkWidget *widget, gpointer user_data)
 {
@@ -2312,10 +2636,19 @@ wavbreaker_update_moodbar_state()
         moodbar_free(moodbarData);
     }
     moodbarData = moodbar_open(sample_get_filename(g_sample));
-    set_action_enabled("display_moodbar", moodbarData != NULL);
-    set_action_enabled("generate_moodbar", moodbarData == NULL);
 
-    redraw();
+    /* the analysis skips the moodbar if it was not shown when the file was opened */
+    if (moodbarData == NULL && appconfig_get_show_moodbar() && sample_is_loaded(g_sample)) {
+        sample_compute_moodbar(g_sample);
+    }
+
+    /* if it is not shown, it may not have been computed yet */
+    gboolean available = (get_moodbar() != NULL || !appconfig_get_show_moodbar());
+    set_action_enabled("display_moodbar", available);
+    set_action_enabled("generate_moodbar", moodbarData == NULL && available);
+
+    /* the new moodbar may have been allocated where the old one was */
+    force_redraw();
 }
 
 static void
@@ -2334,7 +2667,23 @@ menu_view_moodbar(GSimpleAction *action, GVariant *parameter, gpointer user_data
 static void
 menu_moodbar(GSimpleAction *action, GVariant *parameter, gpointer user_data)
 {
-    moodbar_generate(main_window, sample_get_filename(g_sample));
+    /* usually computed in the analysis already, this saves it for other applications */
+    const MoodbarData *data = sample_compute_moodbar(g_sample);
+
+    if (data == NULL) {
+        popupmessage_show(main_window, _("Cannot generate moodbar"), _("The moodbar cannot be computed for the sample format of this file."));
+        return;
+    }
+
+    gchar *moodbar_filename = moodbar_get_filename(sample_get_filename(g_sample));
+
+    if (!moodbar_write(data, moodbar_filename)) {
+        popupmessage_show(main_window, _("Cannot generate moodbar"), _("The moodbar file could not be written."));
+    }
+
+    free(moodbar_filename);
+
+    wavbreaker_update_moodbar_state();
 }
 #endif
 
@@ -2393,6 +2742,8 @@ static void save_window_sizes()
 void wavbreaker_quit() {
     if (g_sample != NULL) {
         sample_stop(g_sample);
+        /* tiles of zoomed in views are rendered from the audio data */
+        waveform_surface_cancel(sample_surface);
         sample_close(g_steal_pointer(&g_sample));
     }
 
@@ -2421,9 +2772,9 @@ void wavbreaker_quit() {
         redraw_source_id = 0;
     }
 
-    if (play_progress_source_id) {
-        g_source_remove(play_progress_source_id);
-        play_progress_source_id = 0;
+    if (play_progress_tick_id) {
+        gtk_widget_remove_tick_callback(draw, play_progress_tick_id);
+        play_progress_tick_id = 0;
     }
 
     save_window_sizes();
@@ -2570,12 +2921,24 @@ do_activate(GApplication *app, gpointer user_data)
         { "auto_rename", menu_rename, NULL, NULL, NULL, },
         { "remove_break", menu_delete_track_break, NULL, NULL, NULL, },
         { "jump_break", jump_to_track_break, NULL, NULL, NULL, },
+        { "audition", menu_audition, NULL, NULL, NULL, },
+
+        { "zoom_in", menu_zoom_in, NULL, NULL, NULL, },
+        { "zoom_out", menu_zoom_out, NULL, NULL, NULL, },
+        { "zoom_reset", menu_zoom_reset, NULL, NULL, NULL, },
     };
 
     g_action_map_add_action_entries(G_ACTION_MAP(main_window),
             entries, G_N_ELEMENTS(entries),
             main_window);
 
+    static const gchar *ZOOM_IN_ACCELS[] = { "<Primary>plus", "<Primary>equal", NULL };
+    static const gchar *ZOOM_OUT_ACCELS[] = { "<Primary>minus", NULL };
+    static const gchar *ZOOM_RESET_ACCELS[] = { "<Primary>0", NULL };
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app), "win.zoom_in", ZOOM_IN_ACCELS);
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app), "win.zoom_out", ZOOM_OUT_ACCELS);
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app), "win.zoom_reset", ZOOM_RESET_ACCELS);
+
     set_action_enabled("add_break", FALSE);
     set_action_enabled("jump_cursor", FALSE);
 
@@ -2586,6 +2949,11 @@ do_activate(GApplication *app, gpointer user_data)
     set_action_enabled("auto_rename", FALSE);
     set_action_enabled("remove_break", FALSE);
     set_action_enabled("jump_break", FALSE);
+    set_action_enabled("audition", FALSE);
+
+    set_action_enabled("zoom_in", FALSE);
+    set_action_enabled("zoom_out", FALSE);
+    set_action_enabled("zoom_reset", FALSE);
 
     set_action_enabled("export", FALSE);
     set_action_enabled("import", FALSE);
@@ -2865,10 +3233,6 @@ do_open(GApplication *application, gpointer files, gint n_files, gchar *hint, gp
 static void
 do_shutdown(GApplication *application, gpointer user_data)
 {
-#if defined(WANT_MOODBAR)
-    moodbar_abort();
-#endif
-
     waveform_surface_free(sample_surface);
     waveform_surface_free(summary_surface);
 
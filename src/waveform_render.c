@@ -0,0 +1,283 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "waveform_render.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Generated using the following Python 3 snippet (with some editing):
+ *
+ * import colorsys
+ * for i in range(6):
+ *     print('    { %3d, %3d, %3d, },' % tuple(int(x*255)
+ *           for x in colorsys.hsv_to_rgb(i/8., 0.8, 0.8)))
+ **/
+static const unsigned char SAMPLE_COLORS_VALUES[WAVEFORM_TRACK_COLORS][3] = {
+    { 204,  40,  40, },
+    { 204, 163,  40, },
+    { 122, 204,  40, },
+    {  40,  81, 204, },
+    {  40, 204, 204, },
+};
+
+#define SAMPLE_SHADES 3
+
+const WaveformColor waveform_background_color = { .red = 1.f, .green = 1.f, .blue = 1.f, .alpha = 1.f };
+
+static const WaveformColor NOWRITE_COLOR = { .red = 0.86f, .green = 0.86f, .blue = 0.86f, .alpha = 1.f };
+
+/* track color (or NOWRITE_COLOR) of each shade, from the peaks towards the x axis */
+static WaveformColor
+sample_color(int color, int shade)
+{
+    if (color >= WAVEFORM_TRACK_COLORS) {
+        return NOWRITE_COLOR;
+    }
+
+    float factor_white = 0.5f*((float)shade/(float)SAMPLE_SHADES);
+    float factor_color = 1.f-factor_white;
+
+    return (WaveformColor){
+        .red = SAMPLE_COLORS_VALUES[color][0]/255.f*factor_color+factor_white,
+        .green = SAMPLE_COLORS_VALUES[color][1]/255.f*factor_color+factor_white,
+        .blue = SAMPLE_COLORS_VALUES[color][2]/255.f*factor_color+factor_white,
+        .alpha = 1.f,
+    };
+}
+
+void
+waveform_raster_attach(struct WaveformRaster *raster, cairo_surface_t *surface, int width, int height)
+{
+    double x_scale, y_scale;
+    cairo_surface_get_device_scale(surface, &x_scale, &y_scale);
+
+    cairo_surface_flush(surface);
+
+    raster->data = cairo_image_surface_get_data(surface);
+    raster->stride = cairo_image_surface_get_stride(surface);
+    raster->scale = MAX((int)x_scale, 1);
+    raster->width = width;
+    raster->height = height;
+}
+
+void
+waveform_raster_end(cairo_surface_t *surface)
+{
+    cairo_surface_mark_dirty(surface);
+}
+
+void
+waveform_raster_fill_span(struct WaveformRaster *raster, int x, int y0, int y1, guint32 pixel)
+{
+    if (y0 > y1) {
+        int tmp = y0;
+        y0 = y1;
+        y1 = tmp;
+    }
+
+    y0 = CLAMP(y0, 0, raster->height) * raster->scale;
+    y1 = CLAMP(y1, 0, raster->height) * raster->scale;
+
+    if (x < 0 || x >= raster->width) {
+        return;
+    }
+
+    for (int y=y0; y<y1; y++) {
+        guint32 *row = (guint32 *)(raster->data + (size_t)y * raster->stride);
+
+        for (int dx=0; dx<raster->scale; dx++) {
+            row[x * raster->scale + dx] = pixel;
+        }
+    }
+}
+
+void
+waveform_raster_fill(struct WaveformRaster *raster, guint32 pixel)
+{
+    int width = raster->width * raster->scale;
+
+    for (int y=0; y<raster->height * raster->scale; y++) {
+        guint32 *row = (guint32 *)(raster->data + (size_t)y * raster->stride);
+
+        for (int x=0; x<width; x++) {
+            row[x] = pixel;
+        }
+    }
+}
+
+void
+waveform_raster_draw_column(struct WaveformRaster *raster, int x, int y_min, int y_max, int xaxis, int color)
+{
+    static guint32 pixels[WAVEFORM_TRACK_COLORS + 1][SAMPLE_SHADES];
+    static gsize pixels_initialized = 0;
+
+    /* this is also called from the tile rendering thread of the GUI */
+    if (g_once_init_enter(&pixels_initialized)) {
+        for (int i=0; i<=WAVEFORM_TRACK_COLORS; i++) {
+            for (int shade=0; shade<SAMPLE_SHADES; shade++) {
+                pixels[i][shade] = waveform_color_to_pixel(sample_color(i, shade));
+            }
+        }
+        g_once_init_leave(&pixels_initialized, 1);
+    }
+
+    color = MIN(color, WAVEFORM_TRACK_COLORS);
+
+    for (int shade=0; shade<SAMPLE_SHADES; shade++) {
+        guint32 pixel = pixels[color][shade];
+
+        waveform_raster_fill_span(raster, x, y_min+(xaxis-y_min)*shade/SAMPLE_SHADES, y_min+(xaxis-y_min)*(shade+1)/SAMPLE_SHADES, pixel);
+        waveform_raster_fill_span(raster, x, y_max-(y_max-xaxis)*shade/SAMPLE_SHADES, y_max-(y_max-xaxis)*(shade+1)/SAMPLE_SHADES, pixel);
+    }
+}
+
+/* moodbar color at a position (0..1) of the file, interpolated between frames */
+static guint32
+moodbar_pixel(const MoodbarData *moodbar, double position)
+{
+    double index = position * moodbar->numFrames;
+    unsigned long iindex = MIN((unsigned long)index, moodbar->numFrames - 1);
+    const guint8 *a = moodbar->rgb + iindex * 3;
+    const guint8 *b = (iindex + 1 < moodbar->numFrames) ? a + 3 : a;
+    double fractional = index - iindex;
+
+    guint32 pixel = 0;
+    for (int i=0; i<3; i++) {
+        /* CAIRO_FORMAT_RGB24 pixels are native-endian 0x00RRGGBB */
+        pixel = (pixel << 8) | (guint32)((1.0 - fractional) * a[i] + fractional * b[i] + 0.5);
+    }
+
+    return pixel;
+}
+
+const guint32 *
+waveform_moodbar_lut_get(struct WaveformMoodbarLut *lut, const MoodbarData *moodbar, unsigned long size)
+{
+    if (moodbar == NULL || moodbar->numFrames == 0 || size == 0) {
+        return NULL;
+    }
+
+    if (lut->moodbar != moodbar || lut->size != size) {
+        lut->pixels = g_renew(guint32, lut->pixels, size);
+
+        for (unsigned long i=0; i<size; i++) {
+            lut->pixels[i] = moodbar_pixel(moodbar, (double)i / (double)size);
+        }
+
+        lut->moodbar = moodbar;
+        lut->size = size;
+    }
+
+    return lut->pixels;
+}
+
+void
+waveform_moodbar_lut_clear(struct WaveformMoodbarLut *lut)
+{
+    g_free(lut->pixels);
+
+    lut->moodbar = NULL;
+    lut->size = 0;
+    lut->pixels = NULL;
+}
+
+void
+waveform_render_overview(struct WaveformRaster *raster, GraphData *graphData, TrackBreakList *list,
+        const guint32 *moodbar_pixels, gboolean damaged, unsigned long first_block, unsigned long last_block)
+{
+    int xaxis;
+    int width = raster->width, height = raster->height;
+    int y_min, y_max;
+    int min, max;
+    int scale;
+    int i, k;
+    int loop_end, array_offset;
+
+    float x_scale;
+
+    xaxis = height / 2;
+    if (xaxis != 0) {
+        scale = graphData->maxSampleValue / xaxis;
+        if (scale == 0) {
+            scale = 1;
+        }
+    } else {
+        scale = 1;
+    }
+
+    /* draw sample graph */
+
+    x_scale = (float)(graphData->numSamples) / (float)(width);
+    if (x_scale == 0) {
+        x_scale = 1;
+    }
+
+    int tb_index = 0;
+    GList *tbl = list->breaks;
+    for (i = 0; i < width && i < graphData->numSamples; i++) {
+        min = max = 0;
+        array_offset = (int)(i * x_scale);
+
+        /* find the track break we are drawing now */
+        while (tbl->next && array_offset > ((TrackBreak *)(tbl->next->data))->offset) {
+            tbl = tbl->next;
+            ++tb_index;
+        }
+
+        if (damaged) {
+            if ((unsigned long)array_offset < first_block || (unsigned long)array_offset > last_block) {
+                continue;
+            }
+
+            waveform_raster_fill_span(raster, i, 0, height, waveform_color_to_pixel(waveform_background_color));
+        }
+
+        if (x_scale != 1) {
+            loop_end = (int)x_scale;
+
+            for (k = 0; k < loop_end; k++) {
+                if (graphData->data[array_offset + k].max > max) {
+                    max = graphData->data[array_offset + k].max;
+                } else if (graphData->data[array_offset + k].min < min) {
+                    min = graphData->data[array_offset + k].min;
+                }
+            }
+        } else {
+            min = graphData->data[i].min;
+            max = graphData->data[i].max;
+        }
+
+        y_min = min;
+        y_max = max;
+
+        y_min = xaxis + fabs((double)y_min) / scale;
+        y_max = xaxis - y_max / scale;
+
+        if (moodbar_pixels != NULL) {
+            waveform_raster_fill_span(raster, i, 0, height, moodbar_pixels[i]);
+        }
+
+        waveform_raster_draw_column(raster, i, y_min, y_max, xaxis, waveform_track_color(tbl->data, tb_index));
+    }
+}
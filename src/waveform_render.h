@@ -0,0 +1,129 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include "sample.h"
+#include "track_break.h"
+#include "moodbar.h"
+
+#include <glib.h>
+#include <cairo.h>
+
+/**
+ * Rasterization of waveforms into cairo image surfaces, shared by the
+ * views of the GUI (draw.c) and "wavcli render". Nothing in here needs
+ * GTK or a display.
+ **/
+
+typedef struct WaveformColor_ WaveformColor;
+struct WaveformColor_ {
+    double red;
+    double green;
+    double blue;
+    double alpha;
+};
+
+/* number of track colors, tracks that are not written are drawn in grey */
+#define WAVEFORM_TRACK_COLORS 5
+
+extern const WaveformColor waveform_background_color;
+
+/**
+ * Pixels of a CAIRO_FORMAT_RGB24 image surface the waveform is written
+ * to directly, one span of pixels per shade and column, instead of
+ * stroking thousands of separate cairo paths.
+ **/
+struct WaveformRaster {
+    unsigned char *data;
+    int stride;
+    /* device pixels per logical pixel (HiDPI) */
+    int scale;
+    /* in logical pixels */
+    int width;
+    int height;
+};
+
+static inline guint32
+waveform_color_to_pixel(WaveformColor color)
+{
+    /* CAIRO_FORMAT_RGB24 pixels are native-endian 0x00RRGGBB */
+    return ((guint32)(color.red * 255.f + 0.5f) << 16) |
+           ((guint32)(color.green * 255.f + 0.5f) << 8) |
+           ((guint32)(color.blue * 255.f + 0.5f));
+}
+
+/**
+ * Start writing to an image surface of width x height logical pixels,
+ * the device scale of the surface is taken into account.
+ **/
+void
+waveform_raster_attach(struct WaveformRaster *raster, cairo_surface_t *surface, int width, int height);
+
+void
+waveform_raster_end(cairo_surface_t *surface);
+
+/* fill rows [y0, y1) of column x (in either order), in logical pixels */
+void
+waveform_raster_fill_span(struct WaveformRaster *raster, int x, int y0, int y1, guint32 pixel);
+
+void
+waveform_raster_fill(struct WaveformRaster *raster, guint32 pixel);
+
+/* one column of the waveform, shaded from the peaks towards the x axis */
+void
+waveform_raster_draw_column(struct WaveformRaster *raster, int x, int y_min, int y_max, int xaxis, int color);
+
+/* palette index of the waveform color of a track, WAVEFORM_TRACK_COLORS if it is not written */
+static inline int
+waveform_track_color(TrackBreak *tb, int tb_index)
+{
+    return tb->write ? (tb_index % WAVEFORM_TRACK_COLORS) : WAVEFORM_TRACK_COLORS;
+}
+
+/**
+ * Moodbar colors as pixels for the columns of a view, so that drawing the
+ * moodbar is one table lookup per column. The table is only computed again
+ * when the moodbar or the number of columns changes.
+ **/
+struct WaveformMoodbarLut {
+    const MoodbarData *moodbar;
+    unsigned long size;
+    guint32 *pixels;
+};
+
+/**
+ * Pixels of size columns spanning the whole file (column i is at position
+ * i / size), NULL if moodbar is NULL or empty.
+ **/
+const guint32 *
+waveform_moodbar_lut_get(struct WaveformMoodbarLut *lut, const MoodbarData *moodbar, unsigned long size);
+
+void
+waveform_moodbar_lut_clear(struct WaveformMoodbarLut *lut);
+
+/**
+ * Draw the whole file into the raster, one column per pixel, with the
+ * tracks in their colors and the moodbar (if not NULL, one pixel per
+ * column of the raster) as background. If damaged is set, only the
+ * columns starting at blocks first_block to last_block are repainted
+ * and the rest of the raster is kept.
+ **/
+void
+waveform_render_overview(struct WaveformRaster *raster, GraphData *graphData, TrackBreakList *list,
+        const guint32 *moodbar_pixels, gboolean damaged, unsigned long first_block, unsigned long last_block);
@@ -0,0 +1,162 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <config.h>
+
+#include "xxh64.h"
+
+#include <string.h>
+
+#define XXH_PRIME64_1 G_GUINT64_CONSTANT(0x9E3779B185EBCA87)
+#define XXH_PRIME64_2 G_GUINT64_CONSTANT(0xC2B2AE3D27D4EB4F)
+#define XXH_PRIME64_3 G_GUINT64_CONSTANT(0x165667B19E3779F9)
+#define XXH_PRIME64_4 G_GUINT64_CONSTANT(0x85EBCA77C2B2AE63)
+#define XXH_PRIME64_5 G_GUINT64_CONSTANT(0x27D4EB2F165667C5)
+
+static inline uint64_t
+xxh64_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+xxh64_read64(const unsigned char *p)
+{
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return GUINT64_FROM_LE(value);
+}
+
+static inline uint32_t
+xxh64_read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return GUINT32_FROM_LE(value);
+}
+
+static inline uint64_t
+xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = xxh64_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t
+xxh64_merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+void
+xxh64_init(Xxh64State *state)
+{
+    memset(state, 0, sizeof(*state));
+
+    state->acc[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    state->acc[1] = XXH_PRIME64_2;
+    state->acc[2] = 0;
+    state->acc[3] = -XXH_PRIME64_1;
+}
+
+static void
+xxh64_consume_stripe(Xxh64State *state, const unsigned char *p)
+{
+    for (int i=0; i<4; ++i) {
+        state->acc[i] = xxh64_round(state->acc[i], xxh64_read64(p + 8 * i));
+    }
+}
+
+void
+xxh64_update(Xxh64State *state, const unsigned char *buf, size_t size)
+{
+    state->total_len += size;
+
+    if (state->buffer_size > 0) {
+        size_t n = MIN(size, sizeof(state->buffer) - state->buffer_size);
+        memcpy(state->buffer + state->buffer_size, buf, n);
+        state->buffer_size += n;
+        buf += n;
+        size -= n;
+
+        if (state->buffer_size < sizeof(state->buffer)) {
+            return;
+        }
+
+        xxh64_consume_stripe(state, state->buffer);
+        state->buffer_size = 0;
+    }
+
+    while (size >= 32) {
+        xxh64_consume_stripe(state, buf);
+        buf += 32;
+        size -= 32;
+    }
+
+    memcpy(state->buffer, buf, size);
+    state->buffer_size = size;
+}
+
+uint64_t
+xxh64_digest(const Xxh64State *state)
+{
+    uint64_t h;
+
+    if (state->total_len >= 32) {
+        h = xxh64_rotl(state->acc[0], 1) + xxh64_rotl(state->acc[1], 7) +
+            xxh64_rotl(state->acc[2], 12) + xxh64_rotl(state->acc[3], 18);
+
+        for (int i=0; i<4; ++i) {
+            h = xxh64_merge_round(h, state->acc[i]);
+        }
+    } else {
+        h = XXH_PRIME64_5;
+    }
+
+    h += state->total_len;
+
+    const unsigned char *p = state->buffer;
+    size_t remaining = state->buffer_size;
+
+    for (; remaining >= 8; p += 8, remaining -= 8) {
+        h ^= xxh64_round(0, xxh64_read64(p));
+        h = xxh64_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+
+    if (remaining >= 4) {
+        h ^= (uint64_t)xxh64_read32(p) * XXH_PRIME64_1;
+        h = xxh64_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+        remaining -= 4;
+    }
+
+    for (; remaining > 0; ++p, --remaining) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = xxh64_rotl(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
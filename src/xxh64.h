@@ -0,0 +1,46 @@
+/* wavbreaker - A tool to split a wave file up into multiple waves.
+ * Copyright (C) 2022 Thomas Perl
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Streaming XXH64 (seed 0), a fast non-cryptographic hash, see
+ * https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+ **/
+
+typedef struct Xxh64State_ Xxh64State;
+struct Xxh64State_ {
+    uint64_t acc[4];
+    uint64_t total_len;
+    unsigned char buffer[32];
+    size_t buffer_size;
+};
+
+void
+xxh64_init(Xxh64State *state);
+
+void
+xxh64_update(Xxh64State *state, const unsigned char *buf, size_t size);
+
+uint64_t
+xxh64_digest(const Xxh64State *state);